@@ -29,17 +29,15 @@
 #include <seastar/core/timer.hh>
 #include <seastar/core/thread.hh>
 #include <seastar/core/print.hh>
+#include <seastar/core/bitops.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/json/formatter.hh>
+#include <seastar/util/std-compat.hh>
 #include <chrono>
 #include <vector>
+#include <fstream>
 #include <boost/range/irange.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/max.hpp>
-#include <boost/accumulators/statistics/mean.hpp>
-#include <boost/accumulators/statistics/p_square_quantile.hpp>
-#include <boost/accumulators/statistics/extended_p_square.hpp>
-#include <boost/accumulators/statistics/extended_p_square_quantile.hpp>
 #include <boost/range/adaptor/filtered.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include <boost/array.hpp>
@@ -49,7 +47,6 @@
 
 using namespace seastar;
 using namespace std::chrono_literals;
-using namespace boost::accumulators;
 
 static auto random_seed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 static std::default_random_engine random_generator(random_seed);
@@ -95,11 +92,30 @@ struct shard_info {
     unsigned parallelism = 10;
     unsigned shares = 10;
     uint64_t request_size = 4 << 10;
+    // If set, requests are issued at this rate whether or not the previous
+    // ones completed (open loop), with at most parallelism of them in flight
+    uint64_t rps = 0;
     std::chrono::duration<float> think_time = 0ms;
     std::chrono::duration<float> execution_time = 1ms;
+    std::chrono::duration<float> latency_target = 0ms;
     seastar::scheduling_group scheduling_group = seastar::default_scheduling_group();
 };
 
+// Limits on the results of a job, summed over all of its shards
+struct job_slo {
+    // Latency quantiles, e.g. {0.99, 2ms}
+    std::vector<std::pair<double, std::chrono::duration<float>>> quantiles;
+    compat::optional<std::chrono::duration<float>> average_latency;
+    compat::optional<std::chrono::duration<float>> max_latency;
+    // Minimum bytes and requests per second
+    uint64_t throughput = 0;
+    uint64_t iops = 0;
+
+    bool empty() const {
+        return quantiles.empty() && !average_latency && !max_latency && !throughput && !iops;
+    }
+};
+
 class class_data;
 
 struct job_config {
@@ -107,15 +123,116 @@ struct job_config {
     request_type type;
     shard_config shard_placement;
     ::shard_info shard_info;
+    job_slo slo;
     std::unique_ptr<class_data> gen_class_data();
 };
 
 std::array<double, 4> quantiles = { 0.5, 0.95, 0.99, 0.999};
 
+// Latencies in microseconds. Buckets are powers of two split in 32 linear
+// sub-buckets, so quantiles are exact to about 3%, and histograms of a job
+// from different shards can be merged.
+class latency_histogram {
+    static constexpr unsigned sub_bucket_bits = 5;
+    static constexpr unsigned sub_buckets = 1 << sub_bucket_bits;
+    std::vector<uint64_t> _counts;
+    uint64_t _count = 0;
+    double _sum = 0;
+    uint64_t _max = 0;
+
+    static unsigned index_of(uint64_t v) {
+        if (v < sub_buckets) {
+            return v;
+        }
+        unsigned shift = log2floor(v) - sub_bucket_bits;
+        return ((shift + 1) << sub_bucket_bits) + (v >> shift) - sub_buckets;
+    }
+
+    // The largest value counted in the bucket
+    static uint64_t upper_bound_of(unsigned idx) {
+        if (idx < sub_buckets) {
+            return idx;
+        }
+        unsigned shift = (idx >> sub_bucket_bits) - 1;
+        uint64_t sub = (idx & (sub_buckets - 1)) + sub_buckets;
+        return ((sub + 1) << shift) - 1;
+    }
+public:
+    void add(uint64_t us) {
+        auto idx = index_of(us);
+        if (idx >= _counts.size()) {
+            _counts.resize(idx + 1);
+        }
+        _counts[idx]++;
+        _count++;
+        _sum += us;
+        _max = std::max(_max, us);
+    }
+
+    void merge(const latency_histogram& o) {
+        if (o._counts.size() > _counts.size()) {
+            _counts.resize(o._counts.size());
+        }
+        for (unsigned i = 0; i < o._counts.size(); i++) {
+            _counts[i] += o._counts[i];
+        }
+        _count += o._count;
+        _sum += o._sum;
+        _max = std::max(_max, o._max);
+    }
+
+    uint64_t count() const {
+        return _count;
+    }
+
+    uint64_t average() const {
+        return _count ? _sum / _count : 0;
+    }
+
+    uint64_t max() const {
+        return _max;
+    }
+
+    // Rounded up to the end of the bucket, so it is safe to check against a limit
+    uint64_t quantile(double q) const {
+        uint64_t target = std::max<uint64_t>(std::ceil(q * _count), 1);
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < _counts.size(); i++) {
+            seen += _counts[i];
+            if (seen >= target) {
+                return std::min(upper_bound_of(i), _max);
+            }
+        }
+        return _max;
+    }
+};
+
+// What a job did in one shard, or in all of them once merged
+struct job_result {
+    std::string name;
+    unsigned shards = 1;
+    uint64_t data = 0;
+    std::chrono::duration<float> duration = 0s;
+    latency_histogram latencies;
+
+    void merge(const job_result& o) {
+        shards += o.shards;
+        data += o.data;
+        duration = std::max(duration, o.duration);
+        latencies.merge(o.latencies);
+    }
+
+    double iops() const {
+        return latencies.count() / duration.count();
+    }
+
+    double throughput() const {
+        return data / duration.count();
+    }
+};
+
 class class_data {
 protected:
-    using accumulator_type = accumulator_set<double, stats<tag::extended_p_square_quantile(quadratic), tag::mean, tag::max>>;
-
     job_config _config;
     uint64_t _alignment;
     uint64_t _last_pos = 0;
@@ -127,7 +244,7 @@ class class_data {
     std::chrono::duration<float> _total_duration;
 
     std::chrono::steady_clock::time_point _start = {};
-    accumulator_type _latencies;
+    latency_histogram _latencies;
     std::uniform_int_distribution<uint32_t> _pos_distribution;
     file _file;
 
@@ -140,7 +257,6 @@ class class_data {
         , _alignment(_config.shard_info.request_size >= 4096 ? 4096 : 512)
         , _iop(engine().register_one_priority_class(format("test-class-{:d}", idgen()), _config.shard_info.shares))
         , _sg(cfg.shard_info.scheduling_group)
-        , _latencies(extended_p_square_probabilities = quantiles)
         , _pos_distribution(0,  file_data_size / _config.shard_info.request_size)
     {}
 
@@ -149,6 +265,9 @@ class class_data {
     future<> issue_requests(std::chrono::steady_clock::time_point stop) {
         _start = std::chrono::steady_clock::now();
         return with_scheduling_group(_sg, [this, stop] {
+            if (_config.shard_info.rps) {
+                return issue_requests_at_rate(stop);
+            }
             return parallel_for_each(boost::irange(0u, parallelism()), [this, stop] (auto dummy) mutable {
                 auto bufptr = allocate_aligned_buffer<char>(this->req_size(), _alignment);
                 auto buf = bufptr.get();
@@ -168,6 +287,61 @@ class class_data {
         });
     }
 
+    // Requests are due every 1/rps seconds. When parallelism requests are in
+    // flight, the next one waits for a slot, and its latency includes the wait,
+    // so that a slow disk doesn't hide its own latency by slowing down the load.
+    future<> issue_requests_at_rate(std::chrono::steady_clock::time_point stop) {
+        struct state {
+            semaphore slots;
+            std::vector<std::unique_ptr<char[], free_deleter>> buffers;
+            gate in_flight;
+            std::exception_ptr ex;
+            std::chrono::steady_clock::time_point due;
+            explicit state(unsigned parallelism) : slots(parallelism) {}
+        };
+        auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1) / _config.shard_info.rps);
+        auto st = make_lw_shared<state>(parallelism());
+        for (unsigned i = 0; i < parallelism(); i++) {
+            st->buffers.push_back(allocate_aligned_buffer<char>(req_size(), _alignment));
+        }
+        st->due = _start;
+        return do_until([st, stop] { return st->due > stop || st->ex; }, [this, st, period, stop] {
+            auto due = st->due;
+            st->due += period;
+            auto now = std::chrono::steady_clock::now();
+            auto wait = due > now ? seastar::sleep(due - now) : make_ready_future<>();
+            return wait.then([st] {
+                return get_units(st->slots, 1);
+            }).then([this, st, due, stop] (auto units) {
+                auto buf = std::move(st->buffers.back());
+                st->buffers.pop_back();
+                (void)with_gate(st->in_flight, [this, st, due, stop, buf = std::move(buf), units = std::move(units)] () mutable {
+                    auto p = buf.get();
+                    return issue_request(p).then_wrapped([this, st, due, stop] (future<size_t> f) {
+                        auto now = std::chrono::steady_clock::now();
+                        try {
+                            auto size = f.get0();
+                            if (now < stop) {
+                                this->add_result(size, std::chrono::duration_cast<std::chrono::microseconds>(now - due));
+                            }
+                        } catch (...) {
+                            st->ex = std::current_exception();
+                        }
+                    }).finally([st, buf = std::move(buf), units = std::move(units)] () mutable {
+                        st->buffers.push_back(std::move(buf));
+                    });
+                });
+            });
+        }).then([st] {
+            return st->in_flight.close();
+        }).then([st] {
+            if (st->ex) {
+                return make_exception_future<>(st->ex);
+            }
+            return make_ready_future<>();
+        });
+    }
+
     future<> think() {
         if (_config.shard_info.think_time > 0us) {
             return seastar::sleep(std::chrono::duration_cast<std::chrono::microseconds>(_config.shard_info.think_time));
@@ -186,7 +360,10 @@ class class_data {
     // append            : will write to the file from pos = EOF onwards, always appending to the end.
     // cpu               : CPU-only load, file is not created.
     future<> start(sstring dir) {
-        return do_start(dir);
+        auto target = std::chrono::duration_cast<std::chrono::microseconds>(_config.shard_info.latency_target);
+        return engine().update_latency_target_for_class(_iop, target).then([this, dir] {
+            return do_start(dir);
+        });
     }
 
     future<> stop() {
@@ -216,6 +393,9 @@ class class_data {
     }
 
     sstring think_time() const {
+        if (_config.shard_info.rps) {
+            return format("{:d} requests/s", _config.shard_info.rps);
+        }
         if (_config.shard_info.think_time == std::chrono::duration<float>(0)) {
             return "NO think time";
         } else {
@@ -223,6 +403,14 @@ class class_data {
         }
     }
 
+    sstring latency_target() const {
+        if (_config.shard_info.latency_target == std::chrono::duration<float>(0)) {
+            return "";
+        } else {
+            return format(", {:d} us latency target", std::chrono::duration_cast<std::chrono::microseconds>(_config.shard_info.latency_target).count());
+        }
+    }
+
     size_t req_size() const {
         return _config.shard_info.request_size;
     }
@@ -244,15 +432,15 @@ class class_data {
     }
 
     uint64_t max_latency() const {
-        return max(_latencies);
+        return _latencies.max();
     }
 
     uint64_t average_latency() const {
-        return mean(_latencies);
+        return _latencies.average();
     }
 
     uint64_t quantile_latency(double q) const {
-        return quantile(_latencies, quantile_probability = q);
+        return _latencies.quantile(q);
     }
 
     bool is_sequential() const {
@@ -278,10 +466,19 @@ class class_data {
 
     void add_result(size_t data, std::chrono::microseconds latency) {
         _data += data;
-        _latencies(latency.count());
+        _latencies.add(latency.count());
     }
 
 public:
+    job_result result() const {
+        job_result r;
+        r.name = name();
+        r.data = _data;
+        r.duration = _total_duration;
+        r.latencies = _latencies;
+        return r;
+    }
+
     virtual sstring describe_class() = 0;
     virtual sstring describe_results() = 0;
 };
@@ -320,7 +517,7 @@ class io_class_data : public class_data {
     }
 
     virtual sstring describe_class() override {
-        return fmt::format("{}: {} shares, {}-byte {}, {} concurrent requests, {}", name(), shares(), req_size(), type_str(), parallelism(), think_time());
+        return fmt::format("{}: {} shares, {}-byte {}, {} concurrent requests, {}{}", name(), shares(), req_size(), type_str(), parallelism(), think_time(), latency_target());
     }
 
     virtual sstring describe_results() override {
@@ -489,12 +686,46 @@ struct convert<shard_info> {
         if (node["reqsize"]) {
             sl.request_size = node["reqsize"].as<byte_size>().size;
         }
+        if (node["rps"]) {
+            sl.rps = node["rps"].as<uint64_t>();
+        }
         if (node["think_time"]) {
             sl.think_time = node["think_time"].as<duration_time>().time;
         }
         if (node["execution_time"]) {
             sl.execution_time = node["execution_time"].as<duration_time>().time;
         }
+        if (node["latency_target"]) {
+            sl.latency_target = node["latency_target"].as<duration_time>().time;
+        }
+        return true;
+    }
+};
+
+template<>
+struct convert<job_slo> {
+    static bool decode(const Node& node, job_slo& slo) {
+        for (auto&& kv : node) {
+            auto key = kv.first.as<std::string>();
+            if (key == "average") {
+                slo.average_latency = kv.second.as<duration_time>().time;
+            } else if (key == "max") {
+                slo.max_latency = kv.second.as<duration_time>().time;
+            } else if (key == "throughput") {
+                slo.throughput = kv.second.as<byte_size>().size;
+            } else if (key == "iops") {
+                slo.iops = kv.second.as<uint64_t>();
+            } else if (key.size() > 1 && key[0] == 'p') {
+                // p99 or p99.9: a percentile
+                auto q = boost::lexical_cast<double>(key.substr(1)) / 100;
+                if (q <= 0 || q > 1) {
+                    return false;
+                }
+                slo.quantiles.emplace_back(q, kv.second.as<duration_time>().time);
+            } else {
+                return false;
+            }
+        }
         return true;
     }
 };
@@ -508,6 +739,9 @@ struct convert<job_config> {
         if (node["shard_info"]) {
             cl.shard_info = node["shard_info"].as<shard_info>();
         }
+        if (node["slo"]) {
+            cl.slo = node["slo"].as<job_slo>();
+        }
         return true;
     }
 };
@@ -553,6 +787,10 @@ class context {
         });
     }
 
+    std::vector<job_result> results() const {
+        return boost::copy_range<std::vector<job_result>>(_cl | boost::adaptors::transformed([] (auto& cl) { return cl->result(); }));
+    }
+
     future<> print_stats() {
         return _finished.wait(_cl.size()).then([this] {
             fmt::print("Shard {:>2}\n", engine().cpu_id());
@@ -571,6 +809,73 @@ int class_data::idgen() {
     return id++;
 }
 
+struct slo_check {
+    sstring what;
+    double limit;
+    double value;
+    bool passed;
+};
+
+std::vector<slo_check> check_slo(const job_slo& slo, const job_result& r) {
+    std::vector<slo_check> checks;
+    auto usecs = [] (std::chrono::duration<float> d) {
+        return double(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+    };
+    auto at_most = [&checks] (sstring what, double limit, double value) {
+        checks.push_back({std::move(what), limit, value, value <= limit});
+    };
+    auto at_least = [&checks] (sstring what, double limit, double value) {
+        checks.push_back({std::move(what), limit, value, value >= limit});
+    };
+    for (auto& q : slo.quantiles) {
+        at_most(format("p{:g} latency (usec)", q.first * 100), usecs(q.second), r.latencies.quantile(q.first));
+    }
+    if (slo.average_latency) {
+        at_most("average latency (usec)", usecs(*slo.average_latency), r.latencies.average());
+    }
+    if (slo.max_latency) {
+        at_most("max latency (usec)", usecs(*slo.max_latency), r.latencies.max());
+    }
+    if (slo.throughput) {
+        at_least("throughput (bytes/s)", slo.throughput, r.throughput());
+    }
+    if (slo.iops) {
+        at_least("IOPS", slo.iops, r.iops());
+    }
+    return checks;
+}
+
+void write_json_results(sstring path, const std::vector<job_result>& results, const std::vector<std::vector<slo_check>>& checks, bool passed) {
+    using json::formatter;
+    std::ofstream out(path);
+    out << "{\n  \"passed\": " << (passed ? "true" : "false") << ",\n  \"jobs\": [";
+    for (unsigned i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        out << (i ? "," : "") << "\n    {\n";
+        out << "      \"name\": " << formatter::to_json(sstring(r.name)) << ",\n";
+        out << "      \"shards\": " << r.shards << ",\n";
+        out << "      \"duration\": " << formatter::to_json(r.duration.count()) << ",\n";
+        out << "      \"throughput\": " << formatter::to_json(r.throughput()) << ",\n";
+        out << "      \"iops\": " << formatter::to_json(r.iops()) << ",\n";
+        out << "      \"latency\": {";
+        out << "\"average\": " << r.latencies.average() << ", \"max\": " << r.latencies.max();
+        for (auto& q : quantiles) {
+            out << fmt::format(", \"p{:g}\": ", q * 100) << r.latencies.quantile(q);
+        }
+        out << "},\n      \"slo\": [";
+        for (unsigned j = 0; j < checks[i].size(); j++) {
+            auto& c = checks[i][j];
+            out << (j ? ", " : "") << "{\"check\": " << formatter::to_json(c.what) << ", \"limit\": " << formatter::to_json(c.limit)
+                << ", \"value\": " << formatter::to_json(c.value) << ", \"passed\": " << (c.passed ? "true" : "false") << "}";
+        }
+        out << "]\n    }";
+    }
+    out << "\n  ]\n}\n";
+    if (!out) {
+        throw std::runtime_error(format("Couldn't write results to {}", path));
+    }
+}
+
 int main(int ac, char** av) {
     namespace bpo = boost::program_options;
 
@@ -580,9 +885,11 @@ int main(int ac, char** av) {
         ("directory", bpo::value<sstring>()->default_value("."), "directory where to execute the test")
         ("duration", bpo::value<unsigned>()->default_value(10), "for how long (in seconds) to run the test")
         ("conf", bpo::value<sstring>()->default_value("./conf.yaml"), "YAML file containing benchmark specification")
+        ("result-file", bpo::value<sstring>(), "path in which to write the results of all jobs, in JSON")
     ;
 
     distributed<context> ctx;
+    int exit_code = 0;
     return app.run(ac, av, [&] {
         return seastar::async([&] {
             auto& opts = app.configuration();
@@ -621,7 +928,45 @@ int main(int ac, char** av) {
                     return c.print_stats();
                 }).get();
             }
+
+            // Sum up each job over its shards and check it against its SLO
+            auto shard_results = ctx.map([] (context& c) {
+                return c.results();
+            }).get0();
+            std::vector<job_result> results;
+            std::vector<std::vector<slo_check>> checks;
+            bool passed = true;
+            for (auto& job : reqs) {
+                compat::optional<job_result> merged;
+                for (auto& rs : shard_results) {
+                    for (auto& r : rs) {
+                        if (r.name != job.name) {
+                            continue;
+                        }
+                        if (merged) {
+                            merged->merge(r);
+                        } else {
+                            merged = r;
+                        }
+                    }
+                }
+                if (!merged) {
+                    continue;
+                }
+                checks.push_back(check_slo(job.slo, *merged));
+                for (auto& c : checks.back()) {
+                    fmt::print("SLO {}: {} {:.0f} {} {:.0f}: {}\n", job.name, c.what, c.value, c.passed ? "within" : "exceeds", c.limit, c.passed ? "passed" : "FAILED");
+                    passed &= c.passed;
+                }
+                results.push_back(std::move(*merged));
+            }
+            if (opts.count("result-file")) {
+                write_json_results(opts["result-file"].as<sstring>(), results, checks, passed);
+            }
+            exit_code = passed ? 0 : 1;
             ctx.stop().get0();
-        }).or_terminate();
+        }).or_terminate().then([&exit_code] {
+            return exit_code;
+        });
     });
 }
@@ -45,6 +45,7 @@
 #include <seastar/core/app-template.hh>
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/fsqual.hh>
+#include <seastar/core/io_queue.hh>
 #include <seastar/util/defer.hh>
 #include <seastar/util/log.hh>
 #include <seastar/util/std-compat.hh>
@@ -93,6 +94,7 @@ struct evaluation_directory {
     unsigned _max_iodepth = 0;
     uint64_t _available_space;
     uint64_t _min_data_transfer_size = 512;
+    uint64_t _max_request_size = 0;
     unsigned _disks_per_array = 0;
 
     void scan_device(unsigned dev_maj, unsigned dev_min) {
@@ -127,6 +129,11 @@ struct evaluation_directory {
                 auto disk_min_io_size = read_first_line_as<uint64_t>(queue_dir / "minimum_io_size");
 
                 _min_data_transfer_size = std::max(_min_data_transfer_size, disk_min_io_size);
+                // The block layer splits anything larger than this
+                auto disk_max_request_size = read_first_line_as<uint64_t>(queue_dir / "max_sectors_kb") << 10;
+                if (!_max_request_size || disk_max_request_size < _max_request_size) {
+                    _max_request_size = disk_max_request_size;
+                }
                 _max_iodepth += read_first_line_as<uint64_t>(queue_dir / "nr_requests");
                 _disks_per_array++;
             }
@@ -162,6 +169,11 @@ struct evaluation_directory {
         return _min_data_transfer_size;
     }
 
+    // 0 if unknown
+    uint64_t max_request_size() const {
+        return _max_request_size;
+    }
+
     future<> discover_directory() {
         return seastar::async([this] {
             auto f = open_directory(_name).get0();
@@ -281,6 +293,20 @@ class read_request_issuer : public request_issuer {
     }
 };
 
+// Reads or writes, at random with the given fraction of reads
+class mixed_request_issuer : public request_issuer {
+    file _file;
+    std::bernoulli_distribution _is_read;
+public:
+    mixed_request_issuer(file f, double read_fraction) : _file(f), _is_read(read_fraction) {}
+    future<size_t> issue_request(uint64_t pos, char* buf, uint64_t size) override {
+        if (_is_read(random_generator)) {
+            return _file.dma_read(pos, buf, size);
+        }
+        return _file.dma_write(pos, buf, size);
+    }
+};
+
 class io_worker {
     uint64_t _bytes = 0;
     unsigned _requests = 0;
@@ -428,6 +454,16 @@ class test_file {
         });
     }
 
+    future<io_rates> mixed_workload(size_t buffer_size, double read_fraction, unsigned max_os_concurrency, std::chrono::duration<double> duration) {
+        buffer_size = std::max(buffer_size, std::max(_file.disk_read_dma_alignment(), _file.disk_write_dma_alignment()));
+        auto worker = std::make_unique<io_worker>(buffer_size, duration, std::make_unique<mixed_request_issuer>(_file, read_fraction), get_position_generator(buffer_size, pattern::random));
+        return do_workload(std::move(worker), max_os_concurrency).then([this] (io_rates r) {
+            return _file.flush().then([r = std::move(r)] () mutable {
+                return make_ready_future<io_rates>(std::move(r));
+            });
+        });
+    }
+
     future<> stop() {
         return _file.close();
     }
@@ -436,13 +472,18 @@ class test_file {
 class iotune_multi_shard_context {
     ::evaluation_directory _test_directory;
 
-    unsigned per_shard_io_depth() const {
-        auto iodepth = _test_directory.max_iodepth() / smp::count;
-        if (engine().cpu_id() < _test_directory.max_iodepth() % smp::count) {
+    // This shard's part of a total queue depth spread over all shards
+    static unsigned per_shard_io_depth(unsigned total) {
+        auto iodepth = total / smp::count;
+        if (engine().cpu_id() < total % smp::count) {
             iodepth++;
         }
         return std::min(iodepth, 128u);
     }
+
+    unsigned per_shard_io_depth() const {
+        return per_shard_io_depth(_test_directory.max_iodepth());
+    }
     seastar::sharded<test_file> _iotune_test_file;
 public:
     future<> stop() {
@@ -483,6 +524,23 @@ class iotune_multi_shard_context {
         }, io_rates(), std::plus<io_rates>());
     }
 
+    // Random reads with a total queue depth of \c depth over all shards
+    future<io_rates> read_random_data_at_depth(size_t buffer_size, unsigned depth, std::chrono::duration<double> duration) {
+        return _iotune_test_file.map_reduce0([buffer_size, depth, duration] (test_file& tf) {
+            auto shard_depth = per_shard_io_depth(depth);
+            if (!shard_depth) {
+                return make_ready_future<io_rates>();
+            }
+            return tf.read_workload(buffer_size, test_file::pattern::random, shard_depth, duration);
+        }, io_rates(), std::plus<io_rates>());
+    }
+
+    future<io_rates> mixed_random_data(size_t buffer_size, double read_fraction, std::chrono::duration<double> duration) {
+        return _iotune_test_file.map_reduce0([buffer_size, read_fraction, this, duration] (test_file& tf) {
+            return tf.mixed_workload(buffer_size, read_fraction, per_shard_io_depth(), duration);
+        }, io_rates(), std::plus<io_rates>());
+    }
+
     iotune_multi_shard_context(::evaluation_directory dir)
         : _test_directory(dir)
     {}
@@ -494,6 +552,8 @@ struct disk_descriptor {
     uint64_t read_bw;
     uint64_t write_iops;
     uint64_t write_bw;
+    uint64_t max_request_size = 0;
+    io_device_model model;
 };
 
 void string_to_file(sstring conf_file, sstring buf) {
@@ -526,6 +586,44 @@ void write_property_file(sstring conf_file, std::vector<disk_descriptor> disk_de
         out << YAML::Key << "read_bandwidth" << YAML::Value << desc.read_bw;
         out << YAML::Key << "write_iops" << YAML::Value << desc.write_iops;
         out << YAML::Key << "write_bandwidth" << YAML::Value << desc.write_bw;
+        if (desc.max_request_size) {
+            out << YAML::Key << "max_request_size" << YAML::Value << desc.max_request_size;
+        }
+        auto& m = desc.model;
+        if (!m.read.empty() || !m.write.empty() || !m.mixed.empty() || !m.concurrency.empty()) {
+            auto rates = [&out] (const char* name, const std::vector<io_device_model::rate_point>& points) {
+                out << YAML::Key << name << YAML::Value << YAML::BeginSeq;
+                for (auto& p : points) {
+                    out << YAML::Flow << YAML::BeginMap;
+                    out << YAML::Key << "request_size" << YAML::Value << p.request_size;
+                    out << YAML::Key << "iops" << YAML::Value << uint64_t(p.iops);
+                    // Not read back, for humans
+                    out << YAML::Key << "bandwidth" << YAML::Value << uint64_t(p.iops * p.request_size);
+                    out << YAML::EndMap;
+                }
+                out << YAML::EndSeq;
+            };
+            out << YAML::Key << "model" << YAML::Value << YAML::BeginMap;
+            rates("read", m.read);
+            rates("write", m.write);
+            out << YAML::Key << "mixed" << YAML::Value << YAML::BeginSeq;
+            for (auto& p : m.mixed) {
+                out << YAML::Flow << YAML::BeginMap;
+                out << YAML::Key << "read_fraction" << YAML::Value << p.read_fraction;
+                out << YAML::Key << "efficiency" << YAML::Value << p.efficiency;
+                out << YAML::EndMap;
+            }
+            out << YAML::EndSeq;
+            out << YAML::Key << "concurrency" << YAML::Value << YAML::BeginSeq;
+            for (auto& p : m.concurrency) {
+                out << YAML::Flow << YAML::BeginMap;
+                out << YAML::Key << "depth" << YAML::Value << p.depth;
+                out << YAML::Key << "iops" << YAML::Value << uint64_t(p.iops);
+                out << YAML::EndMap;
+            }
+            out << YAML::EndSeq;
+            out << YAML::EndMap;
+        }
         out << YAML::EndMap;
     }
     out << YAML::EndSeq;
@@ -535,6 +633,47 @@ void write_property_file(sstring conf_file, std::vector<disk_descriptor> disk_de
     string_to_file(conf_file, sstring(out.c_str(), out.size()));
 }
 
+// Measures the rates of random requests of growing sizes, of small requests
+// with reads and writes mixed and of small reads at growing queue depths.
+// Must run in a thread, after the basic rates were measured.
+io_device_model measure_device_model(iotune_multi_shard_context& tests, const ::evaluation_directory& dir,
+        io_rates read_iops, io_rates write_iops, std::chrono::duration<double> duration) {
+    io_device_model model;
+    auto step = duration * 0.05;
+    auto min_size = dir.minimum_io_size();
+    model.read.push_back({min_size, read_iops.iops});
+    model.write.push_back({min_size, write_iops.iops});
+    uint64_t max_size = std::max<uint64_t>(dir.max_request_size(), 128 << 10);
+    for (uint64_t size = min_size << 2; size <= std::min<uint64_t>(max_size, 1 << 20); size <<= 2) {
+        fmt::print("Measuring random {} kB reads and writes: ", size >> 10);
+        std::cout.flush();
+        auto r = tests.read_random_data(size, step).get0();
+        auto w = tests.write_random_data(size, step).get0();
+        model.read.push_back({size, r.iops});
+        model.write.push_back({size, w.iops});
+        fmt::print("{} / {} IOPS\n", uint64_t(r.iops), uint64_t(w.iops));
+    }
+
+    for (auto read_fraction : { 0.25, 0.5, 0.75 }) {
+        fmt::print("Measuring random IOPS with {}% reads: ", unsigned(read_fraction * 100));
+        std::cout.flush();
+        auto rates = tests.mixed_random_data(min_size, read_fraction, step).get0();
+        // How long the requests would take if reads and writes didn't interfere
+        auto expected = read_fraction / read_iops.iops + (1 - read_fraction) / write_iops.iops;
+        model.mixed.push_back({read_fraction, rates.iops * expected});
+        fmt::print("{} IOPS\n", uint64_t(rates.iops));
+    }
+
+    for (unsigned depth = 1; depth <= dir.max_iodepth(); depth *= 2) {
+        fmt::print("Measuring random read IOPS at depth {}: ", depth);
+        std::cout.flush();
+        auto rates = tests.read_random_data_at_depth(min_size, depth, step * 0.5).get0();
+        model.concurrency.push_back({depth, rates.iops});
+        fmt::print("{} IOPS\n", uint64_t(rates.iops));
+    }
+    return model;
+}
+
 // Returns the mountpoint of a path. It works by walking backwards from the canonical path
 // (absolute, with symlinks resolved), until we find a point that crosses a device ID.
 fs::path mountpoint_of(sstring filename) {
@@ -558,6 +697,7 @@ fs::path mountpoint_of(sstring filename) {
 int main(int ac, char** av) {
     namespace bpo = boost::program_options;
     bool fs_check = false;
+    bool measure_model = false;
 
     app_template::config app_cfg;
     app_cfg.name = "IOTune";
@@ -571,6 +711,8 @@ int main(int ac, char** av) {
         ("duration", bpo::value<unsigned>()->default_value(120), "time, in seconds, for which to run the test")
         ("format", bpo::value<sstring>()->default_value("seastar"), "Configuration file format (seastar | envfile)")
         ("fs-check", bpo::bool_switch(&fs_check), "perform FS check only")
+        ("model", bpo::bool_switch(&measure_model), "also measure how the rates vary with the request size, the read/write mix and the queue depth,"
+                " for the I/O scheduler to account requests by their cost (takes about twice as long)")
     ;
 
     return app.run(ac, av, [&] {
@@ -671,6 +813,10 @@ int main(int ac, char** av) {
                 desc.read_bw = read_bw.bytes_per_sec;
                 desc.write_iops = write_iops.iops;
                 desc.write_bw = write_bw.bytes_per_sec;
+                desc.max_request_size = test_directory.max_request_size();
+                if (measure_model) {
+                    desc.model = measure_device_model(iotune_tests, test_directory, read_iops, write_iops, duration);
+                }
                 disk_descriptors.push_back(std::move(desc));
             }
 
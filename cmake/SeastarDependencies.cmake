@@ -64,6 +64,7 @@ macro (seastar_find_dependencies)
     # Private and private/public dependencies.
     Concepts
     GnuTLS
+    LibUring
     LinuxMembarrier
     Protobuf
     Sanitizers
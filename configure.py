@@ -85,6 +85,11 @@ add_tristate(
     name = 'hwloc',
     dest = 'hwloc',
     help = 'hwloc support')
+add_tristate(
+    arg_parser,
+    name = 'io_uring',
+    dest = 'io_uring',
+    help = 'io_uring reactor backend support')
 add_tristate(
     arg_parser,
     name = 'gcc6-concepts',
@@ -192,6 +197,7 @@ def configure_mode(mode):
         tr(args.dpdk, 'DPDK'),
         tr(infer_dpdk_machine(args.user_cflags), 'DPDK_MACHINE'),
         tr(args.hwloc, 'HWLOC', value_when_none='yes'),
+        tr(args.io_uring, 'IO_URING', value_when_none='yes'),
         tr(args.gcc6_concepts, 'GCC6_CONCEPTS'),
         tr(args.alloc_failure_injection, 'ALLOC_FAILURE_INJECTION'),
         tr(args.alloc_page_size, 'ALLOC_PAGE_SIZE'),
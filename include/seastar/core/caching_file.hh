@@ -0,0 +1,73 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// A block cache in front of seastar files.
+//
+// Files are uncached, so data that is read over and over (indexes,
+// metadata) goes to the disk every time unless the application caches it.
+// A caching file keeps the aligned blocks it reads in a cache shared by all
+// caching files of the shard, evicted in LRU order and shrunk by the memory
+// reclaimer when the shard runs low on memory.
+
+#include <seastar/core/file.hh>
+
+namespace seastar {
+
+/// Options for \ref make_caching_file()
+struct caching_file_options {
+    /// Size of the cached blocks. Rounded up to the disk read alignment of the file.
+    size_t block_size = 16 << 10;
+};
+
+/// Wraps a file so that reads are served from the shard's block cache.
+///
+/// Reads are done in whole blocks. A block that is being read from the disk
+/// is read only once, however many readers ask for it concurrently. Writes,
+/// truncate() and discard() go to the underlying file and drop the blocks they
+/// touch. The file must only be used from the shard it was created on.
+///
+/// \param f the file to wrap
+/// \param opts caching options
+file make_caching_file(file f, caching_file_options opts = {});
+
+/// Sets the capacity of this shard's block cache, evicting blocks if needed.
+///
+/// Defaults to 5% of the shard's memory.
+void set_block_cache_capacity(size_t bytes);
+
+/// Statistics of the shard's block cache
+struct block_cache_stats {
+    uint64_t hits = 0;             ///< block lookups served from memory
+    uint64_t misses = 0;           ///< block lookups that read from the disk
+    uint64_t coalesced_misses = 0; ///< block lookups that waited for a read already in progress
+    uint64_t evictions = 0;        ///< blocks evicted to make room or on memory pressure
+    size_t used_bytes = 0;         ///< memory held by cached blocks
+    size_t capacity = 0;           ///< maximum memory held by cached blocks
+};
+
+/// \return the statistics of this shard's block cache
+block_cache_stats get_block_cache_stats();
+
+}
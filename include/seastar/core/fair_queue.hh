@@ -25,8 +25,11 @@
 #include <seastar/core/circular_buffer.hh>
 #include <seastar/util/noncopyable_function.hh>
 #include <queue>
+#include <vector>
 #include <chrono>
 #include <unordered_set>
+#include <atomic>
+#include <memory>
 
 namespace seastar {
 
@@ -46,10 +49,20 @@ class priority_class {
     struct request {
         noncopyable_function<void()> func;
         fair_queue_request_descriptor desc;
+        std::chrono::steady_clock::time_point queued_at;
     };
     friend class fair_queue;
     uint32_t _shares = 0;
     float _accumulated = 0;
+    std::chrono::microseconds _latency_target{0};
+    // Requests dispatched out of turn since the lead was last re-armed, see
+    // fair_queue::pop_urgent_class()
+    unsigned _lead = 0;
+    std::chrono::steady_clock::time_point _rearmed_at;
+    // Entries of this class in the fair queue's deadline heaps
+    unsigned _deadline_entries = 0;
+    // Shares counted in the demand of the fair queue while the class is backlogged
+    uint32_t _demand = 0;
     circular_buffer<request> _queue;
     bool _queued = false;
 
@@ -64,6 +77,11 @@ class priority_class {
     uint32_t shares() const {
         return _shares;
     }
+
+    /// \brief return the queueing latency target of this priority class, or zero if it has none
+    std::chrono::microseconds latency_target() const {
+        return _latency_target;
+    }
 };
 /// \endcond
 
@@ -77,6 +95,63 @@ class priority_class {
 /// \related fair_queue
 using priority_class_ptr = lw_shared_ptr<priority_class>;
 
+/// \brief Capacity shared by the fair queues dispatching to the same resource
+///
+/// Each \ref fair_queue of a group keeps its request and bytes limits as a reservation
+/// that only it can use. Capacity beyond that is drawn from the group when the queue needs it
+/// and given back as its requests complete, so a busy queue can use what idle ones
+/// leave on the table. Tokens are taken optimistically with atomic operations and
+/// returned if any of the limits was exceeded, so no lock is involved.
+///
+/// Each queue's demand is the sum of the shares of its backlogged classes. A queue can
+/// always borrow up to its part of the group's capacity, in proportion to its demand.
+/// It can borrow beyond that only as long as enough is left for the other queues to
+/// reach their parts. Capacity that completing requests give back therefore goes first
+/// to the queues that are short of their part, rather than to whichever asks first.
+///
+/// \related fair_queue
+class fair_group {
+    std::atomic<int64_t> _req_count;
+    std::atomic<int64_t> _bytes_count;
+    std::atomic<uint64_t> _demand;
+    const int64_t _max_req_count;
+    const int64_t _max_bytes_count;
+public:
+    /// \brief Capacity, on top of the reservations of its queues, that the group lends out
+    struct config {
+        uint64_t max_req_count = 0;
+        uint64_t max_bytes_count = 0;
+    };
+
+    explicit fair_group(config cfg)
+        : _req_count(cfg.max_req_count)
+        , _bytes_count(cfg.max_bytes_count)
+        , _demand(0)
+        , _max_req_count(cfg.max_req_count)
+        , _max_bytes_count(cfg.max_bytes_count)
+    {}
+
+    /// Takes capacity from the group.
+    ///
+    /// \param demand the demand of the queue asking, as published with \ref add_demand
+    /// \param borrowed_req_count request capacity the queue already holds
+    /// \param borrowed_bytes_count bytes capacity the queue already holds
+    /// \param force take the capacity even if the group does not have it, or it would
+    ///        leave the other queues short. The group then goes into debt and will not
+    ///        lend anything until enough capacity is returned.
+    /// \return true if the capacity was taken
+    bool grab(int64_t req_count, int64_t bytes_count, uint64_t demand,
+            int64_t borrowed_req_count, int64_t borrowed_bytes_count, bool force);
+
+    /// Adjusts the total demand of the queues of the group by \c delta.
+    void add_demand(int64_t delta) {
+        _demand.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    /// Returns capacity taken with \ref grab to the group.
+    void release(int64_t req_count, int64_t bytes_count);
+};
+
 /// \brief Fair queuing class
 ///
 /// This is a fair queue, allowing multiple request producers to queue requests
@@ -96,6 +171,18 @@ using priority_class_ptr = lw_shared_ptr<priority_class>;
 /// When the classes that lag behind start seeing requests, the fair queue will serve
 /// them first, until balance is restored. This balancing is expected to happen within
 /// a certain time window that obeys an exponential decay.
+///
+/// A class can also declare a latency target (see \ref set_latency_target). Once the
+/// oldest request of such a class has waited for half of its target, the class is
+/// served ahead of its turn (earliest deadline first among such classes), for up to
+/// \ref config::max_latency_lead requests. The lead is re-armed, at most once per
+/// latency target, whenever the oldest request of the class is past its deadline.
+/// The bypass only reorders dispatching: urgent requests are charged to their
+/// class as usual, so shares still hold over the decay window.
+///
+/// If the configuration names a \ref fair_group, the request and bytes limits are a
+/// reservation and the queue can go past them by borrowing from the group. The
+/// capacity limit is never shared.
 class fair_queue {
 public:
     /// \brief Fair Queue configuration structure.
@@ -107,6 +194,11 @@ class fair_queue {
         std::chrono::microseconds tau = std::chrono::milliseconds(100);
         unsigned max_req_count = std::numeric_limits<unsigned>::max();
         unsigned max_bytes_count = std::numeric_limits<unsigned>::max();
+        /// how many requests a class with a latency target may be served ahead of
+        /// its turn in order to meet that target, before its lead is re-armed
+        unsigned max_latency_lead = 8;
+        /// request and bytes capacity shared with other queues, on top of the limits above
+        std::shared_ptr<fair_group> group;
     };
 private:
     friend priority_class;
@@ -122,21 +214,69 @@ class fair_queue {
     unsigned _req_count_executing = 0;
     unsigned _bytes_count_executing = 0;
     unsigned _requests_queued = 0;
+    // Sum of the shares of the backlogged classes, published to _config.group
+    uint64_t _demand = 0;
+    // Capacity held from _config.group: whatever is executing beyond our own limits
+    int64_t _borrowed_req_count = 0;
+    int64_t _borrowed_bytes_count = 0;
     using clock_type = std::chrono::steady_clock::time_point;
     clock_type _base;
-    using prioq = std::priority_queue<priority_class_ptr, std::vector<priority_class_ptr>, class_compare>;
-    prioq _handles;
+    // When the oldest request of a class with a latency target becomes urgent,
+    // and when it is due
+    struct deadline_entry {
+        clock_type urgent_at;
+        clock_type deadline;
+        priority_class_ptr pc;
+    };
+    struct urgent_at_compare {
+        bool operator() (const deadline_entry& lhs, const deadline_entry& rhs) const {
+            return lhs.urgent_at > rhs.urgent_at;
+        }
+    };
+    struct deadline_compare {
+        bool operator() (const deadline_entry& lhs, const deadline_entry& rhs) const {
+            return lhs.deadline > rhs.deadline;
+        }
+    };
+
+    // A heap ordered by class_compare. Not a std::priority_queue, since classes
+    // served out of turn because of their latency target need to be removed from
+    // the middle of it.
+    std::vector<priority_class_ptr> _handles;
     std::unordered_set<priority_class_ptr> _all_classes;
+    // Classes with a latency target whose oldest request is not urgent yet, as a
+    // heap ordered by urgent_at_compare, and those whose oldest request is, as a
+    // heap ordered by deadline_compare. A class has one entry in either. Its oldest
+    // request only gets younger, so an entry is never late; it is brought up to
+    // date when it reaches the top.
+    std::vector<deadline_entry> _waiting;
+    std::vector<deadline_entry> _urgent;
 
     void push_priority_class(priority_class_ptr pc);
 
+    void push_deadline(const priority_class_ptr& pc);
+
+    void refresh_deadline(const priority_class_ptr& pc);
+
+    bool deadline_is_current(const deadline_entry& e) const;
+
     priority_class_ptr pop_priority_class();
 
+    priority_class_ptr pop_urgent_class();
+
+    float request_cost(const priority_class& pc, const fair_queue_request_descriptor& desc) const;
+
     float normalize_factor() const;
 
     void normalize_stats();
 
     bool can_dispatch() const;
+
+    bool borrow_for(const fair_queue_request_descriptor& desc);
+
+    void return_borrowed();
+
+    void update_demand(priority_class& pc, bool backlogged);
 public:
     /// Constructs a fair queue with configuration parameters \c cfg.
     ///
@@ -189,6 +329,14 @@ class fair_queue {
     ///
     /// \param new_shares the new number of shares for this priority class
     static void update_shares(priority_class_ptr pc, uint32_t new_shares);
+
+    /// Sets the queueing latency target of this priority class
+    ///
+    /// Requests of a class with a latency target are dispatched ahead of the
+    /// share-based order when they risk missing it. See \ref fair_queue.
+    ///
+    /// \param target the new latency target, or zero to disable the latency mode for this class
+    void set_latency_target(priority_class_ptr pc, std::chrono::microseconds target);
 };
 /// @}
 
@@ -55,8 +55,26 @@ struct file_input_stream_options {
     unsigned read_ahead = 0;      ///< Maximum number of extra read-ahead operations
     ::seastar::io_priority_class io_priority_class = default_priority_class();
     lw_shared_ptr<file_input_stream_history> dynamic_adjustments = { }; ///< Input stream history, if null dynamic adjustments are disabled
+    /// Adapt the read-ahead to the access pattern.
+    ///
+    /// The stream starts with \c buffer_size buffers and a single read-ahead.
+    /// While the consumer reads sequentially and has to wait for data, the
+    /// buffer size is doubled up to \c max_buffer_size and the read-ahead is
+    /// deepened up to \c read_ahead, as long as the shard's read-ahead budget
+    /// (see \ref set_file_input_stream_read_ahead_budget()) allows. A skip past
+    /// the buffered data is taken as random access and drops back to the
+    /// initial buffer size with no read-ahead. \c dynamic_adjustments is
+    /// ignored in this mode.
+    bool adaptive_read_ahead = false;
+    size_t max_buffer_size = 1 << 20; ///< Largest buffer size used with \c adaptive_read_ahead
 };
 
+/// Sets how much memory the read-ahead buffers of this shard's adaptive
+/// file input streams may hold together.
+///
+/// Defaults to 1/32 of the shard's memory.
+void set_file_input_stream_read_ahead_budget(size_t bytes);
+
 /// \brief Creates an input_stream to read a portion of a file.
 ///
 /// \param file File to read; multiple streams for the same file may coexist
@@ -92,6 +110,10 @@ struct file_output_stream_options {
     unsigned buffer_size = 65536;
     unsigned preallocation_size = 0; ///< Preallocate extents. For large files, set to a large number (a few megabytes) to reduce fragmentation
     unsigned write_behind = 1; ///< Number of buffers to write in parallel
+    /// Buffers that wait for one of the \c write_behind slots are gathered
+    /// into one vectored write of up to this many bytes, so a stream that
+    /// outpaces the disk issues fewer, larger requests. 0 disables gathering.
+    unsigned max_gathered_write_size = 0;
     ::seastar::io_priority_class io_priority_class = default_priority_class();
 };
 
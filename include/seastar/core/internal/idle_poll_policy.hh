@@ -0,0 +1,128 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright 2020 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/bitops.hh>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace seastar {
+
+namespace internal {
+
+// Decides how long an idle reactor polls before it goes to sleep, from the
+// lengths of its recent idle periods, i.e. the gaps between arrivals of work
+// on any of its pollers.
+//
+// Polling through a gap costs the gap in CPU time. Going to sleep costs the
+// polling before it, plus a wakeup cost standing for the latency that waking
+// up adds to the work that arrives. The policy polls for the time with the
+// least expected cost over the recent gaps: a shard that gets work every few
+// microseconds polls through the gaps, a mostly idle one sleeps right away.
+class idle_poll_policy {
+public:
+    using duration = std::chrono::nanoseconds;
+private:
+    // Gaps in microseconds, bucket i holding those of up to 2^i us, the last
+    // one everything longer
+    static constexpr unsigned nr_buckets = 24;
+    // How many gaps to see before choosing the poll time again
+    static constexpr unsigned gaps_per_update = 64;
+    // Older gaps count half every that many gaps, so the policy follows the load
+    static constexpr unsigned gaps_per_decay = 4096;
+
+    std::array<uint64_t, nr_buckets> _gaps = {};
+    uint64_t _nr_gaps = 0;
+    duration _max_poll_time;
+    duration _wakeup_cost;
+    duration _poll_time;
+
+    static unsigned bucket_of(duration gap) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(gap).count();
+        if (us <= 1) {
+            return 0;
+        }
+        return std::min(log2ceil(uint64_t(us)), nr_buckets - 1);
+    }
+
+    // A typical gap of the bucket, somewhere in its range
+    static double typical_gap_us(unsigned bucket) {
+        return bucket ? 0.75 * (uint64_t(1) << bucket) : 1;
+    }
+
+    void update() {
+        auto max_us = std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(_max_poll_time).count();
+        auto wakeup_us = std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(_wakeup_cost).count();
+        // Candidates are no polling and polling through the gaps of up to each bucket
+        double best_cost = 0;
+        double best_us = 0;
+        for (auto& n : _gaps) {
+            best_cost += n * wakeup_us;
+        }
+        for (unsigned b = 0; b < nr_buckets - 1; b++) {
+            double poll_us = uint64_t(1) << b;
+            if (poll_us > max_us) {
+                break;
+            }
+            double cost = 0;
+            for (unsigned i = 0; i < nr_buckets; i++) {
+                cost += _gaps[i] * (i <= b ? typical_gap_us(i) : poll_us + wakeup_us);
+            }
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_us = poll_us;
+            }
+        }
+        _poll_time = std::chrono::duration_cast<duration>(std::chrono::duration<double, std::micro>(best_us));
+    }
+public:
+    // \c max_poll_time bounds the poll time; \c initial_poll_time is used
+    // until enough gaps were seen.
+    idle_poll_policy(duration max_poll_time, duration wakeup_cost, duration initial_poll_time)
+        : _max_poll_time(max_poll_time)
+        , _wakeup_cost(wakeup_cost)
+        , _poll_time(std::min(initial_poll_time, max_poll_time)) {
+    }
+
+    // Records that work arrived after the reactor was idle for \c gap
+    void add_gap(duration gap) {
+        _gaps[bucket_of(gap)]++;
+        if (++_nr_gaps % gaps_per_update == 0) {
+            update();
+        }
+        if (_nr_gaps % gaps_per_decay == 0) {
+            for (auto& n : _gaps) {
+                n /= 2;
+            }
+        }
+    }
+
+    // How long to poll before sleeping
+    duration poll_time() const {
+        return _poll_time;
+    }
+};
+
+}
+
+}
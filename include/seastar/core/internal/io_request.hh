@@ -26,13 +26,19 @@
 #include <seastar/core/internal/io_desc.hh>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+struct statx;
 
 namespace seastar {
 namespace internal {
 
 class io_request {
 public:
-    enum class operation { read, readv, write, writev, fdatasync, recv, recvmsg, send, sendmsg, accept, connect, poll_add, poll_remove, cancel };
+    enum class operation { read, readv, write, writev, fdatasync, recv, recvmsg, send, sendmsg, accept, connect, poll_add, poll_remove, cancel,
+        // Metadata operations, only submitted when the backend reports it can run them asynchronously
+        openat, close, statx, unlinkat, renameat, linkat, mkdirat };
 private:
     operation _op;
     int _fd;
@@ -53,11 +59,15 @@ class io_request {
         ::sockaddr* sockaddr;
     } _ptr;
 
-    // accept wants a socklen_t*, connect wants a socklen_t
+    // accept wants a socklen_t*, connect wants a socklen_t, the metadata
+    // operations a mode, a second path or a statx buffer
     union {
         size_t len;
         socklen_t* socklen_ptr;
         socklen_t socklen;
+        mode_t mode;
+        char* new_path;
+        struct ::statx* statx;
     } _size;
     kernel_completion* _kernel_completion;
 
@@ -120,6 +130,14 @@ class io_request {
     {
         _ptr.addr = ptr;
     }
+
+    explicit io_request(operation op, int dirfd, const char* path, int flags)
+        : _op(op)
+        , _fd(dirfd)
+    {
+        _attr.flags = flags;
+        _ptr.addr = const_cast<char*>(path);
+    }
 public:
     bool is_read() const {
         switch (_op) {
@@ -199,6 +217,22 @@ class io_request {
         return _size.socklen_ptr;
     }
 
+    const char* path() const {
+        return _ptr.addr;
+    }
+
+    const char* new_path() const {
+        return _size.new_path;
+    }
+
+    mode_t mode() const {
+        return _size.mode;
+    }
+
+    struct ::statx* statx_buffer() const {
+        return _size.statx;
+    }
+
     void attach_kernel_completion(kernel_completion* kc) {
         _kernel_completion = kc;
     }
@@ -261,6 +295,46 @@ class io_request {
     static io_request make_cancel(int fd, void *addr) {
         return io_request(operation::cancel, fd, reinterpret_cast<char*>(addr));
     }
+
+    static io_request make_openat(int dirfd, const char* path, int flags, mode_t mode) {
+        io_request req(operation::openat, dirfd, path, flags);
+        req._size.mode = mode;
+        return req;
+    }
+
+    static io_request make_close(int fd) {
+        return io_request(operation::close, fd);
+    }
+
+    static io_request make_statx(int dirfd, const char* path, int flags, struct ::statx* buffer) {
+        io_request req(operation::statx, dirfd, path, flags);
+        req._size.statx = buffer;
+        return req;
+    }
+
+    static io_request make_unlinkat(int dirfd, const char* path, int flags) {
+        return io_request(operation::unlinkat, dirfd, path, flags);
+    }
+
+    // Paths are relative to the current directory
+    static io_request make_renameat(const char* old_path, const char* new_path) {
+        io_request req(operation::renameat, AT_FDCWD, old_path, 0);
+        req._size.new_path = const_cast<char*>(new_path);
+        return req;
+    }
+
+    // Paths are relative to the current directory
+    static io_request make_linkat(const char* old_path, const char* new_path) {
+        io_request req(operation::linkat, AT_FDCWD, old_path, 0);
+        req._size.new_path = const_cast<char*>(new_path);
+        return req;
+    }
+
+    static io_request make_mkdirat(int dirfd, const char* path, mode_t mode) {
+        io_request req(operation::mkdirat, dirfd, path, 0);
+        req._size.mode = mode;
+        return req;
+    }
 };
 }
 }
@@ -23,6 +23,7 @@
 
 #include <seastar/core/future.hh>
 #include <seastar/core/posix.hh>
+#include <seastar/core/temporary_buffer.hh>
 #include <vector>
 #include <tuple>
 #include <seastar/core/internal/io_desc.hh>
@@ -72,6 +73,7 @@ class pollable_fd_state {
     future<size_t> read_some(char* buffer, size_t size);
     future<size_t> read_some(uint8_t* buffer, size_t size);
     future<size_t> read_some(const std::vector<iovec>& iov);
+    future<temporary_buffer<char>> read_some(temporary_buffer<char> buf);
     future<> write_all(const char* buffer, size_t size);
     future<> write_all(const uint8_t* buffer, size_t size);
     future<size_t> write_some(net::packet& p);
@@ -111,6 +113,12 @@ class pollable_fd {
     future<size_t> read_some(const std::vector<iovec>& iov) {
         return _s->read_some(iov);
     }
+    // Reads into \c buf, which is returned trimmed to what was read. Unlike
+    // the other overloads, the buffer stays alive even if the caller goes away
+    // while the read is in progress.
+    future<temporary_buffer<char>> read_some(temporary_buffer<char> buf) {
+        return _s->read_some(std::move(buf));
+    }
     future<> write_all(const char* buffer, size_t size) {
         return _s->write_all(buffer, size);
     }
@@ -24,11 +24,14 @@
 #include <seastar/core/sstring.hh>
 #include <seastar/core/fair_queue.hh>
 #include <seastar/core/metrics_registration.hh>
+#include <seastar/core/metrics_types.hh>
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/future.hh>
 #include <seastar/core/internal/io_request.hh>
+#include <seastar/util/noncopyable_function.hh>
 #include <mutex>
 #include <array>
+#include <vector>
 
 namespace seastar {
 
@@ -52,12 +55,56 @@ struct io_event;
 struct iocb;
 
 }
+
+// Latency distribution with power-of-two buckets, from 1us to about 33s.
+// Recording a sample is a handful of integer operations.
+class latency_histogram {
+    static constexpr unsigned nr_buckets = 26;
+    std::array<uint64_t, nr_buckets> _buckets = {};
+    uint64_t _count = 0;
+    double _sum = 0;
+public:
+    void add(std::chrono::steady_clock::duration d);
+    // Cumulative buckets, in seconds, as Prometheus expects them
+    metrics::histogram to_metrics_histogram() const;
+};
+
 }
 
 using shard_id = unsigned;
 
 class io_priority_class;
 
+// A device's throughput as a function of request size, read/write mix and
+// concurrency, as measured by iotune
+struct io_device_model {
+    struct rate_point {
+        uint64_t request_size;
+        double iops;
+    };
+    struct mix_point {
+        // Fraction of the requests that are reads
+        double read_fraction;
+        // Measured rate over the rate expected from the pure read and write rates
+        double efficiency;
+    };
+    struct depth_point {
+        unsigned depth;
+        double iops;
+    };
+    // Random reads and writes of different sizes
+    std::vector<rate_point> read;
+    std::vector<rate_point> write;
+    // Small random requests with reads and writes mixed
+    std::vector<mix_point> mixed;
+    // Small random reads at different queue depths
+    std::vector<depth_point> concurrency;
+
+    // The lowest queue depth that gets most of the device's rate, 0 if unknown.
+    // Deeper queues only add latency.
+    unsigned saturation_depth() const;
+};
+
 class io_queue {
 private:
     struct priority_class_data {
@@ -66,6 +113,8 @@ class io_queue {
         uint64_t ops;
         uint32_t nr_queued;
         std::chrono::duration<double> queue_time;
+        internal::latency_histogram queue_latency;
+        internal::latency_histogram device_latency;
         metrics::metric_groups _metric_groups;
         priority_class_data(sstring name, sstring mountpoint, priority_class_ptr ptr, shard_id owner);
         void rename(sstring new_name, sstring mountpoint, shard_id owner);
@@ -73,8 +122,22 @@ class io_queue {
         void register_stats(sstring name, sstring mountpoint, shard_id owner);
     };
 
+    // A dispatched request held back until the end of the dispatch round,
+    // so that it can be merged with the ones adjacent to it
+    struct pending_request {
+        kernel_completion* desc;
+        internal::io_request req;
+        const priority_class_data* pclass;
+    };
+
     std::vector<std::vector<lw_shared_ptr<priority_class_data>>> _priority_classes;
     fair_queue _fq;
+    std::vector<pending_request> _pending_requests;
+    uint64_t _merged_requests = 0;
+    uint64_t _split_requests = 0;
+    // Weights of the recently queued reads and writes, decayed over time
+    uint64_t _recent_read_weight = 0;
+    uint64_t _recent_write_weight = 0;
 
     static constexpr unsigned _max_classes = 2048;
     static std::mutex _register_lock;
@@ -84,7 +147,15 @@ class io_queue {
     static io_priority_class register_one_priority_class(sstring name, uint32_t shares);
 
     priority_class_data& find_or_create_class(const io_priority_class& pc, shard_id owner);
+
+    future<size_t> queue_one_request(priority_class_data& pclass, std::chrono::steady_clock::time_point start, size_t len, internal::io_request req);
+    future<size_t> queue_split_request(priority_class_data& pclass, std::chrono::steady_clock::time_point start, size_t len, internal::io_request req);
+    void submit_request(kernel_completion* desc, internal::io_request req, const priority_class_data& pclass);
+    // Returns the weight and size a request is accounted with in the fair queue
+    std::pair<unsigned, size_t> request_cost(bool is_write, size_t len);
+    void submit_pending_requests();
     friend class smp;
+    friend class io_desc_read_write;
 public:
     // We want to represent the fact that write requests are (maybe) more expensive
     // than read requests. To avoid dealing with floating point math we will scale one
@@ -105,6 +176,37 @@ class io_queue {
         unsigned disk_req_write_to_read_multiplier = read_request_base_count;
         unsigned disk_bytes_write_to_read_multiplier = read_request_base_count;
         sstring mountpoint = "undefined";
+        // If set, the limits above are a reservation and the queue borrows from
+        // this group the capacity left unused by the other queues of the device.
+        std::shared_ptr<fair_group> group;
+        // Reads and writes larger than this are split into requests of this size,
+        // queued separately so that they interleave with other classes. 0 disables.
+        size_t max_request_size = 0;
+        // Whether contiguous reads or writes of the same file and class that are
+        // dispatched together are submitted as one vectored request.
+        bool merge_requests = false;
+        size_t max_merged_request_size = 128 << 10;
+
+        struct request_cost {
+            // Per request, in units of read_request_base_count
+            unsigned weight;
+            // Per byte, in units of read_request_base_count
+            unsigned bytes_multiplier;
+        };
+        // If not empty, the costs of reads and writes by size, instead of the
+        // write-to-read multipliers: entry i covers requests of up to 4kB << i
+        // bytes, the last one everything larger.
+        std::vector<request_cost> read_costs;
+        std::vector<request_cost> write_costs;
+        // If not empty, scales the costs of all requests by the recent mix of
+        // reads and writes: entry i applies when about i tenths of the requests
+        // are reads. In units of read_request_base_count.
+        std::vector<unsigned> mix_multipliers;
+
+        // Fills the tables above from the model, so that every request costs
+        // its share of the device's time. read_req_rate and read_bytes_rate are
+        // the rates max_req_count and max_bytes_count are derived from.
+        void set_cost_model(const io_device_model& model, uint64_t read_req_rate, uint64_t read_bytes_rate);
     };
 
     io_queue(config cfg);
@@ -113,6 +215,12 @@ class io_queue {
     future<size_t>
     queue_request(const io_priority_class& pc, size_t len, internal::io_request req);
 
+    // Like queue_request(), for a read of \c len bytes done by \c op, a
+    // blocking system call (e.g. sendfile(2)) run in the syscall thread.
+    // \c op returns -errno on failure.
+    future<size_t>
+    queue_blocking_read(const io_priority_class& pc, size_t len, noncopyable_function<ssize_t ()> op);
+
     size_t capacity() const {
         return _config.capacity;
     }
@@ -134,6 +242,19 @@ class io_queue {
     // Dispatch requests that are pending in the I/O queue
     void poll_io_queue() {
         _fq.dispatch_requests();
+        if (!_pending_requests.empty()) {
+            submit_pending_requests();
+        }
+    }
+
+    // How many requests were submitted as part of a merged request
+    uint64_t merged_requests() const {
+        return _merged_requests;
+    }
+
+    // How many requests were split because they were larger than max_request_size
+    uint64_t split_requests() const {
+        return _split_requests;
     }
 
     sstring mountpoint() const {
@@ -148,6 +269,7 @@ class io_queue {
     }
 
     future<> update_shares_for_class(io_priority_class pc, size_t new_shares);
+    future<> update_latency_target_for_class(io_priority_class pc, std::chrono::microseconds target);
     void rename_priority_class(io_priority_class pc, sstring new_name);
 
     friend class reactor;
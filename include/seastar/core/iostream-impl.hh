@@ -140,6 +140,35 @@ future<> output_stream<CharType>::write(temporary_buffer<CharType> p) {
     return write(net::packet(std::move(p)));
 }
 
+template <typename CharType>
+future<>
+output_stream<CharType>::write_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc) {
+    // Hand whatever is buffered to the sink first; the file's contents go after it.
+    // As in put(), a scheduled flush is disabled so that it will not write in
+    // parallel, and one in progress is waited for before putting anything else.
+    _flush = false;
+    auto f_flushed = make_ready_future<>();
+    if (_flushing) {
+        f_flushed = _in_batch.value().get_future();
+    }
+    return f_flushed.then([this] {
+        if (_ex) {
+            // a background flush failed
+            return make_exception_future<>(std::move(_ex));
+        }
+        if (_end) {
+            _buf.trim(_end);
+            _end = 0;
+            return put(std::move(_buf));
+        } else if (_zc_bufs) {
+            return zero_copy_put(std::move(_zc_bufs));
+        }
+        return make_ready_future<>();
+    }).then([this, &f, pos, len, &pc] {
+        return _fd.put_file(f, pos, len, pc);
+    });
+}
+
 template <typename CharType>
 future<temporary_buffer<CharType>>
 input_stream<CharType>::read_exactly_part(size_t n, tmp_buf out, size_t completed) {
@@ -44,6 +44,9 @@ namespace seastar {
 
 namespace net { class packet; }
 
+class file;
+class io_priority_class;
+
 class data_source_impl {
 public:
     virtual ~data_source_impl() {}
@@ -87,6 +90,12 @@ class data_sink_impl {
     virtual future<> flush() {
         return make_ready_future<>();
     }
+    // Writes \c len bytes of \c f, starting at \c pos, reading them with
+    // priority \c pc. Sinks that can have the kernel move the data (e.g.
+    // with sendfile(2)) override this; the default reads the file into
+    // buffers and put()s them. \c f must stay alive until the returned
+    // future resolves.
+    virtual future<> put_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc);
     virtual future<> close() = 0;
 };
 
@@ -112,6 +121,9 @@ class data_sink {
     future<> flush() {
         return _dsi->flush();
     }
+    future<> put_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc) {
+        return _dsi->put_file(f, pos, len, pc);
+    }
     future<> close() { return _dsi->close(); }
 };
 
@@ -316,6 +328,14 @@ class output_stream final {
     future<> write(net::packet p);
     future<> write(scattered_message<char_type> msg);
     future<> write(temporary_buffer<char_type>);
+    /// Writes \c len bytes of file \c f, starting at \c pos, after any
+    /// data already written to the stream.
+    ///
+    /// On a posix-stack socket the bytes go straight from the page cache to
+    /// the socket (sendfile(2)) and are accounted as reads of priority \c pc;
+    /// other sinks (TLS, the native stack) receive them as regular buffers.
+    /// \c f must stay alive until the returned future resolves.
+    future<> write_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc);
     future<> flush();
 
     /// Flushes the stream before closing it (and the underlying data sink) to
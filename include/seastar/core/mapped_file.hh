@@ -0,0 +1,101 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// Random access to large immutable files through plain pointers.
+//
+// mmap()ing a file would make every first access a blocking page fault that
+// stalls the reactor. Instead, a mapped_file reserves an address range the
+// size of the file and fills it in chunks with direct I/O, through the
+// file's I/O queue. Lookups into resident chunks are memory accesses; the
+// application makes chunks resident ahead of time with prefetch() or
+// ensure_resident().
+
+#include <seastar/core/file.hh>
+#include <seastar/core/shared_ptr.hh>
+
+namespace seastar {
+
+/// Options for \ref make_mapped_file()
+struct mapped_file_options {
+    /// Unit of residency, rounded up to the file's read alignment. Defaults
+    /// to a huge page.
+    size_t chunk_size = 2 << 20;
+    /// Back the mapping with transparent huge pages, to save TLB misses on
+    /// random lookups
+    bool huge_pages = true;
+    ::seastar::io_priority_class io_priority_class = default_priority_class();
+};
+
+/// A read-only, in-memory image of an immutable file.
+///
+/// Memory is reserved for the whole file but only used by the chunks that
+/// were read in, and is not accounted by the seastar allocator. Like \ref file,
+/// copies share the same mapping, which may only be used on the shard it was
+/// created on, and close() must be called before the last copy goes away.
+class mapped_file {
+    class impl;
+    shared_ptr<impl> _impl;
+
+    explicit mapped_file(shared_ptr<impl> i);
+    friend future<mapped_file> make_mapped_file(file f, mapped_file_options opts);
+public:
+    mapped_file(const mapped_file&) = default;
+    mapped_file(mapped_file&&) noexcept = default;
+    mapped_file& operator=(const mapped_file&) = default;
+    mapped_file& operator=(mapped_file&&) noexcept = default;
+    ~mapped_file();
+
+    /// \return the size of the file
+    uint64_t size() const;
+
+    /// \return the start of the file's image. Only ranges that are resident
+    ///         (see ensure_resident()) hold the file's contents.
+    const char* data() const;
+
+    /// \return whether [offset, offset + len) is resident
+    bool is_resident(uint64_t offset, size_t len) const;
+
+    /// Reads the chunks covering [offset, offset + len) that are not resident
+    /// yet. Concurrent callers share the reads of the same chunks.
+    ///
+    /// \return a future that resolves when the whole range is resident
+    future<> ensure_resident(uint64_t offset, size_t len);
+
+    /// Starts reading [offset, offset + len) in the background. Errors are
+    /// ignored; a later ensure_resident() of the range retries the read.
+    void prefetch(uint64_t offset, size_t len);
+
+    /// \return how much of the file is resident, in bytes
+    uint64_t resident_bytes() const;
+
+    /// Waits for the reads in progress, closes the file and releases the memory.
+    future<> close();
+};
+
+/// Creates the image of a file opened for reading. The file must not be
+/// modified while the image exists; it is closed by mapped_file::close().
+future<mapped_file> make_mapped_file(file f, mapped_file_options opts = {});
+
+}
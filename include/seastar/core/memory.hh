@@ -25,6 +25,7 @@
 #include <seastar/core/bitops.hh>
 #include <new>
 #include <functional>
+#include <iosfwd>
 #include <vector>
 
 namespace seastar {
@@ -133,11 +134,18 @@ class reclaimer {
 extern compat::polymorphic_allocator<char>* malloc_allocator;
 
 // Call periodically to recycle objects that were freed
-// on cpu other than the one they were allocated on.
+// on cpu other than the one they were allocated on, and to hand
+// over objects of other cpus freed here.
 //
 // Returns @true if any work was actually performed.
 bool drain_cross_cpu_freelist();
 
+// Hands over the objects of other cpus freed here so far, and stops
+// batching them until the next drain_cross_cpu_freelist(). Call before
+// going to sleep, so that other cpus don't wait for this one to wake up
+// to get their memory back.
+void flush_cross_cpu_frees();
+
 
 // We don't want the memory code calling back into the rest of
 // the system, so allow the rest of the system to tell the memory
@@ -160,15 +168,20 @@ class statistics {
     uint64_t _mallocs;
     uint64_t _frees;
     uint64_t _cross_cpu_frees;
+    uint64_t _cross_cpu_free_batches;
     size_t _total_memory;
     size_t _free_memory;
     uint64_t _reclaims;
     uint64_t _large_allocs;
+    size_t _released_memory;
+    uint64_t _memory_releases;
 private:
-    statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees,
-            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims, uint64_t large_allocs)
-        : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees)
-        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims), _large_allocs(large_allocs) {}
+    statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees, uint64_t cross_cpu_free_batches,
+            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims, uint64_t large_allocs,
+            uint64_t released_memory, uint64_t memory_releases)
+        : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees), _cross_cpu_free_batches(cross_cpu_free_batches)
+        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims), _large_allocs(large_allocs)
+        , _released_memory(released_memory), _memory_releases(memory_releases) {}
 public:
     /// Total number of memory allocations calls since the system was started.
     uint64_t mallocs() const { return _mallocs; }
@@ -177,6 +190,9 @@ class statistics {
     /// Total number of memory deallocations that occured on a different lcore
     /// than the one on which they were allocated.
     uint64_t cross_cpu_frees() const { return _cross_cpu_frees; }
+    /// Total number of batches in which cross-cpu frees were handed over
+    /// to the lcores owning the memory.
+    uint64_t cross_cpu_free_batches() const { return _cross_cpu_free_batches; }
     /// Total number of objects which were allocated but not freed.
     size_t live_objects() const { return mallocs() - frees(); }
     /// Total free memory (in bytes)
@@ -189,6 +205,10 @@ class statistics {
     uint64_t reclaims() const { return _reclaims; }
     /// Number of allocations which violated the large allocation threshold
     uint64_t large_allocations() const { return _large_allocs; }
+    /// Free memory (in bytes) currently returned to the OS; part of free_memory()
+    size_t released_memory() const { return _released_memory; }
+    /// Number of free spans returned to the OS since the system was started
+    uint64_t memory_releases() const { return _memory_releases; }
     friend statistics stats();
 };
 
@@ -208,6 +228,37 @@ size_t min_free_memory();
 /// Sets the value of free memory low water mark in memory::page_size units.
 void set_min_free_pages(size_t pages);
 
+/// How free memory is returned to the OS.
+enum class free_memory_release {
+    none,     ///< free memory stays resident (default)
+    dontneed, ///< pages are dropped immediately (MADV_DONTNEED)
+    lazy,     ///< pages are dropped when the OS needs them (MADV_FREE)
+};
+
+/// Return free memory of this lcore to the OS in the background.
+///
+/// Once more than four times the free memory low water mark (see
+/// min_free_memory()) is free and resident, free spans of at least
+/// huge_page_size are released until only twice the low water mark is left.
+/// The check runs from the reactor's poll loop, not from free(). Has no
+/// effect when memory is backed by hugetlbfs.
+void set_free_memory_release(free_memory_release mode);
+
+/// Return all free spans of at least huge_page_size to the OS now.
+///
+/// Uses the mode set by set_free_memory_release(), or
+/// free_memory_release::dontneed if background release is disabled.
+///
+/// \return the number of bytes released
+size_t release_free_memory();
+
+/// Place large allocations in whole huge pages.
+///
+/// Allocations of at least \c threshold bytes are rounded up to a multiple of
+/// huge_page_size, so they are huge page aligned and do not share a huge page
+/// with other allocations. Zero (the default) disables this.
+void set_huge_page_allocation_threshold(size_t threshold);
+
 /// Enable the large allocation warning threshold.
 ///
 /// Warn when allocation above a given threshold are performed.
@@ -273,6 +324,68 @@ class scoped_large_allocation_warning_disable {
 /// [example flame graph](https://user-images.githubusercontent.com/1389273/72920437-f0cf8a80-3d51-11ea-92f0-f3dbeb698871.png)).
 void set_heap_profiling_enabled(bool);
 
+/// Usage of one size class of the small object allocator.
+struct small_pool_stats {
+    size_t object_size; ///< size of the objects in this class
+    size_t use_count;   ///< objects currently allocated
+    size_t free_count;  ///< free objects in the spans held by this class
+    size_t spans;       ///< spans held by this class
+    size_t memory;      ///< bytes in the spans held by this class
+    uint64_t trims;     ///< times surplus free objects were returned to their spans
+};
+
+/// Add exact-fit size classes to the small object allocator of this lcore.
+///
+/// Small allocations are served from geometrically spaced size classes (four
+/// per power of two), so an object can waste up to a fifth of its size.
+/// Applications dominated by a few object sizes can add classes for them
+/// (up to 16), for example at startup. Sizes that already have a class are
+/// ignored; sizes above the largest small allocation throw
+/// std::invalid_argument.
+void add_small_size_classes(const std::vector<size_t>& sizes);
+
+/// Per size class usage of the small object allocator of this lcore, by
+/// increasing object size. Classes with the same object size are merged.
+std::vector<small_pool_stats> small_pool_statistics();
+
+/// Usage of the size class(es) with objects of \c object_size bytes; all
+/// counts are zero if there is no such class. Unlike positions in
+/// small_pool_statistics(), sizes stay stable when classes are added.
+small_pool_stats small_pool_statistics_for(size_t object_size);
+
+/// Enable the sampling heap profiler on this lcore.
+///
+/// Unlike set_heap_profiling_enabled(), this needs no special build and is
+/// cheap enough for production: about one allocation per \c bytes allocated
+/// is sampled (as a Poisson process over allocated bytes) and has its
+/// backtrace recorded. Zero (the default) stops sampling; allocations that
+/// were already sampled are still tracked until they are freed.
+void set_heap_profiling_sample_rate(size_t bytes);
+
+/// Allocations sampled at one call site.
+struct sampled_allocation_site {
+    std::vector<uintptr_t> backtrace; ///< return addresses, innermost first
+    size_t live_count;   ///< sampled allocations not yet freed
+    size_t live_bytes;   ///< bytes in sampled allocations not yet freed
+    uint64_t alloc_count; ///< sampled allocations since sampling was enabled
+    uint64_t alloc_bytes; ///< bytes in sampled allocations since sampling was enabled
+};
+
+/// Samples collected by the sampling heap profiler on one lcore.
+struct sampled_heap_profile {
+    size_t sample_rate = 0;
+    std::vector<sampled_allocation_site> sites;
+};
+
+/// Snapshot of the sampled heap profile of this lcore.
+sampled_heap_profile get_sampled_heap_profile();
+
+/// Writes sampled heap profiles in the gperftools heap profile format.
+///
+/// The output can be read by pprof, which scales the samples by the sample
+/// rate. Profiles of several lcores are merged into one.
+void write_pprof_heap_profile(std::ostream& os, const std::vector<sampled_heap_profile>& profiles);
+
 /// Enable heap profiling for the duration of the scope.
 ///
 /// For more information about heap profiling see
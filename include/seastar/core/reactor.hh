@@ -144,11 +144,17 @@ namespace internal {
 
 class reactor_stall_sampler;
 class cpu_stall_detector;
+class idle_poll_policy;
+class task_profiler;
 
 }
 
 class kernel_completion;
 class io_queue;
+template <typename T>
+struct syscall_result;
+template <typename Extra>
+struct syscall_result_extra;
 class disk_config_params;
 
 class reactor {
@@ -189,6 +195,7 @@ class reactor {
     friend class task_quota_aio_completion;
     friend class reactor_backend_epoll;
     friend class reactor_backend_aio;
+    friend class reactor_backend_uring;
     friend class reactor_backend_selector;
     friend class aio_storage_context;
 public:
@@ -310,6 +317,14 @@ class reactor {
         void set_shares(float shares);
         struct indirect_compare;
         sched_clock::duration _time_spent_on_task_quota_violations = {};
+        // Fraction of the shard's time the queue may use, 0 if uncapped
+        float _cpu_cap = 0;
+        // What the queue may still use in this cap period; negative when it
+        // overran it, and owes that to the next period
+        sched_clock::duration _cpu_cap_budget = {};
+        bool _throttled = false;
+        sched_clock::time_point _throttled_since;
+        sched_clock::duration _throttled_time = {};
         seastar::metrics::metric_groups _metrics;
         void rename(sstring new_name);
     private:
@@ -322,6 +337,11 @@ class reactor {
     int64_t _last_vruntime = 0;
     task_queue_list _active_task_queues;
     task_queue_list _activating_task_queues;
+    // Queues with tasks that exhausted their CPU cap for this period
+    task_queue_list _throttled_task_queues;
+    sched_clock::duration _cpu_cap_period = std::chrono::milliseconds(100);
+    // Starts a new cap period, while some queue has a CPU cap
+    timer<> _cpu_cap_timer;
     task_queue* _at_destroy_tasks;
     sched_clock::duration _task_quota;
     /// Handler that will be called when there is no task to execute on cpu.
@@ -346,6 +366,10 @@ class reactor {
     sched_clock::duration _total_sleep;
     sched_clock::time_point _start_time = sched_clock::now();
     std::chrono::nanoseconds _max_poll_time = calculate_poll_time();
+    // If set, chooses how long to poll when idle, up to _max_poll_time
+    std::unique_ptr<internal::idle_poll_policy> _idle_poll_policy;
+    // Set while the task profiler is enabled
+    std::unique_ptr<internal::task_profiler> _task_profiler;
     circular_buffer<output_stream<char>* > _flush_batching;
     std::atomic<bool> _sleeping alignas(seastar::cache_line_size);
     pthread_t _thread_id alignas(seastar::cache_line_size) = pthread_self();
@@ -353,9 +377,12 @@ class reactor {
     bool _force_io_getevents_syscall = false;
     bool _bypass_fsync = false;
     bool _have_aio_fsync = false;
+    bool _async_metadata = true;
     std::atomic<bool> _dying{false};
 private:
     static std::chrono::nanoseconds calculate_poll_time();
+    // How long to poll for work when idle before going to sleep
+    std::chrono::nanoseconds idle_poll_time() const;
     static void block_notifier(int);
     void wakeup();
     size_t handle_aio_error(internal::linux_abi::iocb* iocb, int ec);
@@ -412,6 +439,7 @@ class reactor {
     std::unique_ptr<thread_pool> _thread_pool;
     friend class thread_pool;
     friend class internal::cpu_stall_detector;
+    friend class internal::task_profiler;
 
     uint64_t pending_task_count() const;
     void run_tasks(task_queue& tq);
@@ -423,6 +451,12 @@ class reactor {
     void insert_active_task_queue(task_queue* tq);
     void insert_activating_task_queues();
     void account_runtime(task_queue& tq, sched_clock::duration runtime);
+    bool over_cpu_cap(const task_queue& tq) const;
+    void throttle(task_queue& tq);
+    void unthrottle(task_queue& tq);
+    void remove_throttled(task_queue& tq);
+    void start_cpu_cap_period();
+    void set_cpu_cap(task_queue& tq, float fraction);
     void account_idle(sched_clock::duration idletime);
     void allocate_scheduling_group_specific_data(scheduling_group sg, scheduling_group_key key);
     future<> init_scheduling_group(scheduling_group sg, sstring name, float shares);
@@ -489,6 +523,18 @@ class reactor {
     /// \param shares the new shares value
     /// \return a future that is ready when the share update is applied
     future<> update_shares_for_class(io_priority_class pc, uint32_t shares);
+
+    /// \brief Sets the queueing latency target for a given priority class
+    ///
+    /// Requests of this class that risk waiting in the I/O queue for longer than
+    /// \c target are dispatched ahead of their shares-based turn, within a bounded
+    /// lead over the other classes. Like \ref update_shares_for_class, this applies
+    /// to the requests issued by the calling shard.
+    ///
+    /// \param pc the priority class handle
+    /// \param target the latency target, or zero to disable it
+    /// \return a future that is ready when the target is applied
+    future<> update_latency_target_for_class(io_priority_class pc, std::chrono::microseconds target);
     static future<> rename_priority_class(io_priority_class pc, sstring new_name);
 
     void configure(boost::program_options::variables_map config);
@@ -508,6 +554,13 @@ class reactor {
 
     future<> write_all(pollable_fd_state& fd, const void* buffer, size_t size);
 
+    // Whether sendfile() can transfer data from \c f, i.e. whether it is
+    // backed by a regular file descriptor.
+    bool can_sendfile(const file& f) const;
+    // Transfers up to \c len bytes of \c f at \c pos to the socket \c out_fd
+    // with sendfile(2), accounted and scheduled as a read of priority \c pc.
+    future<size_t> sendfile(int out_fd, const file& f, uint64_t pos, size_t len, const io_priority_class& pc);
+
     future<file> open_file_dma(sstring name, open_flags flags, file_open_options options = {});
     future<file> open_directory(sstring name);
     future<> make_directory(sstring name, file_permissions permissions = file_permissions::default_dir_permissions);
@@ -538,6 +591,24 @@ class reactor {
             const io_priority_class& priority_class,
             size_t len,
             internal::io_request req);
+private:
+    // File metadata operations are submitted to the kernel when the backend
+    // can run them asynchronously (have_async_metadata_op()), instead of
+    // going through the syscall thread. The paths are kept alive until the
+    // operation completes.
+    bool have_async_metadata_op(internal::io_request::operation op) const;
+    future<syscall_result<int>> submit_metadata_op(internal::io_request::operation op, int fd,
+            sstring path = {}, sstring new_path = {}, int flags = 0, mode_t mode = 0);
+    future<syscall_result_extra<struct stat>> submit_statx(int dirfd, sstring path, int flags);
+    future<syscall_result<int>> open_file_dma_in_thread_pool(sstring name, open_flags flags, file_open_options options);
+public:
+    // Runs the blocking system call \c op in the syscall thread and completes
+    // \c desc with its result, which is -errno on failure.
+    void submit_blocking_io(kernel_completion* desc, noncopyable_function<ssize_t ()> op);
+    future<size_t> submit_blocking_read(io_queue* ioq,
+            const io_priority_class& priority_class,
+            size_t len,
+            noncopyable_function<ssize_t ()> op);
 
     inline void handle_io_result(ssize_t res) {
         if (res < 0) {
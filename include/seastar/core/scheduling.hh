@@ -263,6 +263,18 @@ class scheduling_group {
     /// \param shares number of shares allotted to the group. Use numbers
     ///               in the 1-1000 range.
     void set_shares(float shares);
+    /// Caps the CPU time the group may use.
+    ///
+    /// Shares only divide the CPU among the groups that have work to do, so a
+    /// group alone on the shard uses all of it. A cap holds even then: once
+    /// the group used \c fraction of a cap period (see --cpu-cap-period-ms),
+    /// its tasks wait until the next period, and the shard may idle. The cap
+    /// is enforced at the granularity of the task quota, with any overrun
+    /// deducted from the next period. The adjustment is local to the shard.
+    ///
+    /// \param fraction fraction of the shard's time the group may use. 0, or
+    ///                 1 and above, remove the cap.
+    void set_cpu_cap(float fraction);
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
     friend future<> destroy_scheduling_group(scheduling_group sg);
     friend future<> rename_scheduling_group(scheduling_group sg, sstring new_name);
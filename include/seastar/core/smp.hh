@@ -26,10 +26,13 @@
 #include <seastar/core/metrics.hh>
 #include <seastar/core/posix.hh>
 #include <seastar/core/reactor_config.hh>
+#include <seastar/core/cacheline.hh>
 #include <boost/lockfree/spsc_queue.hpp>
 #include <boost/thread/barrier.hpp>
 #include <boost/range/irange.hpp>
 #include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
 #include <deque>
 #include <thread>
 
@@ -46,6 +49,13 @@ namespace internal {
 
 unsigned smp_service_group_id(smp_service_group ssg);
 
+// What a shard publishes about the cross-shard requests it serves. Written
+// only by that shard, read by the others.
+struct alignas(seastar::cache_line_size) smp_load_stats {
+    std::atomic<uint64_t> backlog{0};
+    std::atomic<uint64_t> service_latency_ns{0};
+};
+
 }
 
 /// Returns shard_id of the of the current shard.
@@ -127,6 +137,26 @@ using smp_service_group_semaphore_units = semaphore_units<named_semaphore_except
 
 static constexpr smp_timeout_clock::time_point smp_no_timeout = smp_timeout_clock::time_point::max();
 
+/// The load of a shard, as seen by cross-shard callers.
+///
+/// \see smp::load()
+struct smp_shard_load {
+    /// Cross-shard requests the shard received and didn't complete yet
+    size_t backlog = 0;
+    /// Moving average of the time from sending a cross-shard request to
+    /// completing it, including the time it waited in the queue
+    std::chrono::microseconds service_latency{0};
+};
+
+/// Thrown by \ref smp::submit_to() when the destination shard is more loaded
+/// than \ref smp_submit_to_options allows.
+class smp_overloaded_error : public std::exception {
+public:
+    virtual const char* what() const noexcept override {
+        return "destination shard is overloaded";
+    }
+};
+
 /// Options controlling the behaviour of \ref smp::submit_to().
 struct smp_submit_to_options {
     /// Controls resource allocation.
@@ -135,6 +165,13 @@ struct smp_submit_to_options {
     /// processed by the remote shard, and *not* to the time it takes to be
     /// executed there.
     smp_timeout_clock::time_point timeout = smp_no_timeout;
+    /// Admission control: fail calls to a remote shard whose backlog is at
+    /// least this, with \ref smp_overloaded_error, instead of queueing them.
+    /// 0 admits all calls.
+    size_t max_backlog = 0;
+    /// Same as \c max_backlog, for the service latency of the remote shard.
+    /// 0 admits all calls.
+    std::chrono::microseconds max_service_latency{0};
 
     smp_submit_to_options(smp_service_group service_group = default_smp_service_group(), smp_timeout_clock::time_point timeout = smp_no_timeout)
         : service_group(service_group)
@@ -150,6 +187,10 @@ class smp_message_queue {
     static constexpr size_t queue_length = 128;
     static constexpr size_t batch_size = 16;
     static constexpr size_t prefetch_cnt = 2;
+    // Work items up to this size are recycled by the shard that submits,
+    // and later frees, them
+    static constexpr size_t small_item_size = 2 * seastar::cache_line_size;
+    static constexpr size_t max_cached_items = 4 * queue_length;
     struct work_item;
     struct lf_queue_remote {
         reactor* remote;
@@ -183,7 +224,12 @@ class smp_message_queue {
     struct work_item : public task {
         explicit work_item(smp_service_group ssg) : task(current_scheduling_group()), ssg(ssg) {}
         smp_service_group ssg;
+        // When the sending shard queued it, so that the service latency
+        // includes the time it waited to be picked up
+        std::chrono::steady_clock::time_point sent;
         virtual ~work_item() {}
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
         virtual void fail_with(std::exception_ptr) = 0;
         void process();
         virtual void complete() = 0;
@@ -257,6 +303,7 @@ class smp_message_queue {
     void respond(work_item* wi);
     void move_pending();
     void flush_request_batch();
+    bool should_flush_now() const;
     void flush_response_batch();
     bool has_unflushed_responses() const;
     bool pure_poll_rx() const;
@@ -274,13 +321,25 @@ class smp {
       void operator()(smp_message_queue** qs) const;
     };
     static std::unique_ptr<smp_message_queue*[], qs_deleter> _qs;
+    static std::unique_ptr<internal::smp_load_stats[]> _loads;
     static std::thread::id _tmain;
     static bool _using_dpdk;
 
+    friend class smp_message_queue;
+
     template <typename Func>
     using returns_future = is_future<std::result_of_t<Func()>>;
     template <typename Func>
     using returns_void = std::is_same<std::result_of_t<Func()>, void>;
+
+    static bool admit(shard_id t, const smp_submit_to_options& options) {
+        if (!options.max_backlog && !options.max_service_latency.count()) {
+            return true;
+        }
+        auto l = load(t);
+        return (!options.max_backlog || l.backlog < options.max_backlog)
+                && (!options.max_service_latency.count() || l.service_latency < options.max_service_latency);
+    }
 public:
     static boost::program_options::options_description get_options_description();
     static void register_network_stacks();
@@ -326,6 +385,9 @@ class smp {
                 return futurize<std::result_of_t<Func()>>::make_exception_future(std::current_exception());
             }
         } else {
+            if (!admit(t, options)) {
+                return futurize<std::result_of_t<Func()>>::make_exception_future(smp_overloaded_error());
+            }
             return _qs[t][this_shard_id()].submit(t, options, std::forward<Func>(func));
         }
     }
@@ -347,6 +409,86 @@ class smp {
     static futurize_t<std::result_of_t<Func()>> submit_to(unsigned t, Func&& func) {
         return submit_to(t, default_smp_service_group(), std::forward<Func>(func));
     }
+    /// Returns the load of shard \c t, as it last published it.
+    ///
+    /// The load is updated as the shard receives and completes cross-shard
+    /// requests, so it is cheap to read, but slightly stale.
+    static smp_shard_load load(shard_id t) {
+        auto& l = _loads[t];
+        smp_shard_load ret;
+        ret.backlog = l.backlog.load(std::memory_order_relaxed);
+        ret.service_latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::nanoseconds(l.service_latency_ns.load(std::memory_order_relaxed)));
+        return ret;
+    }
+    /// Returns the least loaded of \c shards: the one with the smallest
+    /// backlog, then with the lowest service latency.
+    ///
+    /// \param shards a non-empty range of shard ids
+    template <typename Range>
+    static shard_id least_loaded(const Range& shards) {
+        return least_loaded(shards, smp_submit_to_options());
+    }
+    /// Returns the least loaded of the \c shards that \c options admits,
+    /// or, if it admits none of them, the least loaded of all \c shards.
+    ///
+    /// \param shards a non-empty range of shard ids
+    template <typename Range>
+    static shard_id least_loaded(const Range& shards, const smp_submit_to_options& options) {
+        auto best = *std::begin(shards);
+        auto best_load = load(best);
+        bool best_admitted = admit(best, options);
+        for (shard_id t : shards) {
+            auto l = load(t);
+            bool admitted = admit(t, options);
+            if ((admitted && !best_admitted)
+                    || (admitted == best_admitted
+                        && (l.backlog < best_load.backlog
+                            || (l.backlog == best_load.backlog && l.service_latency < best_load.service_latency)))) {
+                best = t;
+                best_load = l;
+                best_admitted = admitted;
+            }
+        }
+        return best;
+    }
+    /// Runs a function on the least loaded of several cores.
+    ///
+    /// For work that can run on any of \c shards, this routes calls
+    /// away from shards that fall behind. The call goes to a shard that
+    /// the admission control of \c options admits, if there is one, so
+    /// it fails with \ref smp_overloaded_error only if all of \c shards
+    /// are overloaded.
+    ///
+    /// \param shards a non-empty range of shard ids
+    /// \see least_loaded(), submit_to()
+    template <typename Range, typename Func>
+    static futurize_t<std::result_of_t<Func()>> submit_to_least_loaded(const Range& shards, smp_submit_to_options options, Func&& func) {
+        return submit_to(least_loaded(shards, options), options, std::forward<Func>(func));
+    }
+    /// Runs several functions on a remote core, as a single cross-shard call.
+    ///
+    /// Sends one message, and takes one unit of the smp_service_group, for
+    /// all of \c funcs, which then run concurrently on core \c t. Cheaper
+    /// than a submit_to() per function when there are many small ones.
+    /// \c funcs stay on the calling core until they all complete.
+    ///
+    /// \param t designates the core to run the functions on.
+    /// \param options an \ref smp_submit_to_options that contains options for this call.
+    /// \param funcs callables to run on core \c t. May return void or future<>.
+    /// \returns a future that resolves when all the functions completed, and
+    ///          fails if any of them did.
+    template <typename Func>
+    static future<> submit_batch_to(shard_id t, smp_submit_to_options options, std::vector<Func> funcs) {
+        static_assert(std::is_same<future<>, typename futurize<std::result_of_t<Func()>>::type>::value, "bad Func signature");
+        return do_with(std::move(funcs), [t, options] (std::vector<Func>& funcs) {
+            return submit_to(t, options, [&funcs] {
+                return parallel_for_each(funcs, [] (Func& func) {
+                    return futurize_apply(func);
+                });
+            });
+        });
+    }
     static bool poll_queues();
     static bool pure_poll_queues();
     static boost::integer_range<unsigned> all_cpus() {
@@ -0,0 +1,88 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// A sampling profiler of the tasks the reactor runs.
+//
+// The reactor accounts runtime per scheduling group, which doesn't tell which
+// continuations use it, and profilers can't tell lambdas apart. When enabled,
+// the task profiler times about one in every N tasks and accounts the time to
+// the task's type. For continuations, that is the lambda they run, named
+// after the function that defines it.
+
+#include <seastar/core/future.hh>
+#include <seastar/core/sstring.hh>
+#include <chrono>
+#include <vector>
+
+namespace seastar {
+
+namespace httpd {
+
+class http_server;
+
+}
+
+/// What the task profiler saw of one task type
+struct task_profile_entry {
+    sstring task_type;
+    /// Tasks that were timed
+    uint64_t samples = 0;
+    /// Estimated number of tasks run, and time spent running them
+    uint64_t tasks = 0;
+    std::chrono::nanoseconds runtime{0};
+};
+
+/// The task types that used the most time in a scheduling group
+struct task_profile_group {
+    sstring scheduling_group;
+    /// Estimated number of tasks run, and time spent running them, for all types
+    uint64_t tasks = 0;
+    std::chrono::nanoseconds runtime{0};
+    /// By decreasing runtime
+    std::vector<task_profile_entry> top;
+};
+
+/// Enables the task profiler on this shard, timing about one task every
+/// \c period. 0 disables it and drops the profile. Can also be set with the
+/// --task-profiler-sample-period option.
+void set_task_profiler_sample_period(unsigned period);
+
+/// \return the profile of this shard, with the \c top_n task types of each
+///         scheduling group, or nothing if the profiler is disabled
+std::vector<task_profile_group> get_task_profile(size_t top_n = 20);
+
+/// \return the profile of all shards together, with the \c top_n task types
+///         of each scheduling group
+future<std::vector<task_profile_group>> collect_task_profile(size_t top_n = 20);
+
+/// Forgets what the profiler saw on this shard so far
+void reset_task_profile();
+
+/// Adds a GET handler at \c path that returns the profile of all shards in
+/// JSON. The "top" query parameter sets the number of task types per
+/// scheduling group, 20 by default.
+void add_task_profile_route(httpd::http_server& server, sstring path = "/task_profile");
+
+}
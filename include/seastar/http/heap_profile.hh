@@ -0,0 +1,54 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/http/handlers.hh>
+#include <seastar/http/httpd.hh>
+#include <seastar/core/distributed.hh>
+
+namespace seastar {
+
+namespace httpd {
+
+/**
+ * Serves the sampled heap profile (see memory::set_heap_profiling_sample_rate())
+ * in the heap profile format read by pprof, e.g.
+ * `pprof http://host:port/heap_profile`.
+ *
+ * Profiles of all shards are merged, unless a single one is picked with
+ * the `shard` query parameter.
+ */
+class heap_profile_handler : public handler_base {
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override;
+};
+
+/// \defgroup add_heap_profile_routes adds a \c path endpoint serving the sampled heap profile
+/// @{
+future<> add_heap_profile_routes(http_server& server, sstring path = "/heap_profile");
+future<> add_heap_profile_routes(distributed<http_server>& server, sstring path = "/heap_profile");
+/// @}
+
+}
+
+}
@@ -124,6 +124,13 @@ class udp_channel {
     future<udp_datagram> receive();
     future<> send(const socket_address& dst, const char* msg);
     future<> send(const socket_address& dst, packet p);
+    /// Sends several datagrams, each to its own destination, in order.
+    ///
+    /// The posix stack hands the whole batch to the kernel with as few
+    /// system calls as it can (sendmmsg(2)), and merges runs of equally
+    /// sized datagrams to the same destination into one UDP GSO send when
+    /// the kernel supports it. Other stacks send them one by one.
+    future<> send_batch(std::vector<std::pair<socket_address, packet>> datagrams);
     bool is_closed() const;
     /// Causes a pending receive() to complete (possibly with an exception)
     void shutdown_input();
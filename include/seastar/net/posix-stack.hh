@@ -25,6 +25,7 @@
 #include <seastar/core/sharded.hh>
 #include <seastar/net/stack.hh>
 #include <seastar/core/polymorphic_temporary_buffer.hh>
+#include <seastar/core/circular_buffer.hh>
 #include <boost/program_options.hpp>
 
 namespace seastar {
@@ -117,13 +118,58 @@ class posix_data_source_impl final : public data_source_impl {
 };
 
 class posix_data_sink_impl : public data_sink_impl {
+    // With MSG_ZEROCOPY the kernel transmits straight from the packet's memory,
+    // so it must stay alive until the kernel reports, through the socket's error
+    // queue, that it is done with it. Every successful zero-copy sendmsg() is
+    // assigned the next 32-bit sequence number and notifications carry inclusive
+    // ranges of those numbers.
+    //
+    // The state is shared with a background reaper, so the socket and the
+    // packets outlive the sink if it is closed while sends are still in flight.
+    class zero_copy_state : public enable_lw_shared_from_this<zero_copy_state> {
+        struct in_flight {
+            uint32_t first_seq;
+            uint32_t nr_seqs;
+            uint32_t outstanding;
+            packet p;
+        };
+        lw_shared_ptr<pollable_fd> _fd;
+        const size_t _threshold;
+        uint32_t _next_seq = 0;
+        circular_buffer<in_flight> _in_flight;
+        compat::optional<pollable_fd> _errqueue_fd; // epoll instance, readable on notifications
+        bool _reaping = false;
+        bool _kernel_copies = false;
+    public:
+        zero_copy_state(lw_shared_ptr<pollable_fd> fd, size_t threshold)
+            : _fd(std::move(fd)), _threshold(threshold) {}
+        bool wants(size_t len) const {
+            return !_kernel_copies && len >= _threshold;
+        }
+        future<> send(packet p) {
+            reap();
+            return send_some(std::move(p), _next_seq, 0);
+        }
+    private:
+        future<> send_some(packet p, uint32_t first_seq, uint32_t nr_seqs);
+        void retire(packet p, uint32_t first_seq, uint32_t nr_seqs);
+        void complete(uint32_t lo, uint32_t hi);
+        // Returns whether any notification was consumed.
+        bool reap() noexcept;
+        future<> wait_for_notification();
+        void maybe_start_reaper();
+    };
     lw_shared_ptr<pollable_fd> _fd;
     packet _p;
+    lw_shared_ptr<zero_copy_state> _zc; // null if zero-copy send is disabled
 public:
-    explicit posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
+    // Packets of at least \c zero_copy_threshold bytes are transmitted with
+    // MSG_ZEROCOPY, if the socket supports it. 0 disables zero-copy send.
+    explicit posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd, size_t zero_copy_threshold = 0);
     using data_sink_impl::put;
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
+    future<> put_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc) override;
     future<> close() override;
 };
 
@@ -191,8 +237,7 @@ class posix_network_stack : public network_stack {
 protected:
     compat::polymorphic_allocator<char>* _allocator;
 public:
-    explicit posix_network_stack(boost::program_options::variables_map opts, compat::polymorphic_allocator<char>* allocator=memory::malloc_allocator) :
-        _reuseport(engine().posix_reuseport_available()), _allocator(allocator) {}
+    explicit posix_network_stack(boost::program_options::variables_map opts, compat::polymorphic_allocator<char>* allocator=memory::malloc_allocator);
     virtual server_socket listen(socket_address sa, listen_options opts) override;
     virtual ::seastar::socket socket() override;
     virtual net::udp_channel make_udp_channel(const socket_address&) override;
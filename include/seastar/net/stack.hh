@@ -90,6 +90,7 @@ class udp_channel_impl {
     virtual future<udp_datagram> receive() = 0;
     virtual future<> send(const socket_address& dst, const char* msg) = 0;
     virtual future<> send(const socket_address& dst, packet p) = 0;
+    virtual future<> send_batch(std::vector<std::pair<socket_address, packet>> datagrams);
     virtual void shutdown_input() = 0;
     virtual void shutdown_output() = 0;
     virtual bool is_closed() const = 0;
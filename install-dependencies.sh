@@ -32,6 +32,7 @@ debian_packages=(
     ragel
     libhwloc-dev
     libnuma-dev
+    liburing-dev
     libpciaccess-dev
     libcrypto++-dev
     libboost-all-dev
@@ -97,6 +98,7 @@ fedora_packages=(
     libubsan
     libasan
     libatomic
+    liburing-devel
 )
 
 centos_packages=(
@@ -125,6 +127,7 @@ arch_packages=(
     boost-libs
     hwloc
     numactl
+    liburing
     libpciaccess
     crypto++
     libxml2
@@ -171,6 +174,7 @@ opensuse_packages=(
     libgnutlsxx28
     liblz4-devel
     libnuma-devel
+    liburing-devel
     lksctp-tools-devel
     ninja protobuf-devel
     ragel
@@ -0,0 +1,446 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#include <seastar/core/caching_file.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/future-util.hh>
+#include <boost/intrusive/list.hpp>
+#include <boost/range/irange.hpp>
+#include <unordered_map>
+#include <cstring>
+
+namespace seastar {
+
+namespace bi = boost::intrusive;
+
+namespace {
+
+struct block_key {
+    uint64_t file_id;
+    uint64_t index;
+
+    bool operator==(const block_key& o) const {
+        return file_id == o.file_id && index == o.index;
+    }
+};
+
+struct block_key_hash {
+    size_t operator()(const block_key& k) const {
+        return std::hash<uint64_t>()((k.file_id * 0x9e3779b97f4a7c15ull) ^ k.index);
+    }
+};
+
+class block_cache {
+public:
+    struct block {
+        bi::list_member_hook<> lru_link;
+        // Unlinks itself from the file's list when the block is destroyed
+        bi::list_member_hook<bi::link_mode<bi::auto_unlink>> file_link;
+        block_key key;
+        temporary_buffer<char> data;
+    };
+    using file_blocks = bi::list<block,
+            bi::member_hook<block, bi::list_member_hook<bi::link_mode<bi::auto_unlink>>, &block::file_link>,
+            bi::constant_time_size<false>>;
+private:
+    using lru_type = bi::list<block,
+            bi::member_hook<block, bi::list_member_hook<>, &block::lru_link>,
+            bi::constant_time_size<false>>;
+
+    // A block being read from the disk. Readers that miss on it wait for
+    // the read already in progress.
+    struct load {
+        shared_promise<> done;
+        temporary_buffer<char> data;
+        bool invalidated = false;
+    };
+
+    std::unordered_map<block_key, block, block_key_hash> _blocks;
+    std::unordered_map<block_key, lw_shared_ptr<load>, block_key_hash> _loads;
+    // Front is the most recently used block
+    lru_type _lru;
+    size_t _capacity;
+    uint64_t _next_file_id = 0;
+    block_cache_stats _stats;
+    memory::reclaimer _reclaimer;
+    metrics::metric_groups _metrics;
+
+    void erase(block& b) {
+        _stats.used_bytes -= b.data.size();
+        _lru.erase(_lru.iterator_to(b));
+        _blocks.erase(b.key);
+    }
+
+    void evict_one() {
+        erase(_lru.back());
+        _stats.evictions++;
+    }
+
+    void shrink_to(size_t bytes) {
+        while (_stats.used_bytes > bytes && !_lru.empty()) {
+            evict_one();
+        }
+    }
+
+    void insert(file_blocks& blocks, block_key key, temporary_buffer<char> data) {
+        if (data.size() > _capacity) {
+            return;
+        }
+        shrink_to(_capacity - data.size());
+        auto& b = _blocks[key];
+        b.key = key;
+        _stats.used_bytes += data.size();
+        b.data = std::move(data);
+        _lru.push_front(b);
+        blocks.push_back(b);
+    }
+
+    memory::reclaiming_result reclaim(memory::reclaimer::request req) {
+        if (_lru.empty()) {
+            return memory::reclaiming_result::reclaimed_nothing;
+        }
+        auto target = _stats.used_bytes > req.bytes_to_reclaim ? _stats.used_bytes - req.bytes_to_reclaim : 0;
+        shrink_to(target);
+        return memory::reclaiming_result::reclaimed_something;
+    }
+public:
+    block_cache()
+        : _capacity(memory::stats().total_memory() / 20)
+        , _reclaimer([this] (memory::reclaimer::request req) { return reclaim(req); })
+    {
+        namespace sm = seastar::metrics;
+        _metrics.add_group("block_cache", {
+            sm::make_derive("hits", _stats.hits, sm::description("block lookups served from memory")),
+            sm::make_derive("misses", _stats.misses, sm::description("block lookups that read from the disk")),
+            sm::make_derive("coalesced_misses", _stats.coalesced_misses,
+                    sm::description("block lookups that waited for a read of the same block already in progress")),
+            sm::make_derive("evictions", _stats.evictions, sm::description("blocks evicted to make room or on memory pressure")),
+            sm::make_gauge("bytes", [this] { return _stats.used_bytes; }, sm::description("memory held by cached blocks")),
+            sm::make_gauge("capacity", [this] { return _capacity; }, sm::description("maximum memory held by cached blocks")),
+        });
+    }
+
+    uint64_t new_file_id() {
+        return _next_file_id++;
+    }
+
+    void set_capacity(size_t bytes) {
+        _capacity = bytes;
+        shrink_to(bytes);
+    }
+
+    block_cache_stats stats() const {
+        auto s = _stats;
+        s.capacity = _capacity;
+        return s;
+    }
+
+    template <typename Fetch>
+    future<temporary_buffer<char>> get(file_blocks& blocks, block_key key, Fetch fetch) {
+        auto it = _blocks.find(key);
+        if (it != _blocks.end()) {
+            _stats.hits++;
+            auto& b = it->second;
+            _lru.erase(_lru.iterator_to(b));
+            _lru.push_front(b);
+            return make_ready_future<temporary_buffer<char>>(b.data.share());
+        }
+        auto lit = _loads.find(key);
+        if (lit != _loads.end()) {
+            _stats.coalesced_misses++;
+            return lit->second->done.get_shared_future().then([l = lit->second] {
+                return l->data.share();
+            });
+        }
+        _stats.misses++;
+        auto l = make_lw_shared<load>();
+        _loads.emplace(key, l);
+        return futurize_apply(fetch).then_wrapped([this, &blocks, key, l] (future<temporary_buffer<char>> f) {
+            if (!l->invalidated) {
+                _loads.erase(key);
+            }
+            if (f.failed()) {
+                auto ex = f.get_exception();
+                l->done.set_exception(ex);
+                return make_exception_future<temporary_buffer<char>>(std::move(ex));
+            }
+            l->data = f.get0();
+            if (!l->invalidated) {
+                insert(blocks, key, l->data.share());
+            }
+            l->done.set_value();
+            return make_ready_future<temporary_buffer<char>>(l->data.share());
+        });
+    }
+
+    // Drops the blocks [first, last] of a file, and makes the reads of those
+    // blocks in progress not populate the cache.
+    void invalidate(file_blocks& blocks, uint64_t file_id, uint64_t first, uint64_t last) {
+        if (last - first < 64) {
+            for (auto index = first; index <= last; index++) {
+                auto it = _blocks.find(block_key{file_id, index});
+                if (it != _blocks.end()) {
+                    erase(it->second);
+                }
+            }
+        } else {
+            for (auto it = blocks.begin(); it != blocks.end();) {
+                auto& b = *it++;
+                if (b.key.index >= first && b.key.index <= last) {
+                    erase(b);
+                }
+            }
+        }
+        for (auto it = _loads.begin(); it != _loads.end();) {
+            if (it->first.file_id == file_id && it->first.index >= first && it->first.index <= last) {
+                it->second->invalidated = true;
+                it = _loads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+};
+
+thread_local std::unique_ptr<block_cache> local_block_cache;
+
+block_cache& get_local_block_cache() {
+    if (!local_block_cache) {
+        local_block_cache = std::make_unique<block_cache>();
+        engine().at_destroy([] {
+            local_block_cache.reset();
+        });
+    }
+    return *local_block_cache;
+}
+
+}
+
+class caching_file_impl final : public file_impl {
+    file _file;
+    block_cache& _cache;
+    uint64_t _id;
+    size_t _block_size;
+    block_cache::file_blocks _blocks;
+    // Lowest block read short, i.e. the one holding EOF
+    uint64_t _eof_block = std::numeric_limits<uint64_t>::max();
+    gate _gate;
+private:
+    future<temporary_buffer<char>> get_block(uint64_t index, const io_priority_class& pc) {
+        return _cache.get(_blocks, block_key{_id, index}, [this, index, &pc] {
+            return _file.dma_read_bulk<char>(index * _block_size, _block_size, pc).then([this, index] (temporary_buffer<char> buf) {
+                if (buf.size() > _block_size) {
+                    buf.trim(_block_size);
+                }
+                if (buf.size() < _block_size) {
+                    _eof_block = std::min(_eof_block, index);
+                }
+                return buf;
+            });
+        });
+    }
+
+    // Reads the blocks covering [pos, pos + len) concurrently, and returns how much
+    // was copied up to the first short block (EOF).
+    future<size_t> read_into(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) {
+        if (!len) {
+            return make_ready_future<size_t>(0);
+        }
+        auto first = pos / _block_size;
+        auto last = (pos + len - 1) / _block_size;
+        return do_with(std::vector<size_t>(last - first + 1), [this, pos, dst, len, first, last, &pc] (std::vector<size_t>& copied) {
+            return parallel_for_each(boost::irange<uint64_t>(first, last + 1), [this, pos, dst, len, first, &copied, &pc] (uint64_t index) {
+                return get_block(index, pc).then([this, pos, dst, len, first, index, &copied] (temporary_buffer<char> block) {
+                    auto block_start = index * _block_size;
+                    auto from = std::max(pos, block_start);
+                    auto to = std::min(pos + len, block_start + block.size());
+                    if (to > from) {
+                        std::memcpy(dst + (from - pos), block.get() + (from - block_start), to - from);
+                        copied[index - first] = to - from;
+                    }
+                });
+            }).then([this, pos, len, first, &copied] {
+                size_t total = 0;
+                for (size_t i = 0; i < copied.size(); i++) {
+                    auto block_start = (first + i) * _block_size;
+                    auto expected = std::min(pos + len, block_start + _block_size) - std::max(pos, block_start);
+                    total += copied[i];
+                    if (copied[i] < expected) {
+                        break;
+                    }
+                }
+                return total;
+            });
+        });
+    }
+
+    void invalidate(uint64_t pos, uint64_t len) {
+        if (!len) {
+            return;
+        }
+        auto first = pos / _block_size;
+        auto last = (pos + len - 1) / _block_size;
+        // Reaching the EOF block may extend the file, which makes the short
+        // and empty blocks cached from the old EOF onward stale
+        if (last >= _eof_block) {
+            first = std::min(first, _eof_block);
+            last = std::numeric_limits<uint64_t>::max();
+            _eof_block = std::numeric_limits<uint64_t>::max();
+        }
+        _cache.invalidate(_blocks, _id, first, last);
+    }
+
+    template <typename Func>
+    auto invalidating(uint64_t pos, uint64_t len, Func&& func) {
+        return with_gate(_gate, std::forward<Func>(func)).finally([this, pos, len] {
+            invalidate(pos, len);
+        });
+    }
+public:
+    caching_file_impl(file f, caching_file_options opts)
+        : _file(std::move(f))
+        , _cache(get_local_block_cache())
+        , _id(_cache.new_file_id())
+    {
+        _memory_dma_alignment = _file.memory_dma_alignment();
+        _disk_read_dma_alignment = _file.disk_read_dma_alignment();
+        _disk_write_dma_alignment = _file.disk_write_dma_alignment();
+        _block_size = align_up<size_t>(std::max(opts.block_size, size_t(1)), _disk_read_dma_alignment);
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        return invalidating(pos, len, [this, pos, buffer, len, &pc] {
+            return _file.dma_write(pos, reinterpret_cast<const char*>(buffer), len, pc);
+        });
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        return invalidating(pos, len, [this, pos, iov = std::move(iov), &pc] () mutable {
+            return _file.dma_write(pos, std::move(iov), pc);
+        });
+    }
+
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override {
+        return with_gate(_gate, [this, pos, buffer, len, &pc] {
+            return read_into(pos, reinterpret_cast<char*>(buffer), len, pc);
+        });
+    }
+
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        return with_gate(_gate, [this, pos, iov = std::move(iov), &pc] {
+            std::vector<future<size_t>> reads;
+            reads.reserve(iov.size());
+            auto p = pos;
+            for (auto& v : iov) {
+                reads.push_back(read_into(p, reinterpret_cast<char*>(v.iov_base), v.iov_len, pc));
+                p += v.iov_len;
+            }
+            return when_all_succeed(reads.begin(), reads.end()).then([iov] (std::vector<size_t> sizes) {
+                size_t total = 0;
+                for (size_t i = 0; i < sizes.size(); i++) {
+                    total += sizes[i];
+                    if (sizes[i] < iov[i].iov_len) {
+                        break;
+                    }
+                }
+                return total;
+            });
+        });
+    }
+
+    virtual future<> flush() override {
+        return _file.flush();
+    }
+
+    virtual future<struct stat> stat() override {
+        return _file.stat();
+    }
+
+    virtual future<> truncate(uint64_t length) override {
+        return invalidating(length, std::numeric_limits<uint64_t>::max() - length, [this, length] {
+            return _file.truncate(length);
+        });
+    }
+
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        return invalidating(offset, length, [this, offset, length] {
+            return _file.discard(offset, length);
+        });
+    }
+
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _file.allocate(position, length);
+    }
+
+    virtual future<uint64_t> size() override {
+        return _file.size();
+    }
+
+    virtual future<> close() override {
+        return _gate.close().then([this] {
+            invalidate(0, std::numeric_limits<uint64_t>::max());
+            return _file.close();
+        });
+    }
+
+    virtual std::unique_ptr<file_handle_impl> dup() override {
+        return get_file_impl(_file)->dup();
+    }
+
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override {
+        return _file.list_directory(std::move(next));
+    }
+
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        return with_gate(_gate, [this, offset, range_size, &pc] {
+            // Copied out, so that callers can't modify the cached blocks
+            auto buf = temporary_buffer<uint8_t>::aligned(_memory_dma_alignment, range_size);
+            auto dst = reinterpret_cast<char*>(buf.get_write());
+            return read_into(offset, dst, range_size, pc).then([buf = std::move(buf)] (size_t size) mutable {
+                buf.trim(size);
+                return std::move(buf);
+            });
+        });
+    }
+};
+
+file make_caching_file(file f, caching_file_options opts) {
+    return file(make_shared<caching_file_impl>(std::move(f), opts));
+}
+
+void set_block_cache_capacity(size_t bytes) {
+    get_local_block_cache().set_capacity(bytes);
+}
+
+block_cache_stats get_block_cache_stats() {
+    return get_local_block_cache().stats();
+}
+
+}
@@ -28,25 +28,145 @@
 #include <chrono>
 #include <unordered_set>
 #include <cmath>
+#include <algorithm>
 
 namespace seastar {
 
+// Whether taking n more out of a pool of max, of which free is left and borrowed
+// is held by the queue asking, leaves enough for the other queues to reach their
+// part of the pool. Their parts are in proportion to their demand.
+static bool leaves_others_their_part(int64_t n, int64_t free, int64_t max, int64_t borrowed, uint64_t demand, uint64_t total_demand) {
+    if (!n || total_demand <= demand) {
+        return true;
+    }
+    auto others_part = max * (double(total_demand - demand) / total_demand);
+    auto others_hold = max - free - borrowed;
+    return free - n >= others_part - others_hold;
+}
+
+bool fair_group::grab(int64_t req_count, int64_t bytes_count, uint64_t demand,
+        int64_t borrowed_req_count, int64_t borrowed_bytes_count, bool force) {
+    if (!force) {
+        auto total_demand = _demand.load(std::memory_order_relaxed);
+        if (!leaves_others_their_part(req_count, _req_count.load(std::memory_order_relaxed), _max_req_count,
+                    borrowed_req_count, demand, total_demand)
+                || !leaves_others_their_part(bytes_count, _bytes_count.load(std::memory_order_relaxed), _max_bytes_count,
+                    borrowed_bytes_count, demand, total_demand)) {
+            return false;
+        }
+    }
+    auto c = _req_count.fetch_sub(req_count, std::memory_order_relaxed) - req_count;
+    auto b = _bytes_count.fetch_sub(bytes_count, std::memory_order_relaxed) - bytes_count;
+    if (force || (c >= 0 && b >= 0)) {
+        return true;
+    }
+    release(req_count, bytes_count);
+    return false;
+}
+
+void fair_group::release(int64_t req_count, int64_t bytes_count) {
+    _req_count.fetch_add(req_count, std::memory_order_relaxed);
+    _bytes_count.fetch_add(bytes_count, std::memory_order_relaxed);
+}
+
+static int64_t excess(int64_t executing, unsigned limit) {
+    return std::max(executing - int64_t(limit), int64_t(0));
+}
+
 void fair_queue::push_priority_class(priority_class_ptr pc) {
     if (!pc->_queued) {
-        _handles.push(pc);
+        _handles.push_back(pc);
+        std::push_heap(_handles.begin(), _handles.end(), class_compare());
         pc->_queued = true;
     }
 }
 
 priority_class_ptr fair_queue::pop_priority_class() {
     assert(!_handles.empty());
-    auto h = _handles.top();
-    _handles.pop();
+    std::pop_heap(_handles.begin(), _handles.end(), class_compare());
+    auto h = std::move(_handles.back());
+    _handles.pop_back();
     assert(h->_queued);
     h->_queued = false;
     return h;
 }
 
+float fair_queue::request_cost(const priority_class& pc, const fair_queue_request_descriptor& desc) const {
+    auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+    auto req_cost  = (float(desc.weight) / _config.max_req_count + float(desc.size) / _config.max_bytes_count) / pc._shares;
+    return expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
+}
+
+void fair_queue::push_deadline(const priority_class_ptr& pc) {
+    if (pc->_latency_target.count() && !pc->_queue.empty()) {
+        auto deadline = pc->_queue.front().queued_at + pc->_latency_target;
+        _waiting.push_back(deadline_entry{deadline - pc->_latency_target / 2, deadline, pc});
+        std::push_heap(_waiting.begin(), _waiting.end(), urgent_at_compare());
+        ++pc->_deadline_entries;
+    }
+}
+
+// Called with an entry that was taken off a heap because it is out of date
+void fair_queue::refresh_deadline(const priority_class_ptr& pc) {
+    if (!--pc->_deadline_entries) {
+        push_deadline(pc);
+    }
+}
+
+bool fair_queue::deadline_is_current(const deadline_entry& e) const {
+    auto& pc = *e.pc;
+    return pc._latency_target.count() && !pc._queue.empty()
+            && pc._queue.front().queued_at + pc._latency_target == e.deadline;
+}
+
+// Finds the class with a latency target whose oldest request is closest to
+// missing it, provided that request already waited for half of the target and
+// the class has not used up its lead. The class is taken out of _handles, like
+// pop_priority_class() would do.
+priority_class_ptr fair_queue::pop_urgent_class() {
+    auto pop = [] (std::vector<deadline_entry>& heap, auto compare) {
+        std::pop_heap(heap.begin(), heap.end(), compare);
+        auto e = std::move(heap.back());
+        heap.pop_back();
+        return e;
+    };
+    while (!_urgent.empty() && !deadline_is_current(_urgent.front())) {
+        refresh_deadline(pop(_urgent, deadline_compare()).pc);
+    }
+    auto now = std::chrono::steady_clock::now();
+    while (!_waiting.empty() && _waiting.front().urgent_at <= now) {
+        auto e = pop(_waiting, urgent_at_compare());
+        if (deadline_is_current(e)) {
+            _urgent.push_back(std::move(e));
+            std::push_heap(_urgent.begin(), _urgent.end(), deadline_compare());
+        } else {
+            refresh_deadline(e.pc);
+        }
+    }
+    if (_urgent.empty()) {
+        return nullptr;
+    }
+    auto deadline = _urgent.front().deadline;
+    auto urgent = _urgent.front().pc;
+    // A class that is late even with its lead used up gets a new one, but only
+    // once per target, so it can't starve the others by being late all the time.
+    if (now >= deadline && now - urgent->_rearmed_at >= urgent->_latency_target) {
+        urgent->_lead = 0;
+        urgent->_rearmed_at = now;
+    }
+    if (urgent->_lead >= _config.max_latency_lead) {
+        return nullptr;
+    }
+
+    auto it = std::find(_handles.begin(), _handles.end(), urgent);
+    assert(it != _handles.end());
+    std::swap(*it, _handles.back());
+    _handles.pop_back();
+    std::make_heap(_handles.begin(), _handles.end(), class_compare());
+    urgent->_queued = false;
+    return urgent;
+}
+
 float fair_queue::normalize_factor() const {
     return std::numeric_limits<float>::min();
 }
@@ -61,12 +181,58 @@ void fair_queue::normalize_stats() {
 }
 
 bool fair_queue::can_dispatch() const {
+    if (_config.group) {
+        // Whether the next request fits is only known once it is picked, see borrow_for()
+        return _requests_queued && (_requests_executing < _config.capacity);
+    }
     return _requests_queued &&
            (_requests_executing < _config.capacity) &&
            (_req_count_executing < _config.max_req_count) &&
            (_bytes_count_executing < _config.max_bytes_count);
 }
 
+// Takes from the group whatever the request needs beyond our own limits. A queue
+// with nothing executing always gets its request through, even if that puts the
+// group in debt, so that no queue can be starved by the others.
+bool fair_queue::borrow_for(const fair_queue_request_descriptor& desc) {
+    if (!_config.group) {
+        return true;
+    }
+    auto req_count = excess(int64_t(_req_count_executing) + desc.weight, _config.max_req_count) - _borrowed_req_count;
+    auto bytes_count = excess(int64_t(_bytes_count_executing) + desc.size, _config.max_bytes_count) - _borrowed_bytes_count;
+    if (!req_count && !bytes_count) {
+        return true;
+    }
+    if (!_config.group->grab(req_count, bytes_count, _demand, _borrowed_req_count, _borrowed_bytes_count, _requests_executing == 0)) {
+        return false;
+    }
+    _borrowed_req_count += req_count;
+    _borrowed_bytes_count += bytes_count;
+    return true;
+}
+
+void fair_queue::return_borrowed() {
+    if (!_config.group) {
+        return;
+    }
+    auto req_count = excess(_req_count_executing, _config.max_req_count);
+    auto bytes_count = excess(_bytes_count_executing, _config.max_bytes_count);
+    _config.group->release(_borrowed_req_count - req_count, _borrowed_bytes_count - bytes_count);
+    _borrowed_req_count = req_count;
+    _borrowed_bytes_count = bytes_count;
+}
+
+// Counts the shares of \c pc in our demand while it has requests queued
+void fair_queue::update_demand(priority_class& pc, bool backlogged) {
+    if (!_config.group) {
+        return;
+    }
+    int64_t delta = backlogged ? pc._shares : -int64_t(pc._demand);
+    pc._demand = backlogged ? pc._shares : 0;
+    _demand += delta;
+    _config.group->add_demand(delta);
+}
+
 priority_class_ptr fair_queue::register_priority_class(uint32_t shares) {
     priority_class_ptr pclass = make_lw_shared<priority_class>(shares);
     _all_classes.insert(pclass);
@@ -91,7 +257,13 @@ void fair_queue::queue(priority_class_ptr pc, fair_queue_request_descriptor desc
     // Since we don't know which queue we will use to execute the next request - if ours or
     // someone else's, we need a separate promise at this point.
     push_priority_class(pc);
-    pc->_queue.push_back(priority_class::request{std::move(func), std::move(desc)});
+    pc->_queue.push_back(priority_class::request{std::move(func), std::move(desc), std::chrono::steady_clock::now()});
+    if (pc->_queue.size() == 1) {
+        update_demand(*pc, true);
+    }
+    if (!pc->_deadline_entries) {
+        push_deadline(pc);
+    }
     _requests_queued++;
 }
 
@@ -99,33 +271,43 @@ void fair_queue::notify_requests_finished(fair_queue_request_descriptor& desc) {
     _requests_executing--;
     _req_count_executing -= desc.weight;
     _bytes_count_executing -= desc.size;
+    return_borrowed();
 }
 
 
 void fair_queue::dispatch_requests() {
     while (can_dispatch()) {
-        priority_class_ptr h;
-        do {
-            h = pop_priority_class();
-        } while (h->_queue.empty());
+        priority_class_ptr h = pop_urgent_class();
+        bool out_of_turn = bool(h);
+        if (!h) {
+            do {
+                h = pop_priority_class();
+            } while (h->_queue.empty());
+        }
+
+        if (!borrow_for(h->_queue.front().desc)) {
+            push_priority_class(h);
+            break;
+        }
+        if (out_of_turn) {
+            ++h->_lead;
+        }
 
         auto req = std::move(h->_queue.front());
         h->_queue.pop_front();
+        if (h->_queue.empty()) {
+            update_demand(*h, false);
+        }
         _requests_executing++;
         _req_count_executing += req.desc.weight;
         _bytes_count_executing += req.desc.size;
         _requests_queued--;
 
-        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-        auto req_cost  = (float(req.desc.weight) / _config.max_req_count + float(req.desc.size) / _config.max_bytes_count) / h->_shares;
-        auto cost  = expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
-        float next_accumulated = h->_accumulated + cost;
+        float next_accumulated = h->_accumulated + request_cost(*h, req.desc);
         while (std::isinf(next_accumulated)) {
             normalize_stats();
             // If we have renormalized, our time base will have changed. This should happen very infrequently
-            delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-            cost  = expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
-            next_accumulated = h->_accumulated + cost;
+            next_accumulated = h->_accumulated + request_cost(*h, req.desc);
         }
         h->_accumulated = next_accumulated;
 
@@ -140,4 +322,13 @@ void fair_queue::update_shares(priority_class_ptr pc, uint32_t new_shares) {
     pc->update_shares(new_shares);
 }
 
+void fair_queue::set_latency_target(priority_class_ptr pc, std::chrono::microseconds target) {
+    auto old_target = pc->_latency_target;
+    pc->_latency_target = std::max(target, std::chrono::microseconds(0));
+    // Entries for the old target no longer match and are dropped as they come up
+    if (pc->_latency_target != old_target) {
+        push_deadline(pc);
+    }
+}
+
 }
@@ -23,6 +23,7 @@
 
 #include <seastar/core/file.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/gate.hh>
 
 #include <deque>
 #include <atomic>
@@ -79,12 +80,21 @@ class posix_file_impl : public file_impl {
     virtual std::unique_ptr<seastar::file_handle_impl> dup() override;
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override;
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override;
+    // Transfers up to \c len bytes at \c pos to \c out_fd with sendfile(2).
+    future<size_t> sendfile(int out_fd, uint64_t pos, size_t len, const io_priority_class& pc);
 
     open_flags flags() const {
         return _open_flags;
     }
 private:
+    // Buffered (non-O_DIRECT) descriptor of the same file, for sendfile().
+    int _sendfile_fd = -1;
+    // Held by sendfile() calls, which close() waits for.
+    gate _sendfile_gate;
+
     void query_dma_alignment();
+    void close_sendfile_fd() noexcept;
+    future<> close_fd(int fd) noexcept;
 
     /**
      * Try to read from the given position where the previous short read has
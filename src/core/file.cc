@@ -25,6 +25,7 @@
 #include <dirent.h>
 #include <linux/types.h> // for xfs, below
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <xfs/linux.h>
 #define min min    /* prevent xfs.h from defining min() as a macro */
 #include <xfs/xfs.h>
@@ -78,6 +79,7 @@ posix_file_impl::posix_file_impl(int fd, open_flags f, file_open_options options
 }
 
 posix_file_impl::~posix_file_impl() {
+    close_sendfile_fd();
     if (_refcount && _refcount->fetch_add(-1, std::memory_order_relaxed) != 1) {
         return;
     }
@@ -125,11 +127,14 @@ posix_file_impl::flush(void) {
 
 future<struct stat>
 posix_file_impl::stat(void) {
-    return engine()._thread_pool->submit<syscall_result_extra<struct stat>>([this] {
+    auto stated = engine().have_async_metadata_op(internal::io_request::operation::statx)
+            ? engine().submit_statx(_fd, "", AT_EMPTY_PATH)
+            : engine()._thread_pool->submit<syscall_result_extra<struct stat>>([this] {
         struct stat st;
         auto ret = ::fstat(_fd, &st);
         return wrap_syscall(ret, st);
-    }).then([] (syscall_result_extra<struct stat> ret) {
+    });
+    return stated.then([] (syscall_result_extra<struct stat> ret) {
         ret.throw_if_error();
         return make_ready_future<struct stat>(ret.extra);
     });
@@ -197,6 +202,15 @@ posix_file_impl::close() noexcept {
     }
     auto fd = _fd;
     _fd = -1;  // Prevent a concurrent close (which is illegal) from closing another file's fd
+    // A sendfile() running in the syscall thread still uses both descriptors.
+    return _sendfile_gate.close().then([this, fd] {
+        close_sendfile_fd();
+        return close_fd(fd);
+    });
+}
+
+future<>
+posix_file_impl::close_fd(int fd) noexcept {
     if (_refcount && _refcount->fetch_add(-1, std::memory_order_relaxed) != 1) {
         _refcount = nullptr;
         return make_ready_future<>();
@@ -205,6 +219,9 @@ posix_file_impl::close() noexcept {
     _refcount = nullptr;
     auto closed = [fd] () noexcept {
         try {
+            if (engine().have_async_metadata_op(internal::io_request::operation::close)) {
+                return engine().submit_metadata_op(internal::io_request::operation::close, fd);
+            }
             return engine()._thread_pool->submit<syscall_result<int>>([fd] {
                 return wrap_syscall<int>(::close(fd));
             });
@@ -345,6 +362,44 @@ posix_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priorit
     return engine().submit_io_read(_io_queue, io_priority_class, len, std::move(req)).finally([iov = std::move(iov)] () {});
 }
 
+future<size_t>
+posix_file_impl::sendfile(int out_fd, uint64_t pos, size_t len, const io_priority_class& pc) {
+    return with_gate(_sendfile_gate, [this, out_fd, pos, len, &pc] {
+        auto opened = make_ready_future<>();
+        if (_sendfile_fd == -1) {
+            // sendfile() has to read through the page cache, which _fd bypasses
+            // with O_DIRECT, so reopen the file without it.
+            opened = engine()._thread_pool->submit<syscall_result<int>>([path = "/proc/self/fd/" + to_sstring(_fd)] {
+                return wrap_syscall<int>(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+            }).then([this] (syscall_result<int> sr) {
+                sr.throw_if_error();
+                if (_sendfile_fd == -1) {
+                    _sendfile_fd = sr.result;
+                } else {
+                    // Lost a race with a concurrent sendfile()
+                    ::close(sr.result);
+                }
+            });
+        }
+        return opened.then([this, out_fd, pos, len, &pc] {
+            return engine().submit_blocking_read(_io_queue, pc, len, [in_fd = _sendfile_fd, out_fd, pos, len] {
+                off_t off = pos;
+                auto r = ::sendfile(out_fd, in_fd, &off, len);
+                return r == -1 ? ssize_t(-errno) : r;
+            });
+        });
+    });
+}
+
+void
+posix_file_impl::close_sendfile_fd() noexcept {
+    if (_sendfile_fd != -1) {
+        // Read-only and never written through, so closing it doesn't block
+        ::close(_sendfile_fd);
+        _sendfile_fd = -1;
+    }
+}
+
 future<temporary_buffer<uint8_t>>
 posix_file_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) {
     using tmp_buf_type = typename file::read_state<uint8_t>::tmp_buf_type;
@@ -24,19 +24,50 @@
 #include <seastar/core/circular_buffer.hh>
 #include <seastar/core/semaphore.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/shared_future.hh>
 #include <malloc.h>
 #include <string.h>
 
 namespace seastar {
 
+namespace {
+
+// Memory held by the read-ahead buffers of the shard's adaptive streams
+struct read_ahead_budget {
+    size_t capacity;
+    semaphore units;
+
+    explicit read_ahead_budget(size_t capacity) : capacity(capacity), units(capacity) {}
+};
+
+read_ahead_budget& local_read_ahead_budget() {
+    static thread_local read_ahead_budget budget(memory::stats().total_memory() / 32);
+    return budget;
+}
+
+}
+
+void set_file_input_stream_read_ahead_budget(size_t bytes) {
+    auto& budget = local_read_ahead_budget();
+    if (bytes > budget.capacity) {
+        budget.units.signal(bytes - budget.capacity);
+    } else {
+        budget.units.consume(budget.capacity - bytes);
+    }
+    budget.capacity = bytes;
+}
+
 class file_data_source_impl : public data_source_impl {
     struct issued_read {
         uint64_t _pos;
         uint64_t _size;
         future<temporary_buffer<char>> _ready;
+        // Read-ahead budget, returned when the buffer is consumed or dropped
+        semaphore_units<> _budget;
 
-        issued_read(uint64_t pos, uint64_t size, future<temporary_buffer<char>> f)
-            : _pos(pos), _size(size), _ready(std::move(f)) { }
+        issued_read(uint64_t pos, uint64_t size, future<temporary_buffer<char>> f, semaphore_units<> budget = {})
+            : _pos(pos), _size(size), _ready(std::move(f)), _budget(std::move(budget)) { }
     };
 
     reactor& _reactor = engine();
@@ -51,8 +82,19 @@ class file_data_source_impl : public data_source_impl {
     compat::optional<promise<>> _done;
     size_t _current_buffer_size;
     bool _in_slow_start = false;
+    // Reads since the last skip past the buffered data
+    unsigned _sequential_reads = 0;
     using unused_ratio_target = std::ratio<25, 100>;
+    static constexpr unsigned sequential_reads_threshold = 2;
 private:
+    static file_input_stream_options adapt_options(file_input_stream_options options) {
+        if (options.adaptive_read_ahead) {
+            options.dynamic_adjustments = { };
+            options.max_buffer_size = std::max(options.max_buffer_size, options.buffer_size);
+        }
+        return options;
+    }
+
     size_t minimal_buffer_size() const {
         return std::min(std::max(_options.buffer_size / 4, size_t(8192)), _options.buffer_size);
     }
@@ -69,6 +111,20 @@ class file_data_source_impl : public data_source_impl {
             }
         }
     }
+    // The consumer of a sequential stream is waiting for data: read ahead
+    // more, and in larger requests.
+    void grow_adaptive_read_ahead() {
+        if (_sequential_reads < sequential_reads_threshold) {
+            return;
+        }
+        _current_read_ahead = std::min(_current_read_ahead + 1, _options.read_ahead);
+        _current_buffer_size = std::min(_current_buffer_size * 2, _options.max_buffer_size);
+    }
+    void reset_adaptive_read_ahead() {
+        _sequential_reads = 0;
+        _current_read_ahead = 0;
+        _current_buffer_size = _options.buffer_size;
+    }
     unsigned get_initial_read_ahead() const {
         return _options.dynamic_adjustments
                ? std::min(_options.dynamic_adjustments->read_ahead, _options.read_ahead)
@@ -160,7 +216,7 @@ class file_data_source_impl : public data_source_impl {
     }
 public:
     file_data_source_impl(file f, uint64_t offset, uint64_t len, file_input_stream_options options)
-            : _file(std::move(f)), _options(options), _pos(offset), _remain(len), _current_read_ahead(get_initial_read_ahead())
+            : _file(std::move(f)), _options(adapt_options(std::move(options))), _pos(offset), _remain(len), _current_read_ahead(get_initial_read_ahead())
             , _current_buffer_size(_options.buffer_size) {
         // prevent wraparounds
         set_new_buffer_size(after_skip::no);
@@ -168,8 +224,13 @@ class file_data_source_impl : public data_source_impl {
     }
     virtual future<temporary_buffer<char>> get() override {
         if (!_read_buffers.empty() && !_read_buffers.front()._ready.available()) {
-            try_increase_read_ahead();
+            if (_options.adaptive_read_ahead) {
+                grow_adaptive_read_ahead();
+            } else {
+                try_increase_read_ahead();
+            }
         }
+        _sequential_reads++;
         issue_read_aheads(1);
         auto ret = std::move(_read_buffers.front());
         _read_buffers.pop_front();
@@ -184,11 +245,13 @@ class file_data_source_impl : public data_source_impl {
     }
     virtual future<temporary_buffer<char>> skip(uint64_t n) override {
         uint64_t dropped = 0;
+        bool past_buffers = false;
         while (n) {
             if (_read_buffers.empty()) {
                 assert(n <= _remain);
                 _pos += n;
                 _remain -= n;
+                past_buffers = true;
                 break;
             }
             auto& front = _read_buffers.front();
@@ -210,10 +273,18 @@ class file_data_source_impl : public data_source_impl {
             }
         }
         update_history_unused(dropped);
+        // Dropping read-ahead buffers within the window is still sequential access
+        if (_options.adaptive_read_ahead && past_buffers) {
+            reset_adaptive_read_ahead();
+        }
         return make_ready_future<temporary_buffer<char>>();
     }
     virtual future<> close() override {
         _done.emplace();
+        // The buffers still being read are dropped below, don't hold the budget until then
+        for (auto&& c : _read_buffers) {
+            auto budget = std::move(c._budget);
+        }
         if (!_reads_in_progress) {
             _done->set_value();
         }
@@ -244,7 +315,6 @@ class file_data_source_impl : public data_source_impl {
                 _read_buffers.emplace_back(_pos, 0, make_ready_future<temporary_buffer<char>>());
                 continue;
             }
-            ++_reads_in_progress;
             // if _pos is not dma-aligned, we'll get a short read.  Account for that.
             // Also avoid reading beyond _remain.
             uint64_t align = _file.disk_read_dma_alignment();
@@ -252,6 +322,15 @@ class file_data_source_impl : public data_source_impl {
             auto end = std::min(align_up(start + _current_buffer_size, align), _pos + _remain);
             auto len = end - start;
             auto actual_size = std::min(end - _pos, _remain);
+            semaphore_units<> budget;
+            if (_options.adaptive_read_ahead && _read_buffers.size() >= additional) {
+                auto& units = local_read_ahead_budget().units;
+                if (!units.try_wait(len)) {
+                    return;
+                }
+                budget = semaphore_units<>(units, len);
+            }
+            ++_reads_in_progress;
             _read_buffers.emplace_back(_pos, actual_size, futurize<future<temporary_buffer<char>>>::apply([&] {
                     return _file.dma_read_bulk<char>(start, len, _options.io_priority_class);
             }).then_wrapped(
@@ -278,7 +357,7 @@ class file_data_source_impl : public data_source_impl {
                     }
                     return make_ready_future<temporary_buffer<char>>(std::move(tmp));
                 }
-            }));
+            }), std::move(budget));
             _remain -= end - _pos;
             _pos = end;
         };
@@ -316,6 +395,108 @@ class file_data_sink_impl : public data_sink_impl {
     semaphore _write_behind_sem = { _options.write_behind };
     future<> _background_writes_done = make_ready_future<>();
     bool _failed = false;
+    // Aligned buffers waiting for a write-behind slot, written together with
+    // a single vectored write (max_gathered_write_size)
+    std::vector<temporary_buffer<char>> _gathered;
+    uint64_t _gathered_pos = 0;
+    size_t _gathered_size = 0;
+    // Set while the submission of _gathered is scheduled
+    lw_shared_ptr<shared_promise<>> _gathered_submitted;
+    static constexpr size_t max_gathered_buffers = IOV_MAX;
+private:
+    bool can_gather(const temporary_buffer<char>& buf) const {
+        return _options.write_behind && _options.max_gathered_write_size
+                && !(buf.size() & (_file.disk_write_dma_alignment() - 1));
+    }
+    void add_background_write(future<> this_write_done) {
+        _background_writes_done = when_all(std::move(_background_writes_done), std::move(this_write_done))
+                .then([this] (std::tuple<future<>, future<>> possible_errors) {
+            // merge the two errors, preferring the first
+            auto& e1 = std::get<0>(possible_errors);
+            auto& e2 = std::get<1>(possible_errors);
+            if (e1.failed()) {
+                e2.ignore_ready_future();
+                return std::move(e1);
+            } else {
+                if (e2.failed()) {
+                    _failed = true;
+                }
+                return std::move(e2);
+            }
+        });
+    }
+    future<> put_gathered(uint64_t pos, temporary_buffer<char> buf) {
+        if (_failed) {
+            return std::exchange(_background_writes_done, make_ready_future<>());
+        }
+        if (!_gathered.empty() && (_gathered_pos + _gathered_size != pos
+                || _gathered_size + buf.size() > _options.max_gathered_write_size
+                || _gathered.size() == max_gathered_buffers)) {
+            // Wait for the current batch to go out, which also provides back pressure
+            return _gathered_submitted->get_shared_future().then([this, pos, buf = std::move(buf)] () mutable {
+                return put_gathered(pos, std::move(buf));
+            });
+        }
+        if (_gathered.empty()) {
+            _gathered_pos = pos;
+        }
+        _gathered_size += buf.size();
+        _gathered.push_back(std::move(buf));
+        if (!_gathered_submitted) {
+            _gathered_submitted = make_lw_shared<shared_promise<>>();
+            // wait() takes all units after us, so flush() and close() see this write
+            (void)_write_behind_sem.wait().then([this] {
+                submit_gathered();
+            });
+        }
+        return make_ready_future<>();
+    }
+    void submit_gathered() {
+        auto submitted = std::exchange(_gathered_submitted, nullptr);
+        auto bufs = std::exchange(_gathered, {});
+        auto pos = _gathered_pos;
+        _gathered_size = 0;
+        if (_failed) {
+            _write_behind_sem.signal();
+        } else {
+            add_background_write(do_put_gathered(pos, std::move(bufs)).finally([this] {
+                _write_behind_sem.signal();
+            }));
+        }
+        submitted->set_value();
+    }
+    future<> do_put_gathered(uint64_t pos, std::vector<temporary_buffer<char>> bufs) noexcept {
+        if (bufs.size() == 1) {
+            return do_put(pos, std::move(bufs.front()));
+        }
+      try {
+        std::vector<iovec> iov;
+        iov.reserve(bufs.size());
+        size_t total = 0;
+        for (auto& b : bufs) {
+            iov.push_back(iovec{b.get_write(), b.size()});
+            total += b.size();
+        }
+        return _file.dma_write(pos, std::move(iov), _options.io_priority_class).then(
+                [this, pos, bufs = std::move(bufs), total] (size_t size) mutable {
+            if (size >= total) {
+                return make_ready_future<>();
+            }
+            // short write: resubmit what is left
+            auto written = size;
+            auto it = bufs.begin();
+            while (written >= it->size()) {
+                written -= it->size();
+                ++it;
+            }
+            it->trim_front(written);
+            bufs.erase(bufs.begin(), it);
+            return do_put_gathered(pos + size, std::move(bufs));
+        });
+      } catch (...) {
+          return make_exception_future<>(std::current_exception());
+      }
+    }
 public:
     file_data_sink_impl(file f, file_output_stream_options options)
             : _file(std::move(f)), _options(options) {
@@ -332,6 +513,9 @@ class file_data_sink_impl : public data_sink_impl {
         if (!_options.write_behind) {
             return do_put(pos, std::move(buf));
         }
+        if (can_gather(buf)) {
+            return put_gathered(pos, std::move(buf));
+        }
         // Write behind strategy:
         //
         // 1. Issue N writes in parallel, using a semaphore to limit to N
@@ -344,24 +528,9 @@ class file_data_sink_impl : public data_sink_impl {
                 _background_writes_done = make_ready_future<>();
                 return ret;
             }
-            auto this_write_done = do_put(pos, std::move(buf)).finally([this] {
+            add_background_write(do_put(pos, std::move(buf)).finally([this] {
                 _write_behind_sem.signal();
-            });
-            _background_writes_done = when_all(std::move(_background_writes_done), std::move(this_write_done))
-                    .then([this] (std::tuple<future<>, future<>> possible_errors) {
-                // merge the two errors, preferring the first
-                auto& e1 = std::get<0>(possible_errors);
-                auto& e2 = std::get<1>(possible_errors);
-                if (e1.failed()) {
-                    e2.ignore_ready_future();
-                    return std::move(e1);
-                } else {
-                    if (e2.failed()) {
-                        _failed = true;
-                    }
-                    return std::move(e2);
-                }
-            });
+            }));
             return make_ready_future<>();
         });
     }
@@ -444,6 +613,19 @@ output_stream<char> make_file_output_stream(file f, file_output_stream_options o
     return output_stream<char>(make_file_data_sink(std::move(f), options), options.buffer_size, true);
 }
 
+future<> data_sink_impl::put_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc) {
+    static constexpr uint64_t chunk_size = 128 * 1024;
+    return do_with(file(f), pos, len, [this, &pc] (file& f, uint64_t& pos, uint64_t& len) {
+        return do_until([&len] { return len == 0; }, [this, &f, &pos, &len, &pc] {
+            return f.dma_read_exactly<char>(pos, std::min(len, chunk_size), pc).then([this, &pos, &len] (temporary_buffer<char> buf) {
+                pos += buf.size();
+                len -= buf.size();
+                return put(std::move(buf));
+            });
+        });
+    });
+}
+
 /*
  * template initialization, definition in iostream-impl.hh
  */
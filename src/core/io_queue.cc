@@ -27,10 +27,14 @@
 #include <seastar/core/reactor.hh>
 #include <seastar/core/metrics.hh>
 #include <seastar/core/linux-aio.hh>
+#include <seastar/core/bitops.hh>
 #include <seastar/core/internal/io_desc.hh>
+#include <sys/uio.h>
 #include <chrono>
 #include <mutex>
 #include <array>
+#include <algorithm>
+#include <cmath>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
@@ -39,12 +43,46 @@ namespace seastar {
 using namespace std::chrono_literals;
 using namespace internal::linux_abi;
 
+namespace internal {
+
+void latency_histogram::add(std::chrono::steady_clock::duration d) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    unsigned idx = us <= 1 ? 0 : log2ceil(uint64_t(us));
+    // Samples past the last bucket only show up in the implicit +Inf one
+    if (idx < nr_buckets) {
+        _buckets[idx]++;
+    }
+    _count++;
+    _sum += std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+metrics::histogram latency_histogram::to_metrics_histogram() const {
+    metrics::histogram h;
+    h.sample_count = _count;
+    h.sample_sum = _sum;
+    h.buckets.resize(nr_buckets);
+    uint64_t cumulative = 0;
+    for (unsigned i = 0; i < nr_buckets; i++) {
+        cumulative += _buckets[i];
+        h.buckets[i].count = cumulative;
+        h.buckets[i].upper_bound = double(uint64_t(1) << i) / 1000000;
+    }
+    return h;
+}
+
+}
+
 class io_desc_read_write final : public kernel_completion {
     io_queue* _ioq_ptr;
     fair_queue_request_descriptor _fq_desc;
     promise<size_t> _pr;
+    internal::latency_histogram* _device_latency = nullptr;
+    std::chrono::steady_clock::time_point _dispatched;
 private:
     void notify_requests_finished() {
+        if (_device_latency) {
+            _device_latency->add(std::chrono::steady_clock::now() - _dispatched);
+        }
         _ioq_ptr->notify_requests_finished(_fq_desc);
     }
 public:
@@ -57,6 +95,13 @@ class io_desc_read_write final : public kernel_completion {
         return _fq_desc;
     }
 
+    // Called when the request leaves the fair queue; the time until completion
+    // is recorded as the device time of its class.
+    void dispatched(io_queue::priority_class_data& pclass, std::chrono::steady_clock::time_point now) {
+        _device_latency = &pclass.device_latency;
+        _dispatched = now;
+    }
+
     void set_exception(std::exception_ptr eptr) {
         notify_requests_finished();
         _pr.set_exception(eptr);
@@ -80,11 +125,130 @@ class io_desc_read_write final : public kernel_completion {
 };
 
 
+unsigned io_device_model::saturation_depth() const {
+    double peak = 0;
+    for (auto& p : concurrency) {
+        peak = std::max(peak, p.iops);
+    }
+    unsigned depth = 0;
+    for (auto& p : concurrency) {
+        if (p.iops >= peak * 0.9 && (!depth || p.depth < depth)) {
+            depth = p.depth;
+        }
+    }
+    return depth;
+}
+
+namespace {
+
+// Time the device takes per request of the given size. It grows linearly with
+// the size between the measured points and past the last one, where requests
+// are bandwidth-bound.
+double request_time(std::vector<io_device_model::rate_point> points, uint64_t size) {
+    std::sort(points.begin(), points.end(), [] (auto& a, auto& b) { return a.request_size < b.request_size; });
+    if (size <= points.front().request_size) {
+        return 1 / points.front().iops;
+    }
+    for (size_t i = 1; i < points.size(); i++) {
+        auto& lo = points[i - 1];
+        auto& hi = points[i];
+        if (size <= hi.request_size) {
+            auto f = double(size - lo.request_size) / (hi.request_size - lo.request_size);
+            return (1 - f) / lo.iops + f / hi.iops;
+        }
+    }
+    return double(size) / points.back().request_size / points.back().iops;
+}
+
+std::vector<io_queue::config::request_cost>
+make_request_costs(const std::vector<io_device_model::rate_point>& points, uint64_t read_req_rate, uint64_t read_bytes_rate) {
+    std::vector<io_queue::config::request_cost> costs;
+    if (points.empty()) {
+        return costs;
+    }
+    static constexpr unsigned max_entries = 16;
+    uint64_t largest = 0;
+    for (auto& p : points) {
+        largest = std::max(largest, p.request_size);
+    }
+    for (unsigned i = 0; i < max_entries; i++) {
+        uint64_t size = uint64_t(4096) << i;
+        auto t = request_time(points, size);
+        io_queue::config::request_cost c;
+        c.weight = std::max(unsigned(std::lround(io_queue::read_request_base_count * t * read_req_rate)), 1u);
+        c.bytes_multiplier = std::max(unsigned(std::lround(io_queue::read_request_base_count * t * read_bytes_rate / size)), 1u);
+        costs.push_back(c);
+        if (size >= largest) {
+            break;
+        }
+    }
+    return costs;
+}
+
+}
+
+void io_queue::config::set_cost_model(const io_device_model& model, uint64_t read_req_rate, uint64_t read_bytes_rate) {
+    read_costs = make_request_costs(model.read, read_req_rate, read_bytes_rate);
+    write_costs = make_request_costs(model.write, read_req_rate, read_bytes_rate);
+    mix_multipliers.clear();
+    if (model.mixed.empty()) {
+        return;
+    }
+    // Pure reads and writes are what the costs above are measured with
+    auto points = model.mixed;
+    points.push_back({0, 1});
+    points.push_back({1, 1});
+    std::sort(points.begin(), points.end(), [] (auto& a, auto& b) { return a.read_fraction < b.read_fraction; });
+    for (unsigned i = 0; i <= 10; i++) {
+        double rf = i / 10.0;
+        auto hi = std::find_if(points.begin() + 1, points.end() - 1, [rf] (auto& p) { return p.read_fraction >= rf; });
+        auto lo = hi - 1;
+        auto span = hi->read_fraction - lo->read_fraction;
+        auto f = span > 0 ? (rf - lo->read_fraction) / span : 1;
+        auto efficiency = std::min(std::max((1 - f) * lo->efficiency + f * hi->efficiency, 0.1), 2.0);
+        mix_multipliers.push_back(std::lround(read_request_base_count / efficiency));
+    }
+}
+
+std::pair<unsigned, size_t> io_queue::request_cost(bool is_write, size_t len) {
+    auto& costs = is_write ? _config.write_costs : _config.read_costs;
+    unsigned weight;
+    size_t size;
+    if (!costs.empty()) {
+        size_t idx = len <= 4096 ? 0 : std::min<size_t>(log2ceil(len) - 12, costs.size() - 1);
+        weight = costs[idx].weight;
+        size = size_t(costs[idx].bytes_multiplier) * len;
+    } else if (is_write) {
+        weight = _config.disk_req_write_to_read_multiplier;
+        size = _config.disk_bytes_write_to_read_multiplier * len;
+    } else {
+        weight = io_queue::read_request_base_count;
+        size = io_queue::read_request_base_count * len;
+    }
+    if (_config.mix_multipliers.empty()) {
+        return { weight, size };
+    }
+
+    // Halve the history every few thousand requests, so the mix follows the workload
+    static constexpr uint64_t mix_window = 4096 * read_request_base_count;
+    (is_write ? _recent_write_weight : _recent_read_weight) += weight;
+    auto total = _recent_read_weight + _recent_write_weight;
+    if (total > mix_window) {
+        _recent_read_weight /= 2;
+        _recent_write_weight /= 2;
+        total = _recent_read_weight + _recent_write_weight;
+    }
+    auto idx = (10 * _recent_read_weight + total / 2) / total;
+    auto m = _config.mix_multipliers[idx];
+    return { std::max(weight * m / read_request_base_count, 1u), size * m / read_request_base_count };
+}
+
 fair_queue::config io_queue::make_fair_queue_config(config iocfg) {
     fair_queue::config cfg;
     cfg.capacity = std::min(iocfg.capacity, reactor::max_aio_per_queue);
     cfg.max_req_count = iocfg.max_req_count;
     cfg.max_bytes_count = iocfg.max_bytes_count;
+    cfg.group = iocfg.group;
     return cfg;
 }
 
@@ -191,7 +355,16 @@ io_queue::priority_class_data::register_stats(sstring name, sstring mountpoint,
             }, sm::description("total delay time in the queue"), {io_queue_shard(shard), sm::shard_label(owner), mountlabel, class_label}),
             sm::make_gauge("shares", [this] {
                 return this->ptr->shares();
-            }, sm::description("current amount of shares"), {io_queue_shard(shard), sm::shard_label(owner), mountlabel, class_label})
+            }, sm::description("current amount of shares"), {io_queue_shard(shard), sm::shard_label(owner), mountlabel, class_label}),
+            sm::make_histogram("queue_latency", [this] {
+                return queue_latency.to_metrics_histogram();
+            }, sm::description("time requests waited in the I/O queue before being dispatched, in seconds"), {io_queue_shard(shard), sm::shard_label(owner), mountlabel, class_label}),
+            sm::make_histogram("device_latency", [this] {
+                return device_latency.to_metrics_histogram();
+            }, sm::description("time from dispatching requests to their completion, in seconds"), {io_queue_shard(shard), sm::shard_label(owner), mountlabel, class_label}),
+            sm::make_gauge("latency_target", [this] {
+                return std::chrono::duration_cast<std::chrono::duration<double>>(this->ptr->latency_target()).count();
+            }, sm::description("queueing latency target of the class in seconds, zero if it has none"), {io_queue_shard(shard), sm::shard_label(owner), mountlabel, class_label})
     });
     _metric_groups = std::exchange(new_metrics, {});
 }
@@ -235,6 +408,45 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
     return *_priority_classes[owner][id];
 }
 
+// A vectored request made of several contiguous requests. The result is handed
+// out to the parts in order, so a short read or write completes the first parts
+// and leaves the later ones with the remainder, if any.
+class io_desc_merged final : public kernel_completion {
+    struct part {
+        kernel_completion* desc;
+        size_t len;
+    };
+    std::vector<part> _parts;
+    std::vector<::iovec> _iov;
+public:
+    explicit io_desc_merged(size_t nr_parts) {
+        _parts.reserve(nr_parts);
+        _iov.reserve(nr_parts);
+    }
+
+    void add(kernel_completion* desc, void* addr, size_t len) {
+        _parts.push_back(part{desc, len});
+        _iov.push_back(::iovec{addr, len});
+    }
+
+    std::vector<::iovec>& iov() {
+        return _iov;
+    }
+
+    virtual void complete_with(ssize_t ret) override {
+        for (auto& p : _parts) {
+            if (ret < 0) {
+                p.desc->complete_with(ret);
+            } else {
+                auto n = std::min(size_t(ret), p.len);
+                ret -= n;
+                p.desc->complete_with(n);
+            }
+        }
+        delete this;
+    }
+};
+
 future<size_t>
 io_queue::queue_request(const io_priority_class& pc, size_t len, internal::io_request req) {
     auto start = std::chrono::steady_clock::now();
@@ -242,33 +454,179 @@ io_queue::queue_request(const io_priority_class& pc, size_t len, internal::io_re
         // First time will hit here, and then we create the class. It is important
         // that we create the shared pointer in the same shard it will be used at later.
         auto& pclass = find_or_create_class(pc, owner);
-        pclass.nr_queued++;
-        unsigned weight;
-        size_t size;
-        if (req.is_write()) {
-            weight = _config.disk_req_write_to_read_multiplier;
-            size = _config.disk_bytes_write_to_read_multiplier * len;
-        } else if (req.is_read()) {
-            weight = io_queue::read_request_base_count;
-            size = io_queue::read_request_base_count * len;
-        } else {
-            throw std::runtime_error(fmt::format("Unrecognized request passing through I/O queue {}", req.opname()));
+        auto op = req.opcode();
+        if (_config.max_request_size && len > _config.max_request_size &&
+                (op == internal::io_request::operation::read || op == internal::io_request::operation::write)) {
+            return queue_split_request(pclass, start, len, std::move(req));
         }
-        auto desc = std::make_unique<io_desc_read_write>(this, weight, size);
-        auto fq_desc = desc->fq_descriptor();
-        auto fut = desc->get_future();
-        _fq.queue(pclass.ptr, std::move(fq_desc), [&pclass, start, req = std::move(req), desc = desc.release(), len] () mutable noexcept {
+        return queue_one_request(pclass, start, len, std::move(req));
+    });
+}
+
+future<size_t>
+io_queue::queue_one_request(priority_class_data& pclass, std::chrono::steady_clock::time_point start, size_t len, internal::io_request req) {
+    pclass.nr_queued++;
+    if (!req.is_write() && !req.is_read()) {
+        throw std::runtime_error(fmt::format("Unrecognized request passing through I/O queue {}", req.opname()));
+    }
+    unsigned weight;
+    size_t size;
+    std::tie(weight, size) = request_cost(req.is_write(), len);
+    auto desc = std::make_unique<io_desc_read_write>(this, weight, size);
+    auto fq_desc = desc->fq_descriptor();
+    auto fut = desc->get_future();
+    _fq.queue(pclass.ptr, std::move(fq_desc), [this, &pclass, start, req = std::move(req), desc = desc.release(), len] () mutable noexcept {
+        try {
+            auto now = std::chrono::steady_clock::now();
+            pclass.nr_queued--;
+            pclass.ops++;
+            pclass.bytes += len;
+            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(now - start);
+            pclass.queue_latency.add(now - start);
+            desc->dispatched(pclass, now);
+            submit_request(desc, std::move(req), pclass);
+        } catch (...) {
+            desc->set_exception(std::current_exception());
+        }
+    });
+    return fut;
+}
+
+// Queues the pieces of a large read or write as independent requests, so that the
+// fair queue can interleave other classes' requests between them. The result is
+// the number of bytes transferred up to the first short piece.
+future<size_t>
+io_queue::queue_split_request(priority_class_data& pclass, std::chrono::steady_clock::time_point start, size_t len, internal::io_request req) {
+    auto max = _config.max_request_size;
+    std::vector<future<size_t>> parts;
+    parts.reserve((len + max - 1) / max);
+    for (size_t off = 0; off < len; off += max) {
+        auto part_len = std::min(max, len - off);
+        auto addr = reinterpret_cast<char*>(req.address()) + off;
+        auto part = req.is_read()
+                ? internal::io_request::make_read(req.fd(), req.pos() + off, addr, part_len)
+                : internal::io_request::make_write(req.fd(), req.pos() + off, addr, part_len);
+        parts.push_back(queue_one_request(pclass, start, part_len, std::move(part)));
+    }
+    _split_requests++;
+    return when_all(parts.begin(), parts.end()).then([max] (std::vector<future<size_t>> results) {
+        size_t total = 0;
+        bool short_piece = false;
+        std::exception_ptr ex;
+        for (auto& f : results) {
+            if (f.failed()) {
+                auto e = f.get_exception();
+                if (!ex) {
+                    ex = std::move(e);
+                }
+                continue;
+            }
+            auto n = f.get0();
+            if (!short_piece) {
+                total += n;
+                short_piece = n < max;
+            }
+        }
+        if (ex) {
+            return make_exception_future<size_t>(std::move(ex));
+        }
+        return make_ready_future<size_t>(total);
+    });
+}
+
+void
+io_queue::submit_request(kernel_completion* desc, internal::io_request req, const priority_class_data& pclass) {
+    auto op = req.opcode();
+    if (_config.merge_requests && (op == internal::io_request::operation::read || op == internal::io_request::operation::write)) {
+        _pending_requests.push_back(pending_request{desc, std::move(req), &pclass});
+    } else {
+        engine().submit_io(desc, std::move(req));
+    }
+}
+
+void
+io_queue::submit_pending_requests() {
+    static constexpr size_t max_merged_requests = 32;
+    auto can_merge = [this] (const pending_request& prev, const pending_request& next, size_t merged_size) {
+        return prev.pclass == next.pclass
+            && prev.req.opcode() == next.req.opcode()
+            && prev.req.fd() == next.req.fd()
+            && prev.req.pos() + prev.req.size() == next.req.pos()
+            && merged_size + next.req.size() <= _config.max_merged_request_size;
+    };
+
+    auto n = _pending_requests.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        size_t merged_size = _pending_requests[i].req.size();
+        while (j < n && j - i < max_merged_requests && can_merge(_pending_requests[j - 1], _pending_requests[j], merged_size)) {
+            merged_size += _pending_requests[j].req.size();
+            j++;
+        }
+        io_desc_merged* merged = nullptr;
+        if (j - i > 1) {
+            try {
+                merged = new io_desc_merged(j - i);
+            } catch (...) {
+                // Dispatched unmerged below
+            }
+        }
+        if (merged) {
+            auto& first = _pending_requests[i].req;
+            auto fd = first.fd();
+            auto pos = first.pos();
+            auto write = first.is_write();
+            for (auto k = i; k < j; ++k) {
+                auto& p = _pending_requests[k];
+                merged->add(p.desc, p.req.address(), p.req.size());
+            }
+            auto req = write ? internal::io_request::make_writev(fd, pos, merged->iov())
+                             : internal::io_request::make_readv(fd, pos, merged->iov());
             try {
-                pclass.nr_queued--;
-                pclass.ops++;
-                pclass.bytes += len;
-                pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start);
-                engine().submit_io(desc, std::move(req));
+                engine().submit_io(merged, std::move(req));
+                _merged_requests += j - i;
             } catch (...) {
-                desc->set_exception(std::current_exception());
+                merged->complete_with(-ENOMEM);
+            }
+        } else {
+            for (auto k = i; k < j; ++k) {
+                auto& p = _pending_requests[k];
+                try {
+                    engine().submit_io(p.desc, std::move(p.req));
+                } catch (...) {
+                    p.desc->complete_with(-ENOMEM);
+                }
             }
+        }
+        i = j;
+    }
+    _pending_requests.clear();
+}
+
+future<size_t>
+io_queue::queue_blocking_read(const io_priority_class& pc, size_t len, noncopyable_function<ssize_t ()> op) {
+    auto start = std::chrono::steady_clock::now();
+    return smp::submit_to(coordinator(), [start, &pc, len, op = std::move(op), owner = engine().cpu_id(), this] () mutable {
+        auto& pclass = find_or_create_class(pc, owner);
+        pclass.nr_queued++;
+        auto cost = request_cost(false, len);
+        auto desc = std::make_unique<io_desc_read_write>(this, cost.first, cost.second);
+        auto fq_desc = desc->fq_descriptor();
+        auto fut = desc->get_future();
+        _fq.queue(pclass.ptr, std::move(fq_desc), [&pclass, start, op = std::move(op), desc = desc.release()] () mutable noexcept {
+            auto now = std::chrono::steady_clock::now();
+            pclass.nr_queued--;
+            pclass.ops++;
+            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(now - start);
+            pclass.queue_latency.add(now - start);
+            desc->dispatched(pclass, now);
+            engine().submit_blocking_io(desc, std::move(op));
+        });
+        return fut.then([&pclass] (size_t n) {
+            pclass.bytes += n;
+            return n;
         });
-        return fut;
     });
 }
 
@@ -280,6 +638,14 @@ io_queue::update_shares_for_class(const io_priority_class pc, size_t new_shares)
     });
 }
 
+future<>
+io_queue::update_latency_target_for_class(const io_priority_class pc, std::chrono::microseconds target) {
+    return smp::submit_to(coordinator(), [this, pc, owner = engine().cpu_id(), target] {
+        auto& pclass = find_or_create_class(pc, owner);
+        _fq.set_latency_target(pclass.ptr, target);
+    });
+}
+
 void
 io_queue::rename_priority_class(io_priority_class pc, sstring new_name) {
     for (unsigned owner = 0; owner < _priority_classes.size(); owner++) {
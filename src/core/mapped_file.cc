@@ -0,0 +1,229 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#include <seastar/core/mapped_file.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/print.hh>
+#include <seastar/util/log.hh>
+#include <boost/range/irange.hpp>
+#include <sys/mman.h>
+
+namespace seastar {
+
+extern logger seastar_logger;
+
+class mapped_file::impl {
+    static constexpr size_t huge_page_size = 2 << 20;
+
+    enum class chunk_state { absent, loading, resident };
+    struct chunk {
+        chunk_state state = chunk_state::absent;
+        // Set while loading
+        lw_shared_ptr<shared_promise<>> loaded;
+    };
+
+    file _file;
+    uint64_t _size;
+    size_t _chunk_size;
+    io_priority_class _pc;
+    char* _mapping = nullptr;
+    size_t _mapping_size = 0;
+    char* _base = nullptr;
+    std::vector<chunk> _chunks;
+    uint64_t _resident_bytes = 0;
+    gate _gate;
+    bool _closed = false;
+private:
+    // Reserves the address range, aligned to a huge page so that the
+    // kernel can back it with transparent huge pages.
+    void map(size_t size, bool huge_pages) {
+        _mapping_size = size + (huge_pages ? huge_page_size : 0);
+        auto p = ::mmap(nullptr, _mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "mmap");
+        }
+        _mapping = static_cast<char*>(p);
+        _base = _mapping;
+        if (huge_pages) {
+            _base = align_up(_mapping, huge_page_size);
+            // Ignore errors, huge pages are just a hint
+            ::madvise(_base, size, MADV_HUGEPAGE);
+        }
+    }
+
+    uint64_t chunk_offset(size_t idx) const {
+        return uint64_t(idx) * _chunk_size;
+    }
+
+    size_t chunk_length(size_t idx) const {
+        return std::min<uint64_t>(_chunk_size, _size - chunk_offset(idx));
+    }
+
+    future<> load(size_t idx) {
+        auto& c = _chunks[idx];
+        if (c.state == chunk_state::resident) {
+            return make_ready_future<>();
+        }
+        if (c.state == chunk_state::loading) {
+            return c.loaded->get_shared_future();
+        }
+        c.state = chunk_state::loading;
+        c.loaded = make_lw_shared<shared_promise<>>();
+        auto fut = c.loaded->get_shared_future();
+        auto len = align_up<size_t>(chunk_length(idx), _file.disk_read_dma_alignment());
+        (void)with_gate(_gate, [this, idx, len] {
+            return _file.dma_read(chunk_offset(idx), _base + chunk_offset(idx), len, _pc);
+        }).then_wrapped([this, idx] (future<size_t> f) {
+            auto& c = _chunks[idx];
+            auto loaded = std::exchange(c.loaded, nullptr);
+            try {
+                auto size = f.get0();
+                if (size < chunk_length(idx)) {
+                    throw std::runtime_error(format("short read of chunk {} of mapped file", idx));
+                }
+                c.state = chunk_state::resident;
+                _resident_bytes += chunk_length(idx);
+                loaded->set_value();
+            } catch (...) {
+                c.state = chunk_state::absent;
+                loaded->set_exception(std::current_exception());
+            }
+        });
+        return fut;
+    }
+
+    boost::integer_range<size_t> chunks_of(uint64_t offset, size_t len) const {
+        if (!len || offset >= _size) {
+            return boost::irange<size_t>(0, 0);
+        }
+        auto end = std::min<uint64_t>(offset + len, _size);
+        return boost::irange<size_t>(offset / _chunk_size, (end - 1) / _chunk_size + 1);
+    }
+public:
+    impl(file f, uint64_t size, mapped_file_options opts)
+        : _file(std::move(f))
+        , _size(size)
+        , _chunk_size(align_up<size_t>(std::max<size_t>(opts.chunk_size, 1), _file.disk_read_dma_alignment()))
+        , _pc(opts.io_priority_class)
+        , _chunks((size + _chunk_size - 1) / _chunk_size)
+    {
+        // The last chunk is read with an aligned length, past the end of the file
+        map(align_up<uint64_t>(size, _chunk_size), opts.huge_pages);
+    }
+
+    ~impl() {
+        if (!_closed) {
+            seastar_logger.warn("mapped_file destroyed without being closed");
+        }
+        if (_mapping && _gate.get_count() == 0) {
+            ::munmap(_mapping, _mapping_size);
+        }
+    }
+
+    uint64_t size() const {
+        return _size;
+    }
+
+    const char* data() const {
+        return _base;
+    }
+
+    bool is_resident(uint64_t offset, size_t len) const {
+        for (auto idx : chunks_of(offset, len)) {
+            if (_chunks[idx].state != chunk_state::resident) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    future<> ensure_resident(uint64_t offset, size_t len) {
+        if (_closed) {
+            return make_exception_future<>(gate_closed_exception());
+        }
+        if (is_resident(offset, len)) {
+            return make_ready_future<>();
+        }
+        return parallel_for_each(chunks_of(offset, len), [this] (size_t idx) {
+            return load(idx);
+        });
+    }
+
+    uint64_t resident_bytes() const {
+        return _resident_bytes;
+    }
+
+    future<> close() {
+        _closed = true;
+        return _gate.close().then([this] {
+            ::munmap(std::exchange(_mapping, nullptr), _mapping_size);
+            _base = nullptr;
+            _resident_bytes = 0;
+            return _file.close();
+        });
+    }
+};
+
+mapped_file::mapped_file(shared_ptr<impl> i)
+    : _impl(std::move(i)) {
+}
+
+mapped_file::~mapped_file() = default;
+
+uint64_t mapped_file::size() const {
+    return _impl->size();
+}
+
+const char* mapped_file::data() const {
+    return _impl->data();
+}
+
+bool mapped_file::is_resident(uint64_t offset, size_t len) const {
+    return _impl->is_resident(offset, len);
+}
+
+future<> mapped_file::ensure_resident(uint64_t offset, size_t len) {
+    // Keep the mapping alive while reading, even if this copy goes away
+    return _impl->ensure_resident(offset, len).finally([i = _impl] {});
+}
+
+void mapped_file::prefetch(uint64_t offset, size_t len) {
+    (void)ensure_resident(offset, len).handle_exception([] (std::exception_ptr) {});
+}
+
+uint64_t mapped_file::resident_bytes() const {
+    return _impl->resident_bytes();
+}
+
+future<> mapped_file::close() {
+    return _impl->close().finally([i = _impl] {});
+}
+
+future<mapped_file> make_mapped_file(file f, mapped_file_options opts) {
+    return f.size().then([f, opts] (uint64_t size) mutable {
+        return mapped_file(make_shared<mapped_file::impl>(std::move(f), size, opts));
+    });
+}
+
+}
@@ -59,6 +59,7 @@
 #include <seastar/util/alloc_failure_injector.hh>
 #include <seastar/util/std-compat.hh>
 #include <iostream>
+#include <fstream>
 
 namespace seastar {
 
@@ -111,6 +112,9 @@ compat::polymorphic_allocator<char>* malloc_allocator{&static_malloc_allocator};
 #include <functional>
 #include <cstring>
 #include <boost/intrusive/list.hpp>
+#include <boost/functional/hash.hpp>
+#include <map>
+#include <random>
 #include <sys/mman.h>
 #include <seastar/util/defer.hh>
 #include <seastar/util/backtrace.hh>
@@ -174,8 +178,10 @@ static std::atomic<bool> live_cpus[max_cpus];
 static thread_local uint64_t g_allocs;
 static thread_local uint64_t g_frees;
 static thread_local uint64_t g_cross_cpu_frees;
+static thread_local uint64_t g_cross_cpu_free_batches;
 static thread_local uint64_t g_reclaims;
 static thread_local uint64_t g_large_allocs;
+static thread_local uint64_t g_memory_releases;
 
 using compat::optional;
 
@@ -232,7 +238,9 @@ struct free_object {
 };
 
 struct page {
-    bool free;
+    bool free : 1;
+    bool released : 1; // free span returned to the OS, valid for the head only
+    bool sampled : 1; // an object starting in this page is tracked by the heap sampler
     uint8_t offset_in_span;
     uint16_t nr_small_alloc;
     uint32_t span_size; // in pages, if we're the head or the tail
@@ -274,6 +282,17 @@ class page_list {
         span.link._prev = 0;
         _front = idx;
     }
+    void push_back(page* ary, page& span) {
+        auto idx = &span - ary;
+        if (_back) {
+            ary[_back].link._next = idx;
+        } else {
+            _front = idx;
+        }
+        span.link._prev = _back;
+        span.link._next = 0;
+        _back = idx;
+    }
     void pop_front(page* ary) {
         if (ary[_front].link._next) {
             ary[ary[_front].link._next].link._prev = 0;
@@ -298,6 +317,11 @@ class small_pool {
     unsigned _max_free;
     unsigned _pages_in_use = 0;
     page_list _span_list;
+    // Statistics
+    size_t _use_count = 0;
+    size_t _nr_objects = 0; // allocated or free, in the spans we hold
+    unsigned _nr_spans = 0;
+    uint64_t _trims = 0;
     static constexpr unsigned idx_frac_bits = 2;
 public:
     explicit small_pool(unsigned object_size) noexcept;
@@ -309,6 +333,7 @@ class small_pool {
     static constexpr unsigned size_to_idx(unsigned size);
     static constexpr unsigned idx_to_size(unsigned idx);
     allocation_site_ptr& alloc_site_holder(void* ptr);
+    small_pool_stats stats() const;
 private:
     void add_more_objects();
     void trim_free_list();
@@ -330,9 +355,13 @@ small_pool::size_to_idx(unsigned size) {
             + ((size - 1) >> (log2floor(size) - idx_frac_bits));
 }
 
+// The geometric size classes can be supplemented with exact-fit classes
+// at run time. An extra class is looked up in place of the geometric class
+// its size falls into, for the sizes it can hold.
 class small_pool_array {
 public:
     static constexpr unsigned nr_small_pools = small_pool::size_to_idx(4 * page_size) + 1;
+    static constexpr unsigned max_extra_pools = 16;
 private:
     union u {
         small_pool a[nr_small_pools];
@@ -346,8 +375,31 @@ class small_pool_array {
             // objects may be freed after we are gone.
         }
     } _u;
+    union extra {
+        small_pool a[max_extra_pools];
+        extra() {}
+        ~extra() {}
+    } _extra;
+    unsigned _nr_extra = 0;
+    // Extra pools by increasing object size
+    small_pool* _extra_sorted[max_extra_pools];
+    // Index in _extra_sorted + 1 of the smallest extra pool of each class, or 0
+    uint8_t _first_extra[nr_small_pools] = {};
 public:
     small_pool& operator[](unsigned idx) { return _u.a[idx]; }
+    unsigned size() const { return nr_small_pools + _nr_extra; }
+    small_pool& pool_at(unsigned i) { return i < nr_small_pools ? _u.a[i] : *_extra_sorted[i - nr_small_pools]; }
+    bool has_extra() const { return _nr_extra; }
+    small_pool& pool_for(unsigned size) {
+        auto idx = small_pool::size_to_idx(size);
+        if (__builtin_expect(_first_extra[idx], 0)) {
+            return extra_pool_for(size, idx);
+        }
+        return _u.a[idx];
+    }
+    bool add_extra(unsigned object_size);
+private:
+    small_pool& extra_pool_for(unsigned size, unsigned idx);
 };
 
 static constexpr size_t max_small_allocation
@@ -382,6 +434,51 @@ struct cross_cpu_free_item {
     cross_cpu_free_item* next;
 };
 
+// Sampling heap profiler. Allocated bytes are sampled as a Poisson process,
+// as in tcmalloc: on average one allocation is recorded per sample_rate bytes,
+// and pprof scales the samples back up using the rate.
+struct sampled_site {
+    boost::container::static_vector<uintptr_t, 64> frames;
+    mutable size_t live_count = 0;
+    mutable size_t live_bytes = 0;
+    mutable uint64_t alloc_count = 0;
+    mutable uint64_t alloc_bytes = 0;
+
+    bool operator==(const sampled_site& o) const {
+        return frames == o.frames;
+    }
+};
+
+struct sampled_site_hash {
+    size_t operator()(const sampled_site& s) const {
+        return boost::hash_range(s.frames.begin(), s.frames.end());
+    }
+};
+
+struct heap_sampler {
+    struct live_sample {
+        const sampled_site* site;
+        size_t size;
+    };
+    bool enabled = false;
+    size_t sample_rate = 0;
+    std::minstd_rand rng{std::random_device()()};
+    std::unordered_set<sampled_site, sampled_site_hash> sites;
+    std::map<uintptr_t, live_sample> live;
+
+    int64_t next_sample_interval() {
+        return int64_t(std::exponential_distribution<double>(1.0 / sample_rate)(rng)) + 1;
+    }
+};
+
+// Objects freed on this cpu that belong to another one, waiting to be
+// pushed onto the owner's xcpu_freelist together.
+struct cross_cpu_free_batch {
+    cross_cpu_free_item* head = nullptr;
+    cross_cpu_free_item* tail = nullptr;
+    unsigned count = 0;
+};
+
 struct cpu_pages {
     uint32_t min_free_pages = 20000000 / page_size;
     char* memory;
@@ -394,9 +491,28 @@ struct cpu_pages {
     std::function<void (std::function<void ()>)> reclaim_hook;
     std::vector<reclaimer*> reclaimers;
     static constexpr unsigned nr_span_lists = 32;
+    // Resident spans are kept at the front of each list and released ones at
+    // the back, so allocation prefers memory that is still mapped.
     page_list free_spans[nr_span_lists];  // contains aligned spans with span_size == 2^idx
+    static constexpr unsigned huge_page_pages = huge_page_size / page_size;
+    static constexpr unsigned huge_page_span_idx = log2ceil(huge_page_pages);
+    // Large allocations of at least this many pages get whole huge pages
+    uint32_t huge_page_threshold_pages = 0;
+    free_memory_release release_mode = free_memory_release::none;
+    // A huge-page-sized span was freed; checked on the next poll.
+    bool release_wanted = false;
+    bool release_pending = false;
+    bool hugetlbfs_backed = false;
+    uint32_t nr_released_pages = 0;
     small_pool_array small_pools;
     alignas(seastar::cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
+    // Remote frees are batched per owner cpu and handed over with a single
+    // atomic operation, when a batch fills up or on the next poll. Only
+    // threads that poll drain_cross_cpu_freelist() (reactor threads) batch.
+    static constexpr unsigned xcpu_batch_size = 64;
+    bool xcpu_batching = false;
+    uint64_t xcpu_pending_mask[max_cpus / 64] = {};
+    cross_cpu_free_batch xcpu_pending[max_cpus];
     static std::atomic<unsigned> cpu_id_gen;
     static cpu_pages* all_cpus[max_cpus];
     union asu {
@@ -408,6 +524,11 @@ struct cpu_pages {
     } asu;
     allocation_site_ptr alloc_site_list_head = nullptr; // For easy traversal of asu.alloc_sites from scylla-gdb.py
     bool collect_backtrace = false;
+    // Allocated bytes left until the next heap sample
+    int64_t bytes_until_sample = std::numeric_limits<int64_t>::max();
+    size_t nr_live_samples = 0;
+    bool sampling = false;
+    heap_sampler* sampler = nullptr; // lives forever once created, like alloc_sites
     char* mem() { return memory; }
 
     void link(page_list& list, page* span);
@@ -420,19 +541,27 @@ struct cpu_pages {
     void* allocate_large_and_trim(unsigned nr_pages);
     void* allocate_large(unsigned nr_pages);
     void* allocate_large_aligned(unsigned align_pages, unsigned nr_pages);
+    unsigned place_large(unsigned nr_pages) const;
     page* find_and_unlink_span(unsigned nr_pages);
     page* find_and_unlink_span_reclaiming(unsigned n_pages);
     void free_large(void* ptr);
-    bool grow_span(pageidx& start, uint32_t& nr_pages, unsigned idx);
-    void free_span(pageidx start, uint32_t nr_pages);
-    void free_span_no_merge(pageidx start, uint32_t nr_pages);
+    bool grow_span(pageidx& start, uint32_t& nr_pages, unsigned idx, bool& released);
+    void free_span(pageidx start, uint32_t nr_pages, bool released = false);
+    void free_span_no_merge(pageidx start, uint32_t nr_pages, bool released = false);
     void free_span_unaligned(pageidx start, uint32_t nr_pages);
     void* allocate_small(unsigned size);
     void free(void* ptr);
     void free(void* ptr, size_t size);
+    void set_sample_rate(size_t rate);
+    void sample_allocation(void* ptr, size_t size);
+    void forget_sample(void* ptr, page* p);
+    sampled_heap_profile sampled_profile();
     bool try_cross_cpu_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
+    void push_cross_cpu(unsigned cpu_id, cross_cpu_free_item* head, cross_cpu_free_item* tail);
+    void flush_cross_cpu_batch(unsigned cpu_id);
+    bool flush_cross_cpu_batches();
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
     page* to_page(void* p) {
@@ -445,6 +574,19 @@ struct cpu_pages {
     void schedule_reclaim();
     void set_reclaim_hook(std::function<void (std::function<void ()>)> hook);
     void set_min_free_pages(size_t pages);
+    void set_release_mode(free_memory_release mode);
+    // Free memory is released in passes with hysteresis: a pass starts once
+    // more than the high water mark is free and resident and stops at the
+    // low one, so a shard whose usage hovers around a single threshold
+    // doesn't keep releasing and refaulting the same memory.
+    size_t release_high_water_pages() const {
+        return 4 * size_t(min_free_pages);
+    }
+    size_t release_low_water_pages() const {
+        return 2 * size_t(min_free_pages);
+    }
+    bool maybe_release_free_memory();
+    size_t release_free_spans(size_t retain_pages, free_memory_release mode);
     void resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void replace_memory_backing(allocate_system_memory_fn alloc_sys_mem);
@@ -514,6 +656,9 @@ unsigned index_of(unsigned pages) {
 
 void
 cpu_pages::unlink(page_list& list, page* span) {
+    if (span->released) {
+        nr_released_pages -= span->span_size;
+    }
     list.erase(pages, *span);
 }
 
@@ -522,18 +667,24 @@ cpu_pages::link(page_list& list, page* span) {
     list.push_front(pages, *span);
 }
 
-void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages) {
+void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages, bool released) {
     assert(nr_pages);
     nr_free_pages += nr_pages;
     auto span = &pages[span_start];
     auto span_end = &pages[span_start + nr_pages - 1];
     span->free = span_end->free = true;
     span->span_size = span_end->span_size = nr_pages;
+    span->released = released;
     auto idx = index_of(nr_pages);
-    link(free_spans[idx], span);
+    if (released) {
+        nr_released_pages += nr_pages;
+        free_spans[idx].push_back(pages, *span);
+    } else {
+        link(free_spans[idx], span);
+    }
 }
 
-bool cpu_pages::grow_span(uint32_t& span_start, uint32_t& nr_pages, unsigned idx) {
+bool cpu_pages::grow_span(uint32_t& span_start, uint32_t& nr_pages, unsigned idx, bool& released) {
     auto which = (span_start >> idx) & 1; // 0=lower, 1=upper
     // locate first page of upper buddy or last page of lower buddy
     // examples: span_start = 0x10 nr_pages = 0x08 -> buddy = 0x18  (which = 0)
@@ -542,6 +693,8 @@ bool cpu_pages::grow_span(uint32_t& span_start, uint32_t& nr_pages, unsigned idx
     auto delta = ((which ^ 1) << idx) | -which;
     auto buddy = span_start + delta;
     if (pages[buddy].free && pages[buddy].span_size == nr_pages) {
+        // The merged span is only released if both halves were
+        released &= pages[span_start ^ nr_pages].released;
         unlink(free_spans[idx], &pages[span_start ^ nr_pages]);
         nr_free_pages -= nr_pages; // free_span_no_merge() will restore
         span_start &= ~nr_pages;
@@ -551,12 +704,15 @@ bool cpu_pages::grow_span(uint32_t& span_start, uint32_t& nr_pages, unsigned idx
     return false;
 }
 
-void cpu_pages::free_span(uint32_t span_start, uint32_t nr_pages) {
+void cpu_pages::free_span(uint32_t span_start, uint32_t nr_pages, bool released) {
     auto idx = index_of(nr_pages);
-    while (grow_span(span_start, nr_pages, idx)) {
+    while (grow_span(span_start, nr_pages, idx, released)) {
         ++idx;
     }
-    free_span_no_merge(span_start, nr_pages);
+    free_span_no_merge(span_start, nr_pages, released);
+    if (idx >= huge_page_span_idx && !released) {
+        release_wanted = true;
+    }
 }
 
 // Internal, used during startup. Span is not aligned so needs to be broken up
@@ -630,11 +786,12 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages) {
     }
     auto span_size = span->span_size;
     auto span_idx = span - pages;
+    auto released = span->released;
     nr_free_pages -= span->span_size;
     while (span_size >= n_pages * 2) {
         span_size /= 2;
         auto other_span_idx = span_idx + span_size;
-        free_span_no_merge(other_span_idx, span_size);
+        free_span_no_merge(other_span_idx, span_size, released);
     }
     auto span_end = &pages[span_idx + span_size - 1];
     span->free = span_end->free = false;
@@ -667,6 +824,18 @@ cpu_pages::check_large_allocation(size_t size) {
     }
 }
 
+// Buddy spans are naturally aligned, so rounding a span up to a multiple of
+// the huge page size gives it huge pages of its own, which it does not share
+// with shorter-lived small allocations. Only applies to user allocations,
+// not to small pool spans.
+unsigned
+cpu_pages::place_large(unsigned n_pages) const {
+    if (huge_page_threshold_pages && n_pages >= huge_page_threshold_pages) {
+        return align_up(n_pages, huge_page_pages);
+    }
+    return n_pages;
+}
+
 void*
 cpu_pages::allocate_large(unsigned n_pages) {
     check_large_allocation(n_pages * page_size);
@@ -740,8 +909,7 @@ small_pool::alloc_site_holder(void* ptr) {
 
 void*
 cpu_pages::allocate_small(unsigned size) {
-    auto idx = small_pool::size_to_idx(size);
-    auto& pool = small_pools[idx];
+    auto& pool = small_pools.pool_for(size);
     assert(size <= pool.object_size());
     auto ptr = pool.allocate();
 #ifdef SEASTAR_HEAPPROF
@@ -794,12 +962,51 @@ void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
         return;
     }
     auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
+    ++g_cross_cpu_frees;
+    if (!xcpu_batching) {
+        push_cross_cpu(cpu_id, p, p);
+        return;
+    }
+    auto& b = xcpu_pending[cpu_id];
+    p->next = b.head;
+    b.head = p;
+    if (!b.tail) {
+        b.tail = p;
+        xcpu_pending_mask[cpu_id / 64] |= uint64_t(1) << (cpu_id % 64);
+    }
+    if (++b.count == xcpu_batch_size) {
+        flush_cross_cpu_batch(cpu_id);
+    }
+}
+
+void cpu_pages::push_cross_cpu(unsigned cpu_id, cross_cpu_free_item* head, cross_cpu_free_item* tail) {
     auto& list = all_cpus[cpu_id]->xcpu_freelist;
     auto old = list.load(std::memory_order_relaxed);
     do {
-        p->next = old;
-    } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
-    ++g_cross_cpu_frees;
+        tail->next = old;
+    } while (!list.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+    ++g_cross_cpu_free_batches;
+}
+
+void cpu_pages::flush_cross_cpu_batch(unsigned cpu_id) {
+    auto& b = xcpu_pending[cpu_id];
+    // The owner may have gone away since the objects were queued
+    if (live_cpus[cpu_id].load(std::memory_order_relaxed)) {
+        push_cross_cpu(cpu_id, b.head, b.tail);
+    }
+    b = cross_cpu_free_batch{};
+    xcpu_pending_mask[cpu_id / 64] &= ~(uint64_t(1) << (cpu_id % 64));
+}
+
+bool cpu_pages::flush_cross_cpu_batches() {
+    bool flushed = false;
+    for (unsigned w = 0; w < max_cpus / 64; ++w) {
+        while (auto mask = xcpu_pending_mask[w]) {
+            flush_cross_cpu_batch(w * 64 + count_trailing_zeros(mask));
+            flushed = true;
+        }
+    }
+    return flushed;
 }
 
 bool cpu_pages::drain_cross_cpu_freelist() {
@@ -818,6 +1025,9 @@ bool cpu_pages::drain_cross_cpu_freelist() {
 
 void cpu_pages::free(void* ptr) {
     page* span = to_page(ptr);
+    if (__builtin_expect(span->sampled, false)) {
+        forget_sample(ptr, span);
+    }
     if (span->pool) {
         small_pool& pool = *span->pool;
 #ifdef SEASTAR_HEAPPROF
@@ -834,13 +1044,20 @@ void cpu_pages::free(void* ptr) {
 }
 
 void cpu_pages::free(void* ptr, size_t size) {
+    if (__builtin_expect(nr_live_samples, 0)) {
+        auto p = to_page(ptr);
+        if (p->sampled) {
+            forget_sample(ptr, p);
+        }
+    }
     // match action on allocate() so hit the right pool
     if (size <= sizeof(free_object)) {
         size = sizeof(free_object);
     }
     if (size <= max_small_allocation) {
         size = object_size_with_alloc_site(size);
-        auto pool = &small_pools[small_pool::size_to_idx(size)];
+        // An object may predate an extra size class now covering its size
+        auto pool = small_pools.has_extra() ? to_page(ptr)->pool : &small_pools[small_pool::size_to_idx(size)];
 #ifdef SEASTAR_HEAPPROF
         allocation_site_ptr alloc_site = pool->alloc_site_holder(ptr);
         if (alloc_site) {
@@ -854,6 +1071,94 @@ void cpu_pages::free(void* ptr, size_t size) {
     }
 }
 
+void cpu_pages::set_sample_rate(size_t rate) {
+    if (!sampler) {
+        if (!rate) {
+            return;
+        }
+        sampler = new heap_sampler;
+    }
+    sampler->enabled = rate;
+    if (rate) {
+        // Keep the last rate when disabling, pprof needs it to scale
+        // the samples that are still live
+        sampler->sample_rate = rate;
+        bytes_until_sample = sampler->next_sample_interval();
+    } else {
+        bytes_until_sample = std::numeric_limits<int64_t>::max();
+    }
+}
+
+void cpu_pages::sample_allocation(void* ptr, size_t size) {
+    if (!sampler || !sampler->enabled) {
+        bytes_until_sample = std::numeric_limits<int64_t>::max();
+        return;
+    }
+    bytes_until_sample = sampler->next_sample_interval();
+    // Recording a sample allocates too
+    if (sampling) {
+        return;
+    }
+    sampling = true;
+    auto done = defer([this] { sampling = false; });
+    sampled_site site;
+    void* frames[65];
+    auto n = ::backtrace(frames, 65);
+    // Skip our own frame
+    for (int i = 1; i < n; ++i) {
+        site.frames.push_back(reinterpret_cast<uintptr_t>(frames[i]));
+    }
+    try {
+        auto& s = *sampler->sites.insert(std::move(site)).first;
+        sampler->live.emplace(reinterpret_cast<uintptr_t>(ptr), heap_sampler::live_sample{&s, size});
+        ++s.alloc_count;
+        s.alloc_bytes += size;
+        ++s.live_count;
+        s.live_bytes += size;
+        to_page(ptr)->sampled = true;
+        ++nr_live_samples;
+    } catch (...) {
+        // Out of memory, drop the sample
+    }
+}
+
+void cpu_pages::forget_sample(void* ptr, page* p) {
+    auto& live = sampler->live;
+    auto i = live.find(reinterpret_cast<uintptr_t>(ptr));
+    if (i != live.end()) {
+        auto& s = *i->second.site;
+        --s.live_count;
+        s.live_bytes -= i->second.size;
+        live.erase(i);
+        --nr_live_samples;
+    }
+    // Small objects share pages, so the page stays marked until its last
+    // sampled object is freed
+    auto start = reinterpret_cast<uintptr_t>(mem() + (p - pages) * page_size);
+    auto j = live.lower_bound(start);
+    if (j == live.end() || j->first >= start + page_size) {
+        p->sampled = false;
+    }
+}
+
+sampled_heap_profile cpu_pages::sampled_profile() {
+    sampled_heap_profile ret;
+    if (!sampler) {
+        return ret;
+    }
+    // The snapshot allocates, and must not add sites while we iterate over them
+    auto was_sampling = std::exchange(sampling, true);
+    auto done = defer([this, was_sampling] { sampling = was_sampling; });
+    ret.sample_rate = sampler->sample_rate;
+    ret.sites.reserve(sampler->sites.size());
+    for (auto& s : sampler->sites) {
+        ret.sites.push_back(sampled_allocation_site{
+            std::vector<uintptr_t>(s.frames.begin(), s.frames.end()),
+            s.live_count, s.live_bytes, s.alloc_count, s.alloc_bytes});
+    }
+    return ret;
+}
+
 bool
 cpu_pages::try_cross_cpu_free(void* ptr) {
     auto obj_cpu = object_cpu_id(ptr);
@@ -886,6 +1191,13 @@ void cpu_pages::shrink(void* ptr, size_t new_size) {
         alloc_site->size += new_size_pages * page_size;
     }
 #endif
+    if (span->sampled) {
+        auto i = sampler->live.find(reinterpret_cast<uintptr_t>(ptr));
+        if (i != sampler->live.end() && i->second.size > new_size) {
+            i->second.site->live_bytes -= i->second.size - new_size;
+            i->second.size = new_size;
+        }
+    }
     span->span_size = new_size_pages;
     span[new_size_pages - 1].free = false;
     span[new_size_pages - 1].span_size = new_size_pages;
@@ -894,6 +1206,7 @@ void cpu_pages::shrink(void* ptr, size_t new_size) {
 }
 
 cpu_pages::~cpu_pages() {
+    flush_cross_cpu_batches();
     live_cpus[cpu_id].store(false, std::memory_order_relaxed);
 }
 
@@ -1073,6 +1386,78 @@ void cpu_pages::set_min_free_pages(size_t pages) {
     maybe_reclaim();
 }
 
+void cpu_pages::set_release_mode(free_memory_release mode) {
+    if (mode != free_memory_release::none && hugetlbfs_backed) {
+        seastar_memory_logger.warn("Cannot release free memory to the OS when backed by hugetlbfs");
+        return;
+    }
+    release_mode = mode;
+}
+
+// Called from the reactor's poll loop rather than from free(), as handing
+// the release pass to the reclaim hook allocates. The pass itself runs as a
+// task, so madvise() doesn't stall the poller.
+bool cpu_pages::maybe_release_free_memory() {
+    if (!release_wanted) {
+        return false;
+    }
+    release_wanted = false;
+    if (release_mode == free_memory_release::none || release_pending || !reclaim_hook) {
+        return false;
+    }
+    if (nr_free_pages - nr_released_pages <= release_high_water_pages()) {
+        return false;
+    }
+    release_pending = true;
+    try {
+        reclaim_hook([this] {
+            release_pending = false;
+            if (release_mode != free_memory_release::none) {
+                release_free_spans(release_low_water_pages(), release_mode);
+            }
+        });
+    } catch (...) {
+        release_pending = false;
+        return false;
+    }
+    return true;
+}
+
+// Releases resident free spans of at least a huge page, largest first, until
+// no more than retain_pages free pages are left resident. Smaller spans are
+// never released so as not to break up transparent huge pages.
+size_t cpu_pages::release_free_spans(size_t retain_pages, free_memory_release mode) {
+#ifdef MADV_FREE
+    auto advice = mode == free_memory_release::lazy ? MADV_FREE : MADV_DONTNEED;
+#else
+    auto advice = MADV_DONTNEED;
+#endif
+    size_t released = 0;
+    for (auto idx = nr_span_lists; idx-- > huge_page_span_idx;) {
+        auto& list = free_spans[idx];
+        while (!list.empty() && !list.front(pages).released) {
+            if (nr_free_pages - nr_released_pages <= retain_pages) {
+                return released;
+            }
+            auto span = &list.front(pages);
+            auto bytes = size_t(span->span_size) * page_size;
+            if (::madvise(mem() + (span - pages) * page_size, bytes, advice) != 0) {
+                // e.g. EINVAL for locked memory; no point in trying again
+                seastar_memory_logger.warn("Failed to release free memory to the OS, disabling: {}", strerror(errno));
+                release_mode = free_memory_release::none;
+                return released;
+            }
+            ++g_memory_releases;
+            unlink(list, span);
+            span->released = true;
+            list.push_back(pages, *span);
+            nr_released_pages += span->span_size;
+            released += bytes;
+        }
+    }
+    return released;
+}
+
 small_pool::small_pool(unsigned object_size) noexcept
     : _object_size(object_size) {
     unsigned span_size = 1;
@@ -1112,6 +1497,7 @@ small_pool::allocate() {
     auto* obj = _free;
     _free = _free->next;
     --_free_count;
+    ++_use_count;
     return obj;
 }
 
@@ -1121,6 +1507,7 @@ small_pool::deallocate(void* object) {
     o->next = _free;
     _free = o;
     ++_free_count;
+    --_use_count;
     if (_free_count >= _max_free) {
         trim_free_list();
     }
@@ -1155,6 +1542,8 @@ small_pool::add_more_objects() {
         auto span = cpu_mem.to_page(data);
         span_size = span->span_size;
         _pages_in_use += span_size;
+        ++_nr_spans;
+        _nr_objects += span_size * page_size / _object_size;
         for (unsigned i = 0; i < span_size; ++i) {
             span[i].offset_in_span = i;
             span[i].pool = this;
@@ -1174,6 +1563,7 @@ small_pool::add_more_objects() {
 void
 small_pool::trim_free_list() {
     auto goal = (_min_free + _max_free) / 2;
+    ++_trims;
     while (_free && _free_count > goal) {
         auto obj = _free;
         _free = _free->next;
@@ -1188,12 +1578,68 @@ small_pool::trim_free_list() {
         span->freelist = obj;
         if (--span->nr_small_alloc == 0) {
             _pages_in_use -= span->span_size;
+            --_nr_spans;
+            _nr_objects -= span->span_size * page_size / _object_size;
             _span_list.erase(cpu_mem.pages, *span);
             cpu_mem.free_span(span - cpu_mem.pages, span->span_size);
         }
     }
 }
 
+small_pool_stats
+small_pool::stats() const {
+    small_pool_stats s;
+    s.object_size = _object_size;
+    s.use_count = _use_count;
+    s.free_count = _nr_objects - _use_count;
+    s.spans = _nr_spans;
+    s.memory = size_t(_pages_in_use) * page_size;
+    s.trims = _trims;
+    return s;
+}
+
+bool
+small_pool_array::add_extra(unsigned object_size) {
+    auto idx = small_pool::size_to_idx(object_size);
+    if (small_pool::idx_to_size(idx) == object_size) {
+        return false; // already exact
+    }
+    auto begin = _extra_sorted;
+    auto end = _extra_sorted + _nr_extra;
+    auto pos = std::lower_bound(begin, end, object_size, [] (small_pool* p, unsigned size) {
+        return p->object_size() < size;
+    });
+    if (pos != end && (*pos)->object_size() == object_size) {
+        return false;
+    }
+    if (_nr_extra == max_extra_pools) {
+        throw std::runtime_error(format("Too many extra size classes, at most {} are supported", max_extra_pools));
+    }
+    auto pool = new (&_extra.a[_nr_extra]) small_pool(object_size);
+    std::move_backward(pos, end, end + 1);
+    *pos = pool;
+    ++_nr_extra;
+    std::fill(std::begin(_first_extra), std::end(_first_extra), 0);
+    for (unsigned i = _nr_extra; i-- > 0;) {
+        _first_extra[small_pool::size_to_idx(_extra_sorted[i]->object_size())] = i + 1;
+    }
+    return true;
+}
+
+small_pool&
+small_pool_array::extra_pool_for(unsigned size, unsigned idx) {
+    for (auto i = _first_extra[idx] - 1u; i < _nr_extra; ++i) {
+        auto pool = _extra_sorted[i];
+        if (small_pool::size_to_idx(pool->object_size()) != idx) {
+            break;
+        }
+        if (size <= pool->object_size()) {
+            return *pool;
+        }
+    }
+    return _u.a[idx];
+}
+
 void
 abort_on_underflow(size_t size) {
     if (std::make_signed_t<size_t>(size) < 0) {
@@ -1208,7 +1654,7 @@ void* allocate_large(size_t size) {
     if ((size_t(size_in_pages) << page_bits) < size) {
         return nullptr; // (size + page_size - 1) caused an overflow
     }
-    return cpu_mem.allocate_large(size_in_pages);
+    return cpu_mem.allocate_large(cpu_mem.place_large(size_in_pages));
 
 }
 
@@ -1216,7 +1662,7 @@ void* allocate_large_aligned(size_t align, size_t size) {
     abort_on_underflow(size);
     unsigned size_in_pages = (size + page_size - 1) >> page_bits;
     unsigned align_in_pages = std::max(align, page_size) >> page_bits;
-    return cpu_mem.allocate_large_aligned(align_in_pages, size_in_pages);
+    return cpu_mem.allocate_large_aligned(align_in_pages, cpu_mem.place_large(size_in_pages));
 }
 
 void free_large(void* ptr) {
@@ -1251,6 +1697,13 @@ static inline cpu_pages& get_cpu_mem()
     return *cpu_mem_ptr;
 }
 
+[[gnu::always_inline]]
+static inline void maybe_sample(cpu_pages& cm, void* ptr, size_t size) {
+    if (__builtin_expect((cm.bytes_until_sample -= size) < 0, false) && ptr) {
+        cm.sample_allocation(ptr, size);
+    }
+}
+
 void* allocate(size_t size) {
     if (size <= sizeof(free_object)) {
         size = sizeof(free_object);
@@ -1266,6 +1719,7 @@ void* allocate(size_t size) {
         on_allocation_failure(size);
     }
     ++g_allocs;
+    maybe_sample(get_cpu_mem(), ptr, size);
     return ptr;
 }
 
@@ -1286,6 +1740,7 @@ void* allocate_aligned(size_t align, size_t size) {
         on_allocation_failure(size);
     }
     ++g_allocs;
+    maybe_sample(get_cpu_mem(), ptr, size);
     return ptr;
 }
 
@@ -1366,6 +1821,7 @@ void configure(std::vector<resource::memory> m, bool mbind,
             return allocate_hugetlbfs_memory(*fdp, where, how_much);
         };
         cpu_mem.replace_memory_backing(sys_alloc);
+        cpu_mem.hugetlbfs_backed = true;
     }
     cpu_mem.resize(total, sys_alloc);
     size_t pos = 0;
@@ -1391,12 +1847,22 @@ void configure(std::vector<resource::memory> m, bool mbind,
 }
 
 statistics stats() {
-    return statistics{g_allocs, g_frees, g_cross_cpu_frees,
-        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims, g_large_allocs};
+    return statistics{g_allocs, g_frees, g_cross_cpu_frees, g_cross_cpu_free_batches,
+        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims, g_large_allocs,
+        size_t(cpu_mem.nr_released_pages) * page_size, g_memory_releases};
 }
 
 bool drain_cross_cpu_freelist() {
-    return cpu_mem.drain_cross_cpu_freelist();
+    // Being polled here means remote frees can be deferred to the next poll.
+    cpu_mem.xcpu_batching = true;
+    auto flushed = cpu_mem.flush_cross_cpu_batches();
+    auto drained = cpu_mem.drain_cross_cpu_freelist();
+    return cpu_mem.maybe_release_free_memory() || drained || flushed;
+}
+
+void flush_cross_cpu_frees() {
+    cpu_mem.xcpu_batching = false;
+    cpu_mem.flush_cross_cpu_batches();
 }
 
 memory_layout get_memory_layout() {
@@ -1411,6 +1877,81 @@ void set_min_free_pages(size_t pages) {
     cpu_mem.set_min_free_pages(pages);
 }
 
+void set_free_memory_release(free_memory_release mode) {
+    cpu_mem.set_release_mode(mode);
+}
+
+size_t release_free_memory() {
+    auto mode = cpu_mem.release_mode;
+    if (cpu_mem.hugetlbfs_backed) {
+        return 0;
+    }
+    return cpu_mem.release_free_spans(0, mode == free_memory_release::none ? free_memory_release::dontneed : mode);
+}
+
+void set_heap_profiling_sample_rate(size_t bytes) {
+    cpu_mem.set_sample_rate(bytes);
+}
+
+void add_small_size_classes(const std::vector<size_t>& sizes) {
+    for (auto size : sizes) {
+        auto object_size = align_up(std::max(size, sizeof(free_object)), alignof(free_object));
+        if (object_size_with_alloc_site(object_size) > max_small_allocation) {
+            throw std::invalid_argument(format("Size class {} is larger than the largest small allocation ({})", size, max_small_allocation));
+        }
+        cpu_mem.small_pools.add_extra(object_size_with_alloc_site(object_size));
+    }
+}
+
+static void merge_small_pool_stats(small_pool_stats& into, const small_pool_stats& s) {
+    into.use_count += s.use_count;
+    into.free_count += s.free_count;
+    into.spans += s.spans;
+    into.memory += s.memory;
+    into.trims += s.trims;
+}
+
+std::vector<small_pool_stats> small_pool_statistics() {
+    std::vector<small_pool_stats> all;
+    all.reserve(cpu_mem.small_pools.size());
+    for (unsigned i = 0; i < cpu_mem.small_pools.size(); ++i) {
+        all.push_back(cpu_mem.small_pools.pool_at(i).stats());
+    }
+    // The smallest geometric classes round to the same object size
+    std::stable_sort(all.begin(), all.end(), [] (const small_pool_stats& a, const small_pool_stats& b) {
+        return a.object_size < b.object_size;
+    });
+    std::vector<small_pool_stats> ret;
+    for (auto& s : all) {
+        if (!ret.empty() && ret.back().object_size == s.object_size) {
+            merge_small_pool_stats(ret.back(), s);
+        } else {
+            ret.push_back(s);
+        }
+    }
+    return ret;
+}
+
+small_pool_stats small_pool_statistics_for(size_t object_size) {
+    small_pool_stats ret{object_size, 0, 0, 0, 0, 0};
+    for (unsigned i = 0; i < cpu_mem.small_pools.size(); ++i) {
+        auto& pool = cpu_mem.small_pools.pool_at(i);
+        if (pool.object_size() == object_size) {
+            merge_small_pool_stats(ret, pool.stats());
+        }
+    }
+    return ret;
+}
+
+sampled_heap_profile get_sampled_heap_profile() {
+    return cpu_mem.sampled_profile();
+}
+
+void set_huge_page_allocation_threshold(size_t threshold) {
+    cpu_mem.huge_page_threshold_pages = std::min<size_t>(align_up(threshold, page_size) / page_size,
+            std::numeric_limits<uint32_t>::max());
+}
+
 static thread_local int report_on_alloc_failure_suppressed = 0;
 
 class disable_report_on_alloc_failure_temporarily {
@@ -1441,8 +1982,8 @@ void on_allocation_failure(size_t size) {
         seastar_memory_logger.debug("Used memory: {} Free memory: {} Total memory: {}", total_mem - free_mem, free_mem, total_mem);
         seastar_memory_logger.debug("Small pools:");
         seastar_memory_logger.debug("objsz spansz usedobj   memory       wst%");
-        for (unsigned i = 0; i < cpu_mem.small_pools.nr_small_pools; i++) {
-            auto& sp = cpu_mem.small_pools[i];
+        for (unsigned i = 0; i < cpu_mem.small_pools.size(); i++) {
+            auto& sp = cpu_mem.small_pools.pool_at(i);
             auto use_count = sp._pages_in_use * page_size / sp.object_size() - sp._free_count;
             auto memory = sp._pages_in_use * page_size;
             auto wasted_percent = memory ? sp._free_count * sp.object_size() * 100.0 / memory : 0;
@@ -1889,13 +2430,16 @@ void configure(std::vector<resource::memory> m, bool mbind, compat::optional<std
 }
 
 statistics stats() {
-    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0, 0};
+    return statistics{0, 0, 0, 0, 1 << 30, 1 << 30, 0, 0, 0, 0};
 }
 
 bool drain_cross_cpu_freelist() {
     return false;
 }
 
+void flush_cross_cpu_frees() {
+}
+
 memory_layout get_memory_layout() {
     throw std::runtime_error("get_memory_layout() not supported");
 }
@@ -1908,6 +2452,38 @@ void set_min_free_pages(size_t pages) {
     // Ignore, reclaiming not supported for default allocator.
 }
 
+void set_free_memory_release(free_memory_release) {
+    // Ignore, not supported for default allocator.
+}
+
+size_t release_free_memory() {
+    return 0;
+}
+
+void set_heap_profiling_sample_rate(size_t) {
+    seastar_logger.warn("Seastar compiled with default allocator, heap profiler not supported");
+}
+
+void add_small_size_classes(const std::vector<size_t>&) {
+    // Ignore, not supported for default allocator.
+}
+
+std::vector<small_pool_stats> small_pool_statistics() {
+    return {};
+}
+
+small_pool_stats small_pool_statistics_for(size_t object_size) {
+    return small_pool_stats{object_size, 0, 0, 0, 0, 0};
+}
+
+sampled_heap_profile get_sampled_heap_profile() {
+    return {};
+}
+
+void set_huge_page_allocation_threshold(size_t) {
+    // Ignore, not supported for default allocator.
+}
+
 void set_large_allocation_warning_threshold(size_t) {
     // Ignore, not supported for default allocator.
 }
@@ -1929,6 +2505,42 @@ namespace seastar {
 
 #endif
 
+namespace memory {
+
+void write_pprof_heap_profile(std::ostream& os, const std::vector<sampled_heap_profile>& profiles) {
+    size_t sample_rate = 0;
+    size_t live_count = 0, live_bytes = 0;
+    uint64_t alloc_count = 0, alloc_bytes = 0;
+    for (auto& p : profiles) {
+        sample_rate = std::max(sample_rate, p.sample_rate);
+        for (auto& s : p.sites) {
+            live_count += s.live_count;
+            live_bytes += s.live_bytes;
+            alloc_count += s.alloc_count;
+            alloc_bytes += s.alloc_bytes;
+        }
+    }
+    os << "heap profile: " << live_count << ": " << live_bytes
+       << " [" << alloc_count << ": " << alloc_bytes << "] @ heap_v2/" << sample_rate << "\n";
+    for (auto& p : profiles) {
+        for (auto& s : p.sites) {
+            os << s.live_count << ": " << s.live_bytes << " [" << s.alloc_count << ": " << s.alloc_bytes << "] @";
+            for (auto addr : s.backtrace) {
+                os << " 0x" << std::hex << addr << std::dec;
+            }
+            os << "\n";
+        }
+    }
+    // Lets pprof symbolize the addresses
+    os << "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    if (maps) {
+        os << maps.rdbuf();
+    }
+}
+
+}
+
 /// \endcond
 
 }
@@ -25,6 +25,7 @@
 #include <sys/syscall.h>
 #include <sys/vfs.h>
 #include <sys/statfs.h>
+#include <sys/sysmacros.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <seastar/core/task.hh>
@@ -46,13 +47,16 @@
 #include <seastar/core/stall_sampler.hh>
 #include <seastar/core/thread_cputime_clock.hh>
 #include <seastar/core/abort_on_ebadf.hh>
+#include <seastar/core/align.hh>
 #include <seastar/core/io_queue.hh>
 #include <seastar/core/internal/io_desc.hh>
+#include <seastar/core/internal/idle_poll_policy.hh>
 #include <seastar/util/log.hh>
 #include "core/file-impl.hh"
 #include "core/reactor_backend.hh"
 #include "core/syscall_result.hh"
 #include "core/thread_pool.hh"
+#include "core/task_profiler-impl.hh"
 #include "syscall_work_queue.hh"
 #include "cgroup.hh"
 #include "uname.hh"
@@ -139,6 +143,8 @@ struct mountpoint_params {
     uint64_t write_bytes_rate = std::numeric_limits<uint64_t>::max();
     uint64_t read_req_rate = std::numeric_limits<uint64_t>::max();
     uint64_t write_req_rate = std::numeric_limits<uint64_t>::max();
+    uint64_t max_request_size = 0;
+    io_device_model model;
     uint64_t num_io_queues = 0; // calculated
 };
 
@@ -154,6 +160,43 @@ struct convert<seastar::mountpoint_params> {
         mp.read_req_rate = parse_memory_size(node["read_iops"].as<std::string>());
         mp.write_bytes_rate = parse_memory_size(node["write_bandwidth"].as<std::string>());
         mp.write_req_rate = parse_memory_size(node["write_iops"].as<std::string>());
+        if (node["max_request_size"]) {
+            mp.max_request_size = parse_memory_size(node["max_request_size"].as<std::string>());
+        }
+        if (node["model"]) {
+            mp.model = node["model"].as<io_device_model>();
+        }
+        return true;
+    }
+};
+
+template<>
+struct convert<seastar::io_device_model> {
+    static bool decode(const Node& node, seastar::io_device_model& m) {
+        using namespace seastar;
+        auto rates = [] (const Node& n) {
+            std::vector<io_device_model::rate_point> points;
+            for (auto&& p : n) {
+                points.push_back({parse_memory_size(p["request_size"].as<std::string>()), p["iops"].as<double>()});
+            }
+            return points;
+        };
+        if (node["read"]) {
+            m.read = rates(node["read"]);
+        }
+        if (node["write"]) {
+            m.write = rates(node["write"]);
+        }
+        if (node["mixed"]) {
+            for (auto&& p : node["mixed"]) {
+                m.mixed.push_back({p["read_fraction"].as<double>(), p["efficiency"].as<double>()});
+            }
+        }
+        if (node["concurrency"]) {
+            for (auto&& p : node["concurrency"]) {
+                m.concurrency.push_back({p["depth"].as<unsigned>(), p["iops"].as<double>()});
+            }
+        }
         return true;
     }
 };
@@ -176,6 +219,13 @@ reactor::update_shares_for_class(io_priority_class pc, uint32_t shares) {
     });
 }
 
+future<>
+reactor::update_latency_target_for_class(io_priority_class pc, std::chrono::microseconds target) {
+    return parallel_for_each(_io_queues, [pc, target] (auto& queue) {
+        return queue.second->update_latency_target_for_class(pc, target);
+    });
+}
+
 future<>
 reactor::rename_priority_class(io_priority_class pc, sstring new_name) {
 
@@ -338,6 +388,16 @@ reactor::write_all(pollable_fd_state& fd, const void* buffer, size_t len) {
     return write_all_part(fd, buffer, len, 0);
 }
 
+bool
+reactor::can_sendfile(const file& f) const {
+    return dynamic_cast<posix_file_impl*>(f._file_impl.get());
+}
+
+future<size_t>
+reactor::sendfile(int out_fd, const file& f, uint64_t pos, size_t len, const io_priority_class& pc) {
+    return static_cast<posix_file_impl*>(f._file_impl.get())->sendfile(out_fd, pos, len, pc);
+}
+
 future<size_t> pollable_fd_state::read_some(char* buffer, size_t size) {
     return engine()._backend->read_some(*this, buffer, size);
 }
@@ -350,6 +410,10 @@ future<size_t> pollable_fd_state::read_some(const std::vector<iovec>& iov) {
     return engine()._backend->read_some(*this, iov);
 }
 
+future<temporary_buffer<char>> pollable_fd_state::read_some(temporary_buffer<char> buf) {
+    return engine()._backend->read_some_buffer(*this, std::move(buf));
+}
+
 future<size_t> pollable_fd_state::write_some(net::packet& p) {
     return engine()._backend->write_some(*this, p);
 }
@@ -511,6 +575,10 @@ constexpr unsigned reactor::max_aio_per_queue;
 // Broken (returns spurious EIO). Cause/fix unknown.
 bool aio_nowait_supported = false;
 
+// Use a kernel submission thread (IORING_SETUP_SQPOLL) for the io_uring backend.
+// Must be set before the reactors (and hence their backends) are created.
+bool io_uring_sqpoll = false;
+
 static bool sched_debug() {
     return false;
 }
@@ -794,6 +862,14 @@ reactor::task_queue::register_stats() {
                 return _time_spent_on_task_quota_violations / 1ms;
         }, sm::description("Total amount in milliseconds we were in violation of the task quota"),
            {group_label}),
+        sm::make_gauge("cpu_cap", [this] { return _cpu_cap; },
+                sm::description("Fraction of the shard's time this queue may use, 0 if uncapped"),
+                {group_label}),
+        sm::make_counter("throttled_time_ms", [this] {
+            auto throttled = _throttled_time + (_throttled ? sched_clock::now() - _throttled_since : sched_clock::duration(0));
+            return std::chrono::duration_cast<std::chrono::milliseconds>(throttled).count();
+        }, sm::description("Accumulated time this queue had tasks to run, but was held back by its CPU cap"),
+            {group_label}),
     });
     _metrics = std::exchange(new_metrics, {});
 }
@@ -832,6 +908,85 @@ reactor::account_runtime(task_queue& tq, sched_clock::duration runtime) {
     }
     tq._vruntime += tq.to_vruntime(runtime);
     tq._runtime += runtime;
+    if (tq._cpu_cap) {
+        tq._cpu_cap_budget -= runtime;
+    }
+}
+
+bool
+reactor::over_cpu_cap(const task_queue& tq) const {
+    // Nothing would run the held back tasks once stopped
+    return tq._cpu_cap && tq._cpu_cap_budget <= sched_clock::duration(0) && !_stopped;
+}
+
+void
+reactor::throttle(task_queue& tq) {
+    sched_print("throttling tq {} {}, budget {} usec", (void*)&tq, tq._name, tq._cpu_cap_budget / 1us);
+    // Keeps activate() from queueing it
+    tq._active = true;
+    tq._throttled = true;
+    tq._throttled_since = sched_clock::now();
+    _throttled_task_queues.push_back(&tq);
+}
+
+void
+reactor::unthrottle(task_queue& tq) {
+    sched_print("unthrottling tq {} {}", (void*)&tq, tq._name);
+    tq._throttled = false;
+    tq._throttled_time += sched_clock::now() - tq._throttled_since;
+    // As in activate(), the queue doesn't get to catch up on the time it waited
+    tq._vruntime = std::max(_last_vruntime, tq._vruntime);
+    _activating_task_queues.push_back(&tq);
+}
+
+void
+reactor::remove_throttled(task_queue& tq) {
+    auto throttled = std::exchange(_throttled_task_queues, {});
+    for (auto t : throttled) {
+        if (t != &tq) {
+            _throttled_task_queues.push_back(t);
+        }
+    }
+}
+
+void
+reactor::start_cpu_cap_period() {
+    bool capped = false;
+    for (auto& tq : _task_queues) {
+        if (tq && tq->_cpu_cap) {
+            capped = true;
+            auto quota = std::chrono::duration_cast<sched_clock::duration>(_cpu_cap_period * tq->_cpu_cap);
+            tq->_cpu_cap_budget = std::min(tq->_cpu_cap_budget + quota, quota);
+        }
+    }
+    auto throttled = std::exchange(_throttled_task_queues, {});
+    for (auto tq : throttled) {
+        if (over_cpu_cap(*tq)) {
+            _throttled_task_queues.push_back(tq);
+        } else {
+            unthrottle(*tq);
+        }
+    }
+    if (!capped) {
+        _cpu_cap_timer.cancel();
+    }
+}
+
+void
+reactor::set_cpu_cap(task_queue& tq, float fraction) {
+    if (fraction <= 0 || fraction >= 1) {
+        fraction = 0;
+    }
+    auto quota = std::chrono::duration_cast<sched_clock::duration>(_cpu_cap_period * fraction);
+    tq._cpu_cap_budget = tq._cpu_cap ? std::min(tq._cpu_cap_budget, quota) : quota;
+    tq._cpu_cap = fraction;
+    if (tq._throttled && !over_cpu_cap(tq)) {
+        remove_throttled(tq);
+        unthrottle(tq);
+    }
+    if (fraction && !_cpu_cap_timer.armed()) {
+        _cpu_cap_timer.arm_periodic(_cpu_cap_period);
+    }
 }
 
 void
@@ -868,6 +1023,7 @@ reactor::reactor(unsigned id, reactor_backend_selector rbs, reactor_config cfg)
     _task_queues.push_back(std::make_unique<task_queue>(0, "main", 1000));
     _task_queues.push_back(std::make_unique<task_queue>(1, "atexit", 1000));
     _at_destroy_tasks = _task_queues.back().get();
+    _cpu_cap_timer.set_callback([this] { start_cpu_cap_period(); });
     g_need_preempt = &_preemption_monitor;
     seastar::thread_impl::init();
     _backend->start_tick();
@@ -889,6 +1045,8 @@ reactor::reactor(unsigned id, reactor_backend_selector rbs, reactor_config cfg)
 }
 
 reactor::~reactor() {
+    // The release is deferred through the reclaim hook, which is ours
+    memory::set_free_memory_release(memory::free_memory_release::none);
     sigset_t mask;
     sigemptyset(&mask);
     sigaddset(&mask, cpu_stall_detector::signal_number());
@@ -1274,6 +1432,8 @@ void reactor::configure(boost::program_options::variables_map vm) {
     _handle_sigint = !vm.count("no-handle-interrupt");
     auto task_quota = vm["task-quota-ms"].as<double>() * 1ms;
     _task_quota = std::chrono::duration_cast<sched_clock::duration>(task_quota);
+    // A cap can't be enforced over less than a task quota
+    _cpu_cap_period = std::max<sched_clock::duration>(vm["cpu-cap-period-ms"].as<unsigned>() * 1ms, _task_quota);
 
     auto blocked_time = vm["blocked-reactor-notify-ms"].as<unsigned>() * 1ms;
     cpu_stall_detector_config csdc;
@@ -1291,6 +1451,13 @@ void reactor::configure(boost::program_options::variables_map vm) {
            && !vm.count("poll-mode")) {
         _max_poll_time = 0us;
     }
+    if (vm["adaptive-idle-poll"].as<bool>() && !vm.count("poll-mode") && _max_poll_time > 0us) {
+        auto wakeup_cost = vm["idle-wakeup-cost-us"].as<unsigned>() * 1us;
+        _idle_poll_policy = std::make_unique<internal::idle_poll_policy>(_max_poll_time, wakeup_cost, _max_poll_time);
+    }
+    if (auto period = vm["task-profiler-sample-period"].as<unsigned>()) {
+        _task_profiler = std::make_unique<internal::task_profiler>(period);
+    }
     set_strict_dma(!vm.count("relaxed-dma"));
     if (!vm["poll-aio"].as<bool>()
             || (vm["poll-aio"].defaulted() && vm.count("overprovisioned"))) {
@@ -1300,6 +1467,7 @@ void reactor::configure(boost::program_options::variables_map vm) {
     _force_io_getevents_syscall = vm["force-aio-syscalls"].as<bool>();
     aio_nowait_supported = vm["linux-aio-nowait"].as<bool>();
     _have_aio_fsync = vm["aio-fsync"].as<bool>();
+    _async_metadata = vm["async-metadata"].as<bool>();
 }
 
 pollable_fd
@@ -1457,6 +1625,20 @@ sstring io_request::opname() const {
         return "poll remove";
     case io_request::operation::cancel:
         return "cancel";
+    case io_request::operation::openat:
+        return "openat";
+    case io_request::operation::close:
+        return "close";
+    case io_request::operation::statx:
+        return "statx";
+    case io_request::operation::unlinkat:
+        return "unlinkat";
+    case io_request::operation::renameat:
+        return "renameat";
+    case io_request::operation::linkat:
+        return "linkat";
+    case io_request::operation::mkdirat:
+        return "mkdirat";
     }
     std::abort();
 }
@@ -1496,6 +1678,31 @@ reactor::submit_io_write(io_queue* ioq, const io_priority_class& pc, size_t len,
     return ioq->queue_request(pc, len, std::move(req));
 }
 
+void
+reactor::submit_blocking_io(kernel_completion* desc, noncopyable_function<ssize_t ()> op) {
+    // FIXME: future is discarded
+    (void)_thread_pool->submit<ssize_t>(std::move(op)).then_wrapped([desc] (future<ssize_t> f) {
+        ssize_t r;
+        try {
+            r = f.get0();
+        } catch (...) {
+            // Submission only fails if the work item can't be allocated
+            r = -ENOMEM;
+        }
+        desc->complete_with(r);
+    });
+}
+
+future<size_t>
+reactor::submit_blocking_read(io_queue* ioq, const io_priority_class& pc, size_t len, noncopyable_function<ssize_t ()> op) {
+    ++_io_stats.aio_reads;
+    // \c len only bounds the transfer; account for what was actually read.
+    return ioq->queue_blocking_read(pc, len, std::move(op)).then([this] (size_t n) {
+        _io_stats.aio_read_bytes += n;
+        return n;
+    });
+}
+
 namespace internal {
 
 size_t sanitize_iovecs(std::vector<iovec>& iov, size_t disk_alignment) noexcept {
@@ -1517,8 +1724,145 @@ size_t sanitize_iovecs(std::vector<iovec>& iov, size_t disk_alignment) noexcept
 
 }
 
+namespace {
+
+// A metadata operation submitted to the kernel. Owns the paths the request
+// points to until the kernel completes it.
+class metadata_io_desc final : public kernel_completion {
+    promise<syscall_result<int>> _pr;
+public:
+    sstring path;
+    sstring new_path;
+
+    virtual void complete_with(ssize_t res) override {
+        _pr.set_value(res < 0 ? syscall_result<int>(-1, -res) : syscall_result<int>(res, 0));
+        delete this;
+    }
+    future<syscall_result<int>> get_future() {
+        return _pr.get_future();
+    }
+};
+
+struct stat statx_to_stat(const struct ::statx& stx) {
+    struct stat st = {};
+    st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st.st_ino = stx.stx_ino;
+    st.st_mode = stx.stx_mode;
+    st.st_nlink = stx.stx_nlink;
+    st.st_uid = stx.stx_uid;
+    st.st_gid = stx.stx_gid;
+    st.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st.st_size = stx.stx_size;
+    st.st_blksize = stx.stx_blksize;
+    st.st_blocks = stx.stx_blocks;
+    st.st_atim = timespec{stx.stx_atime.tv_sec, stx.stx_atime.tv_nsec};
+    st.st_mtim = timespec{stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+    st.st_ctim = timespec{stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+    return st;
+}
+
+void set_extent_allocation_size_hint(int fd, const file_open_options& options) {
+    fsxattr attr = {};
+    if (options.extent_allocation_size_hint) {
+        attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
+        attr.fsx_extsize = options.extent_allocation_size_hint;
+    }
+    // Ignore error; may be !xfs, and just a hint anyway
+    ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+}
+
+}
+
+bool
+reactor::have_async_metadata_op(io_request::operation op) const {
+    return _async_metadata && _backend->have_async_metadata_op(op);
+}
+
+future<syscall_result<int>>
+reactor::submit_metadata_op(io_request::operation op, int fd, sstring path, sstring new_path, int flags, mode_t mode) {
+    try {
+        auto desc = std::make_unique<metadata_io_desc>();
+        desc->path = std::move(path);
+        desc->new_path = std::move(new_path);
+        auto fut = desc->get_future();
+        auto req = [&] {
+            using o = io_request::operation;
+            switch (op) {
+            case o::openat:
+                return io_request::make_openat(fd, desc->path.c_str(), flags, mode);
+            case o::close:
+                return io_request::make_close(fd);
+            case o::unlinkat:
+                return io_request::make_unlinkat(fd, desc->path.c_str(), flags);
+            case o::renameat:
+                return io_request::make_renameat(desc->path.c_str(), desc->new_path.c_str());
+            case o::linkat:
+                return io_request::make_linkat(desc->path.c_str(), desc->new_path.c_str());
+            case o::mkdirat:
+                return io_request::make_mkdirat(fd, desc->path.c_str(), mode);
+            case o::fdatasync:
+                return io_request::make_fdatasync(fd);
+            default:
+                throw std::invalid_argument("not a metadata operation");
+            }
+        }();
+        submit_io(desc.release(), std::move(req));
+        return fut;
+    } catch (...) {
+        return make_exception_future<syscall_result<int>>(std::current_exception());
+    }
+}
+
+future<syscall_result_extra<struct stat>>
+reactor::submit_statx(int dirfd, sstring path, int flags) {
+    try {
+        // Written by the kernel before the completion, read by the continuation
+        auto stx = std::make_unique<struct ::statx>();
+        auto desc = std::make_unique<metadata_io_desc>();
+        desc->path = std::move(path);
+        auto fut = desc->get_future();
+        auto req = io_request::make_statx(dirfd, desc->path.c_str(), flags, stx.get());
+        submit_io(desc.release(), std::move(req));
+        return fut.then([stx = std::move(stx)] (syscall_result<int> sr) {
+            return syscall_result_extra<struct stat>(sr.result, sr.error, statx_to_stat(*stx));
+        });
+    } catch (...) {
+        return make_exception_future<syscall_result_extra<struct stat>>(std::current_exception());
+    }
+}
+
 future<file>
 reactor::open_file_dma(sstring name, open_flags flags, file_open_options options) {
+    auto opened = [&] {
+        if (!have_async_metadata_op(io_request::operation::openat)) {
+            return open_file_dma_in_thread_pool(name, flags, options);
+        }
+        auto open_flags = O_CLOEXEC | O_DIRECT | static_cast<int>(flags);
+        if (_bypass_fsync) {
+            open_flags &= ~O_DSYNC;
+        }
+        auto mode = static_cast<mode_t>(options.create_permissions);
+        return submit_metadata_op(io_request::operation::openat, AT_FDCWD, name, {}, open_flags, mode).then(
+                [this, name, flags, options] (syscall_result<int> sr) {
+            if (sr.result == -1 && sr.error == EINVAL) {
+                // The file system does not support O_DIRECT; the syscall thread
+                // knows when that can be forgiven.
+                return open_file_dma_in_thread_pool(name, flags, options);
+            }
+            if (sr.result != -1) {
+                set_extent_allocation_size_hint(sr.result, options);
+            }
+            return make_ready_future<syscall_result<int>>(sr);
+        });
+    }();
+    return opened.then([options, name] (syscall_result<int> sr) {
+        sr.throw_fs_exception_if_error("open failed", name);
+        return make_ready_future<file>(file(sr.result, options));
+    });
+}
+
+future<syscall_result<int>>
+reactor::open_file_dma_in_thread_pool(sstring name, open_flags flags, file_open_options options) {
     return _thread_pool->submit<syscall_result<int>>([name, flags, options, strict_o_direct = _strict_o_direct, bypass_fsync = _bypass_fsync] {
         // We want O_DIRECT, except in two cases:
         //   - tmpfs (which doesn't support it, but works fine anyway)
@@ -1550,26 +1894,29 @@ reactor::open_file_dma(sstring name, open_flags flags, file_open_options options
             return maybe_ret;
         }
         if (fd != -1) {
-            fsxattr attr = {};
-            if (options.extent_allocation_size_hint) {
-                attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
-                attr.fsx_extsize = options.extent_allocation_size_hint;
-            }
-            // Ignore error; may be !xfs, and just a hint anyway
-            ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+            set_extent_allocation_size_hint(fd, options);
         }
         return wrap_syscall<int>(fd);
-    }).then([options, name] (syscall_result<int> sr) {
-        sr.throw_fs_exception_if_error("open failed", name);
-        return make_ready_future<file>(file(sr.result, options));
     });
 }
 
 future<>
 reactor::remove_file(sstring pathname) {
-    return engine()._thread_pool->submit<syscall_result<int>>([pathname] {
-        return wrap_syscall<int>(::remove(pathname.c_str()));
-    }).then([pathname] (syscall_result<int> sr) {
+    auto removed = [&] {
+        if (!have_async_metadata_op(io_request::operation::unlinkat)) {
+            return _thread_pool->submit<syscall_result<int>>([pathname] {
+                return wrap_syscall<int>(::remove(pathname.c_str()));
+            });
+        }
+        // Like remove(3), fall back to rmdir for directories
+        return submit_metadata_op(io_request::operation::unlinkat, AT_FDCWD, pathname).then([this, pathname] (syscall_result<int> sr) {
+            if (sr.result == -1 && sr.error == EISDIR) {
+                return submit_metadata_op(io_request::operation::unlinkat, AT_FDCWD, pathname, {}, AT_REMOVEDIR);
+            }
+            return make_ready_future<syscall_result<int>>(sr);
+        });
+    }();
+    return removed.then([pathname] (syscall_result<int> sr) {
         sr.throw_fs_exception_if_error("remove failed", pathname);
         return make_ready_future<>();
     });
@@ -1577,9 +1924,12 @@ reactor::remove_file(sstring pathname) {
 
 future<>
 reactor::rename_file(sstring old_pathname, sstring new_pathname) {
-    return engine()._thread_pool->submit<syscall_result<int>>([old_pathname, new_pathname] {
+    auto renamed = have_async_metadata_op(io_request::operation::renameat)
+            ? submit_metadata_op(io_request::operation::renameat, AT_FDCWD, old_pathname, new_pathname)
+            : _thread_pool->submit<syscall_result<int>>([old_pathname, new_pathname] {
         return wrap_syscall<int>(::rename(old_pathname.c_str(), new_pathname.c_str()));
-    }).then([old_pathname, new_pathname] (syscall_result<int> sr) {
+    });
+    return renamed.then([old_pathname, new_pathname] (syscall_result<int> sr) {
         sr.throw_fs_exception_if_error("rename failed",  old_pathname, new_pathname);
         return make_ready_future<>();
     });
@@ -1587,9 +1937,12 @@ reactor::rename_file(sstring old_pathname, sstring new_pathname) {
 
 future<>
 reactor::link_file(sstring oldpath, sstring newpath) {
-    return engine()._thread_pool->submit<syscall_result<int>>([oldpath, newpath] {
+    auto linked = have_async_metadata_op(io_request::operation::linkat)
+            ? submit_metadata_op(io_request::operation::linkat, AT_FDCWD, oldpath, newpath)
+            : _thread_pool->submit<syscall_result<int>>([oldpath, newpath] {
         return wrap_syscall<int>(::link(oldpath.c_str(), newpath.c_str()));
-    }).then([oldpath, newpath] (syscall_result<int> sr) {
+    });
+    return linked.then([oldpath, newpath] (syscall_result<int> sr) {
         sr.throw_fs_exception_if_error("link failed", oldpath, newpath);
         return make_ready_future<>();
     });
@@ -1636,12 +1989,15 @@ directory_entry_type stat_to_entry_type(__mode_t type) {
 
 future<compat::optional<directory_entry_type>>
 reactor::file_type(sstring name, follow_symlink follow) {
-    return _thread_pool->submit<syscall_result_extra<struct stat>>([name, follow] {
+    auto stated = have_async_metadata_op(io_request::operation::statx)
+            ? submit_statx(AT_FDCWD, name, follow ? 0 : AT_SYMLINK_NOFOLLOW)
+            : _thread_pool->submit<syscall_result_extra<struct stat>>([name, follow] {
         struct stat st;
         auto stat_syscall = follow ? stat : lstat;
         auto ret = stat_syscall(name.c_str(), &st);
         return wrap_syscall(ret, st);
-    }).then([name] (syscall_result_extra<struct stat> sr) {
+    });
+    return stated.then([name] (syscall_result_extra<struct stat> sr) {
         if (long(sr.result) == -1) {
             if (sr.error != ENOENT && sr.error != ENOTDIR) {
                 sr.throw_fs_exception_if_error("stat failed", name);
@@ -1663,12 +2019,15 @@ timespec_to_time_point(const timespec& ts) {
 
 future<stat_data>
 reactor::file_stat(sstring pathname, follow_symlink follow) {
-    return _thread_pool->submit<syscall_result_extra<struct stat>>([pathname, follow] {
+    auto stated = have_async_metadata_op(io_request::operation::statx)
+            ? submit_statx(AT_FDCWD, pathname, follow ? 0 : AT_SYMLINK_NOFOLLOW)
+            : _thread_pool->submit<syscall_result_extra<struct stat>>([pathname, follow] {
         struct stat st;
         auto stat_syscall = follow ? stat : lstat;
         auto ret = stat_syscall(pathname.c_str(), &st);
         return wrap_syscall(ret, st);
-    }).then([pathname = std::move(pathname)] (syscall_result_extra<struct stat> sr) {
+    });
+    return stated.then([pathname = std::move(pathname)] (syscall_result_extra<struct stat> sr) {
         sr.throw_fs_exception_if_error("stat failed", pathname);
         struct stat& st = sr.extra;
         stat_data sd;
@@ -1757,9 +2116,12 @@ reactor::statvfs(sstring pathname) {
 
 future<file>
 reactor::open_directory(sstring name) {
-    return _thread_pool->submit<syscall_result<int>>([name] {
+    auto opened = have_async_metadata_op(io_request::operation::openat)
+            ? submit_metadata_op(io_request::operation::openat, AT_FDCWD, name, {}, O_DIRECTORY | O_CLOEXEC | O_RDONLY)
+            : _thread_pool->submit<syscall_result<int>>([name] {
         return wrap_syscall<int>(::open(name.c_str(), O_DIRECTORY | O_CLOEXEC | O_RDONLY));
-    }).then([name] (syscall_result<int> sr) {
+    });
+    return opened.then([name] (syscall_result<int> sr) {
         sr.throw_fs_exception_if_error("open failed", name);
         return make_ready_future<file>(file(sr.result, file_open_options()));
     });
@@ -1767,20 +2129,26 @@ reactor::open_directory(sstring name) {
 
 future<>
 reactor::make_directory(sstring name, file_permissions permissions) {
-    return _thread_pool->submit<syscall_result<int>>([=] {
+    auto made = have_async_metadata_op(io_request::operation::mkdirat)
+            ? submit_metadata_op(io_request::operation::mkdirat, AT_FDCWD, name, {}, 0, static_cast<mode_t>(permissions))
+            : _thread_pool->submit<syscall_result<int>>([=] {
         auto mode = static_cast<mode_t>(permissions);
         return wrap_syscall<int>(::mkdir(name.c_str(), mode));
-    }).then([name] (syscall_result<int> sr) {
+    });
+    return made.then([name] (syscall_result<int> sr) {
         sr.throw_fs_exception_if_error("mkdir failed", name);
     });
 }
 
 future<>
 reactor::touch_directory(sstring name, file_permissions permissions) {
-    return engine()._thread_pool->submit<syscall_result<int>>([=] {
+    auto made = have_async_metadata_op(io_request::operation::mkdirat)
+            ? submit_metadata_op(io_request::operation::mkdirat, AT_FDCWD, name, {}, 0, static_cast<mode_t>(permissions))
+            : _thread_pool->submit<syscall_result<int>>([=] {
         auto mode = static_cast<mode_t>(permissions);
         return wrap_syscall<int>(::mkdir(name.c_str(), mode));
-    }).then([name] (syscall_result<int> sr) {
+    });
+    return made.then([name] (syscall_result<int> sr) {
         if (sr.result == -1 && sr.error != EEXIST) {
             sr.throw_fs_exception("mkdir failed", fs::path(name));
         }
@@ -1825,9 +2193,12 @@ reactor::fdatasync(int fd) {
             return make_exception_future<>(std::current_exception());
         }
     }
-    return _thread_pool->submit<syscall_result<int>>([fd] {
+    auto synced = have_async_metadata_op(io_request::operation::fdatasync)
+            ? submit_metadata_op(io_request::operation::fdatasync, fd)
+            : _thread_pool->submit<syscall_result<int>>([fd] {
         return wrap_syscall<int>(::fdatasync(fd));
-    }).then([] (syscall_result<int> sr) {
+    });
+    return synced.then([] (syscall_result<int> sr) {
         sr.throw_if_error();
         return make_ready_future<>();
     });
@@ -1974,6 +2345,8 @@ void reactor::register_metrics() {
             sm::make_derive("polls", _polls, sm::description("Number of times pollers were executed")),
             sm::make_derive("timers_pending", std::bind(&decltype(_timers)::size, &_timers), sm::description("Number of tasks in the timer-pending queue")),
             sm::make_gauge("utilization", [this] { return (1-_load)  * 100; }, sm::description("CPU utilization")),
+            sm::make_gauge("idle_poll_time_us", [this] { return double(idle_poll_time().count()) / 1000; },
+                    sm::description("How long the reactor polls for work when idle before going to sleep")),
             sm::make_derive("cpu_busy_ms", [this] () -> int64_t { return total_busy_time() / 1ms; },
                     sm::description("Total cpu busy time in milliseconds")),
             sm::make_derive("cpu_steal_time_ms", [this] () -> int64_t { return total_steal_time() / 1ms; },
@@ -2000,11 +2373,17 @@ void reactor::register_metrics() {
                     sm::description("Total number of malloc operations")),
             sm::make_derive("free_operations", [] { return memory::stats().frees(); }, sm::description("Total number of free operations")),
             sm::make_derive("cross_cpu_free_operations", [] { return memory::stats().cross_cpu_frees(); }, sm::description("Total number of cross cpu free")),
+            sm::make_derive("cross_cpu_free_batches", [] { return memory::stats().cross_cpu_free_batches(); },
+                    sm::description("Total number of batches of cross cpu frees handed over to their owner cpus")),
             sm::make_gauge("malloc_live_objects", [] { return memory::stats().live_objects(); }, sm::description("Number of live objects")),
             sm::make_current_bytes("free_memory", [] { return memory::stats().free_memory(); }, sm::description("Free memeory size in bytes")),
             sm::make_current_bytes("total_memory", [] { return memory::stats().total_memory(); }, sm::description("Total memeory size in bytes")),
             sm::make_current_bytes("allocated_memory", [] { return memory::stats().allocated_memory(); }, sm::description("Allocated memeory size in bytes")),
-            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations"))
+            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations")),
+            sm::make_current_bytes("released_memory", [] { return memory::stats().released_memory(); },
+                    sm::description("Free memory returned to the OS in bytes, included in free_memory")),
+            sm::make_derive("memory_release_operations", [] { return memory::stats().memory_releases(); },
+                    sm::description("Total number of free spans returned to the OS"))
     });
 
     _metric_groups.add_group("reactor", {
@@ -2014,11 +2393,36 @@ void reactor::register_metrics() {
             sm::make_derive("abandoned_failed_futures", _abandoned_failed_futures, sm::description("Total number of abandoned failed futures, futures destroyed while still containing an exception")),
     });
 
+    // Keyed by object size, which, unlike a class's position, doesn't change
+    // when memory::add_small_size_classes() adds classes later on (those
+    // classes are not exported, but the existing series stay correct).
+    auto pool_label = sm::label("object_size");
+    for (auto& pool : memory::small_pool_statistics()) {
+        auto object_size = pool.object_size;
+        auto size = pool_label(object_size);
+        _metric_groups.add_group("memory", {
+                sm::make_gauge("small_pool_objects", [object_size] { return memory::small_pool_statistics_for(object_size).use_count; },
+                        sm::description("Number of allocated objects in a small allocation size class"), {size}),
+                sm::make_gauge("small_pool_free_objects", [object_size] { return memory::small_pool_statistics_for(object_size).free_count; },
+                        sm::description("Number of free objects held by a small allocation size class"), {size}),
+                sm::make_gauge("small_pool_spans", [object_size] { return memory::small_pool_statistics_for(object_size).spans; },
+                        sm::description("Number of spans held by a small allocation size class"), {size}),
+                sm::make_current_bytes("small_pool_memory", [object_size] { return memory::small_pool_statistics_for(object_size).memory; },
+                        sm::description("Memory held by a small allocation size class in bytes"), {size}),
+                sm::make_derive("small_pool_trims", [object_size] { return memory::small_pool_statistics_for(object_size).trims; },
+                        sm::description("Total number of times a small allocation size class returned free objects to its spans"), {size}),
+        });
+    }
+
     auto ioq_group = sm::label("mountpoint");
     for (auto& ioq : my_io_queues) {
         auto ioq_name = ioq_group(ioq->mountpoint());
         _metric_groups.add_group("reactor", {
                 sm::make_gauge("io_queue_requests", [&ioq] { return ioq->queued_requests(); } , sm::description("Number of requests in the io queue"), {ioq_name}),
+                sm::make_derive("io_queue_merged_requests", [&ioq] { return ioq->merged_requests(); },
+                        sm::description("Number of requests submitted as part of a merged vectored request"), {ioq_name}),
+                sm::make_derive("io_queue_split_requests", [&ioq] { return ioq->split_requests(); },
+                        sm::description("Number of requests split because they were larger than the device's max_request_size"), {ioq_name}),
         });
     }
 
@@ -2060,7 +2464,18 @@ void reactor::run_tasks(task_queue& tq) {
         tasks.pop_front();
         STAP_PROBE(seastar, reactor_run_tasks_single_start);
         task_histogram_add_task(*tsk);
-        tsk->run_and_dispose();
+        if (__builtin_expect(_task_profiler != nullptr, false) && _task_profiler->should_sample()) {
+            // The task is gone after it runs
+            auto& type = typeid(*tsk);
+            auto start = sched_clock::now();
+            tsk->run_and_dispose();
+            // The task may have disabled the profiler
+            if (_task_profiler) {
+                _task_profiler->add(tq._id, type, sched_clock::now() - start);
+            }
+        } else {
+            tsk->run_and_dispose();
+        }
         STAP_PROBE(seastar, reactor_run_tasks_single_end);
         ++tq._tasks_processed;
         ++_global_tasks_processed;
@@ -2269,6 +2684,11 @@ class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
         // doesn't have any side effects.
         //
         // We'll take care of those items when we wake up for another reason.
+        //
+        // Items of other cpus we freed must not wait for us to wake up, though:
+        // hand them over now, and without batching those freed until then, e.g.
+        // by the pollers that go to sleep after us.
+        memory::flush_cross_cpu_frees();
         return true;
     }
     virtual void exit_interrupt_mode() override final {
@@ -2483,7 +2903,11 @@ reactor::run_some_tasks() {
         sched_print("run complete ({} {}); time consumed {} usec; final vruntime {} empty {}",
                 (void*)tq, tq->_name, delta / 1us, tq->_vruntime, tq->_q.empty());
         if (!tq->_q.empty()) {
-            insert_active_task_queue(tq);
+            if (over_cpu_cap(*tq)) {
+                throttle(*tq);
+            } else {
+                insert_active_task_queue(tq);
+            }
         } else {
             tq->_active = false;
         }
@@ -2510,6 +2934,10 @@ reactor::activate(task_queue& tq) {
         sched_print("tq {} {} losing vruntime {} due to sleep", (void*)&tq, tq._name, _last_vruntime - tq._vruntime);
     }
     tq._vruntime = std::max(_last_vruntime, tq._vruntime);
+    if (over_cpu_cap(tq)) {
+        throttle(tq);
+        return;
+    }
     _activating_task_queues.push_back(&tq);
 }
 
@@ -2638,6 +3066,10 @@ int reactor::run() {
         run_some_tasks();
         if (_stopped) {
             load_timer.cancel();
+            _cpu_cap_timer.cancel();
+            for (auto tq : std::exchange(_throttled_task_queues, {})) {
+                unthrottle(*tq);
+            }
             // Final tasks may include sending the last response to cpu 0, so run them
             while (have_more_tasks()) {
                 run_some_tasks();
@@ -2657,6 +3089,9 @@ int reactor::run() {
 
         if (check_for_work()) {
             if (idle) {
+                if (_idle_poll_policy) {
+                    _idle_poll_policy->add_gap(idle_end - idle_start);
+                }
                 _total_idle += idle_end - idle_start;
                 account_idle(idle_end - idle_start);
                 idle_start = idle_end;
@@ -2680,7 +3115,7 @@ int reactor::run() {
             }
             if (go_to_sleep) {
                 internal::cpu_relax();
-                if (idle_end - idle_start > _max_poll_time) {
+                if (idle_end - idle_start > idle_poll_time()) {
                     // Turn off the task quota timer to avoid spurious wakeups
                     struct itimerspec zero_itimerspec = {};
                     _task_quota_timer.timerfd_settime(0, zero_itimerspec);
@@ -2727,6 +3162,11 @@ reactor::sleep() {
     }
 }
 
+std::chrono::nanoseconds
+reactor::idle_poll_time() const {
+    return _idle_poll_policy ? _idle_poll_policy->poll_time() : _max_poll_time;
+}
+
 bool
 reactor::poll_once() {
     bool work = false;
@@ -2924,17 +3364,33 @@ void smp_message_queue::submit_item(shard_id t, smp_timeout_clock::time_point ti
         ++_last_cmpl_batch;
         return;
     }
+    item->sent = std::chrono::steady_clock::now();
     _tx.a.pending_fifo.push_back(item.get());
     // no exceptions from this point
     item.release();
     units_fut.get0().release();
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+    if (_tx.a.pending_fifo.size() >= batch_size || should_flush_now()) {
         move_pending();
     }
   });
 }
 
+// Requests are held back until a batch is full or the next poll, so that
+// they cross to the remote shard together. That only pays when the remote
+// shard is busy: when it drained everything this shard sent, and is awake,
+// it is polling for work, and the first request of a burst goes right away.
+// The requests that follow it see it in flight and are batched.
+bool smp_message_queue::should_flush_now() const {
+    return _current_queue_length == 0 && !_pending.remote->_sleeping.load(std::memory_order_relaxed);
+}
+
 void smp_message_queue::respond(work_item* item) {
+    // Only this shard writes its load, so there is no need for atomic updates
+    auto& load = smp::_loads[engine().cpu_id()];
+    load.backlog.store(load.backlog.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - item->sent).count();
+    int64_t average = load.service_latency_ns.load(std::memory_order_relaxed);
+    load.service_latency_ns.store(average + (latency - average) / 16, std::memory_order_relaxed);
     _completed_fifo.push_back(item);
     if (_completed_fifo.size() >= batch_size || engine()._stopped) {
         flush_response_batch();
@@ -3035,6 +3491,10 @@ size_t smp_message_queue::process_incoming() {
     auto nr = process_queue<prefetch_cnt>(_pending, [] (work_item* wi) {
         wi->process();
     });
+    if (nr) {
+        auto& load = smp::_loads[engine().cpu_id()];
+        load.backlog.store(load.backlog.load(std::memory_order_relaxed) + nr, std::memory_order_relaxed);
+    }
     _received += nr;
     _last_rcv_batch = nr;
     return nr;
@@ -3172,10 +3632,21 @@ reactor::get_options_description(reactor_config cfg) {
         ("poll-mode", "poll continuously (100% cpu use)")
         ("idle-poll-time-us", bpo::value<unsigned>()->default_value(calculate_poll_time() / 1us),
                 "idle polling time in microseconds (reduce for overprovisioned environments or laptops)")
+        ("adaptive-idle-poll", bpo::value<bool>()->default_value(false),
+                "choose the idle polling time of each shard, up to --idle-poll-time-us, from how often work arrives:"
+                " poll through short gaps between requests and sleep right away when mostly idle")
+        ("idle-wakeup-cost-us", bpo::value<unsigned>()->default_value(50),
+                "with --adaptive-idle-poll, how much polling time in microseconds avoiding one sleep is worth"
+                " (increase to favor latency, decrease to save CPU)")
         ("poll-aio", bpo::value<bool>()->default_value(true),
                 "busy-poll for disk I/O (reduces latency and increases throughput)")
         ("task-quota-ms", bpo::value<double>()->default_value(cfg.task_quota / 1ms), "Max time (ms) between polls")
+        ("cpu-cap-period-ms", bpo::value<unsigned>()->default_value(100),
+                "period (ms) over which the CPU caps of scheduling groups are enforced; at least the task quota")
         ("max-task-backlog", bpo::value<unsigned>()->default_value(1000), "Maximum number of task backlog to allow; above this we ignore I/O")
+        ("task-profiler-sample-period", bpo::value<unsigned>()->default_value(0),
+                "time about one in this many tasks and account the time to the task's type (0 to disable);"
+                " see task_profiler.hh for getting the results")
         ("blocked-reactor-notify-ms", bpo::value<unsigned>()->default_value(200), "threshold in miliseconds over which the reactor is considered blocked if no progress is made")
         ("blocked-reactor-reports-per-minute", bpo::value<unsigned>()->default_value(5), "Maximum number of backtraces reported by stall detector per minute")
         ("relaxed-dma", "allow using buffered I/O if DMA is not available (reduces performance)")
@@ -3190,8 +3661,17 @@ reactor::get_options_description(reactor_config cfg) {
                 " This makes strace output more useful, but slows down the application")
         ("reactor-backend", bpo::value<reactor_backend_selector>()->default_value(reactor_backend_selector::default_backend()),
                 format("Internal reactor implementation ({})", reactor_backend_selector::available()).c_str())
+#ifdef SEASTAR_HAVE_URING
+        ("reactor-io-uring-sqpoll", bpo::value<bool>()->default_value(false),
+                "Let a kernel thread poll the io_uring submission queue (io_uring backend only). Saves the io_uring_enter(2)"
+                " system call per reactor iteration at the cost of a kernel thread spinning while I/O is active")
+#endif
         ("aio-fsync", bpo::value<bool>()->default_value(kernel_supports_aio_fsync()),
                 "Use Linux aio for fsync() calls. This reduces latency; requires Linux 4.18 or later.")
+        ("async-metadata", bpo::value<bool>()->default_value(true),
+                "Submit file metadata operations (open, stat, unlink, rename, link, mkdir, close) to the kernel"
+                " asynchronously when the reactor backend supports it (io_uring), instead of running them in the"
+                " syscall thread")
 #ifdef SEASTAR_HEAPPROF
         ("heapprof", "enable seastar heap profiling")
 #endif
@@ -3217,6 +3697,15 @@ smp::get_options_description()
         ("reserve-memory", bpo::value<std::string>(), "memory reserved to OS (if --memory not specified)")
         ("hugepages", bpo::value<std::string>(), "path to accessible hugetlbfs mount (typically /dev/hugepages/something)")
         ("lock-memory", bpo::value<bool>(), "lock all memory (prevents swapping)")
+        ("release-free-memory", bpo::value<std::string>()->default_value("none"),
+                "return free memory to the OS once a shard has plenty of it: none, dontneed (MADV_DONTNEED)"
+                " or lazy (MADV_FREE). Lowers the RSS of shards that spiked and went idle; has no effect with --hugepages")
+        ("huge-page-allocation-threshold", bpo::value<std::string>(),
+                "place allocations of at least this size (ex: 512k) in whole huge pages, to reduce TLB misses on large buffers")
+        ("small-size-classes", bpo::value<std::string>(),
+                "comma separated object sizes to add as exact-fit size classes to the small object allocator (ex: 200,360)")
+        ("heap-profiling-sample-rate", bpo::value<std::string>(),
+                "enable the sampling heap profiler, recording about one allocation per this many bytes allocated (ex: 512k)")
         ("thread-affinity", bpo::value<bool>()->default_value(true), "pin threads to their cpus (disable for overprovisioning)")
 #ifdef SEASTAR_HAVE_HWLOC
         ("num-io-queues", bpo::value<unsigned>(), "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
@@ -3224,6 +3713,14 @@ smp::get_options_description()
 #else
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of processors")
 #endif
+        ("shared-io-capacity", bpo::value<bool>()->default_value(false),
+                "let the I/O queues of a device lend each other the request and bandwidth capacity they leave unused,"
+                " instead of splitting it statically. Each queue keeps a quarter of its static share reserved,"
+                " and the rest is lent in proportion to the I/O shares each queue has waiting."
+                " Applies to the limits derived from --io-properties(-file), not to --max-io-requests,"
+                " which is bounded by the aio slots of each shard")
+        ("merge-io-requests", bpo::value<bool>()->default_value(false),
+                "submit contiguous reads or writes of the same file and I/O priority class, dispatched together, as a single vectored request")
         ("io-properties-file", bpo::value<std::string>(), "path to a YAML file describing the characteristics of the I/O Subsystem")
         ("io-properties", bpo::value<std::string>(), "a YAML string describing the characteristics of the I/O Subsystem")
         ("mbind", bpo::value<bool>()->default_value(true), "enable mbind")
@@ -3254,6 +3751,7 @@ std::vector<std::function<void ()>> smp::_thread_loops;
 compat::optional<boost::barrier> smp::_all_event_loops_done;
 std::vector<reactor*> smp::_reactors;
 std::unique_ptr<smp_message_queue*[], smp::qs_deleter> smp::_qs;
+std::unique_ptr<internal::smp_load_stats[]> smp::_loads;
 std::thread::id smp::_tmain;
 unsigned smp::count = 1;
 bool smp::_using_dpdk;
@@ -3393,7 +3891,26 @@ class disk_config_params {
     compat::optional<unsigned> _capacity;
     std::unordered_map<dev_t, mountpoint_params> _mountpoints;
     std::chrono::duration<double> _latency_goal;
+    bool _shared_capacity = false;
+    bool _merge_requests = false;
 
+    // With shared capacity, the part of its static share each queue keeps to itself,
+    // so that a shard that suddenly has work to do doesn't have to wait for the others
+    static constexpr unsigned shared_capacity_reservation_divisor = 4;
+
+    static unsigned reserved(unsigned limit) {
+        if (limit == std::numeric_limits<unsigned>::max()) {
+            return limit;
+        }
+        return std::max(limit / shared_capacity_reservation_divisor, 1u);
+    }
+
+    static uint64_t lendable(unsigned limit, unsigned nr_queues) {
+        if (limit == std::numeric_limits<unsigned>::max()) {
+            return 0;
+        }
+        return uint64_t(limit - reserved(limit)) * nr_queues;
+    }
 public:
     uint64_t per_io_queue(uint64_t qty, dev_t devid) const {
         const mountpoint_params& p = _mountpoints.at(devid);
@@ -3417,6 +3934,8 @@ class disk_config_params {
         if (configuration.count("max-io-requests")) {
             _capacity = configuration["max-io-requests"].as<unsigned>();
         }
+        _shared_capacity = configuration["shared-io-capacity"].as<bool>();
+        _merge_requests = configuration["merge-io-requests"].as<bool>();
 
         if (configuration.count("num-io-queues")) {
             _num_io_queues = configuration["num-io-queues"].as<unsigned>();
@@ -3462,6 +3981,17 @@ class disk_config_params {
                             d.read_req_rate == 0 || d.write_req_rate == 0) {
                         throw std::runtime_error(fmt::format("R/W bytes and req rates must not be zero"));
                     }
+                    for (auto* points : { &d.model.read, &d.model.write }) {
+                        for (auto& p : *points) {
+                            if (p.request_size == 0 || p.iops <= 0) {
+                                throw std::runtime_error(fmt::format("Device model of {}: request sizes and rates must not be zero", d.mountpoint));
+                            }
+                        }
+                    }
+                    // Split pieces must keep the DMA alignment of the original request
+                    if (d.max_request_size) {
+                        d.max_request_size = std::max(align_down<uint64_t>(d.max_request_size, 4096), uint64_t(4096));
+                    }
 
                     // Ideally we wouldn't have I/O Queues and would dispatch from every shard (https://github.com/scylladb/seastar/issues/485)
                     // While we don't do that, we'll just be conservative and try to recommend values of I/O Queues that are close to what we
@@ -3516,12 +4046,54 @@ class disk_config_params {
             if (max_iops != std::numeric_limits<uint64_t>::max()) {
                 cfg.max_req_count = io_queue::read_request_base_count * per_io_queue(max_iops * latency_goal().count(), devid);
             }
+            cfg.set_cost_model(p.model, p.read_req_rate, p.read_bytes_rate);
+            // Requests past the depth that saturates the device just wait in it.
+            // The depth is measured with small reads, the unit of request weights,
+            // so as a weight limit it accounts for the type and size of what is in
+            // flight. It bounds the device's total, which shared capacity lends
+            // between the queues.
+            if (p.model.saturation_depth()) {
+                auto depth = uint64_t(io_queue::read_request_base_count) * p.model.saturation_depth();
+                cfg.max_req_count = std::min<uint64_t>(cfg.max_req_count, per_io_queue(depth, devid));
+            }
             cfg.mountpoint = p.mountpoint;
         } else {
+            // Not shared with --shared-io-capacity: the capacity limit bounds the
+            // requests a queue has in flight, which its coordinator submits through
+            // its own, fixed number of aio slots (max_aio), so it can't borrow more.
             cfg.capacity = per_io_queue(*_capacity, 0);
             cfg.disk_bytes_write_to_read_multiplier = 1;
             cfg.disk_req_write_to_read_multiplier = 1;
         }
+        cfg.max_request_size = p.max_request_size;
+        cfg.merge_requests = _merge_requests;
+        if (p.max_request_size) {
+            cfg.max_merged_request_size = p.max_request_size;
+        }
+        return cfg;
+    }
+
+    // The group the \c nr_queues queues of a device borrow from when capacity is
+    // shared. The queues then only reserve part of their static share, and the group
+    // lends out the rest. Must be paired with generate_config() of the same device.
+    std::shared_ptr<fair_group> generate_group(dev_t devid, unsigned nr_queues) const {
+        if (!_shared_capacity) {
+            return nullptr;
+        }
+        auto cfg = generate_config(devid);
+        fair_group::config gcfg;
+        gcfg.max_req_count = lendable(cfg.max_req_count, nr_queues);
+        gcfg.max_bytes_count = lendable(cfg.max_bytes_count, nr_queues);
+        return std::make_shared<fair_group>(gcfg);
+    }
+
+    struct io_queue::config generate_config(dev_t devid, std::shared_ptr<fair_group> group) const {
+        auto cfg = generate_config(devid);
+        if (group) {
+            cfg.max_req_count = reserved(cfg.max_req_count);
+            cfg.max_bytes_count = reserved(cfg.max_bytes_count);
+            cfg.group = std::move(group);
+        }
         return cfg;
     }
 
@@ -3571,6 +4143,9 @@ void smp::configure(boost::program_options::variables_map configuration, reactor
 #ifdef SEASTAR_HAVE_DPDK
     _using_dpdk = configuration.count("dpdk-pmd");
 #endif
+    if (!configuration["cpu-cap-period-ms"].as<unsigned>()) {
+        throw std::runtime_error("cpu-cap-period-ms must be greater than zero");
+    }
     auto thread_affinity = configuration["thread-affinity"].as<bool>();
     if (configuration.count("overprovisioned")
            && configuration["thread-affinity"].defaulted()) {
@@ -3691,6 +4266,39 @@ void smp::configure(boost::program_options::variables_map configuration, reactor
         memory::set_heap_profiling_enabled(heapprof_enabled);
     }
 
+    auto release_free_memory = memory::free_memory_release::none;
+    auto release_mode = configuration["release-free-memory"].as<std::string>();
+    if (release_mode == "dontneed") {
+        release_free_memory = memory::free_memory_release::dontneed;
+    } else if (release_mode == "lazy") {
+        release_free_memory = memory::free_memory_release::lazy;
+    } else if (release_mode != "none") {
+        throw std::runtime_error(format("Unknown --release-free-memory mode: {}", release_mode));
+    }
+    size_t huge_page_allocation_threshold = 0;
+    if (configuration.count("huge-page-allocation-threshold")) {
+        huge_page_allocation_threshold = parse_memory_size(configuration["huge-page-allocation-threshold"].as<std::string>());
+    }
+    size_t heap_profiling_sample_rate = 0;
+    if (configuration.count("heap-profiling-sample-rate")) {
+        heap_profiling_sample_rate = parse_memory_size(configuration["heap-profiling-sample-rate"].as<std::string>());
+    }
+    std::vector<size_t> small_size_classes;
+    if (configuration.count("small-size-classes")) {
+        std::vector<std::string> sizes;
+        auto value = configuration["small-size-classes"].as<std::string>();
+        boost::split(sizes, value, boost::is_any_of(","));
+        for (auto& size : sizes) {
+            small_size_classes.push_back(boost::lexical_cast<size_t>(size));
+        }
+    }
+    memory::set_free_memory_release(release_free_memory);
+    memory::set_huge_page_allocation_threshold(huge_page_allocation_threshold);
+    memory::add_small_size_classes(small_size_classes);
+    if (heap_profiling_sample_rate) {
+        memory::set_heap_profiling_sample_rate(heap_profiling_sample_rate);
+    }
+
 #ifdef SEASTAR_HAVE_DPDK
     if (smp::_using_dpdk) {
         dpdk::eal::cpuset cpus;
@@ -3710,19 +4318,21 @@ void smp::configure(boost::program_options::variables_map configuration, reactor
     auto ioq_topology = std::move(resources.ioq_topology);
 
     std::unordered_map<dev_t, std::vector<io_queue*>> all_io_queues;
+    std::unordered_map<dev_t, std::shared_ptr<fair_group>> io_groups;
 
     for (auto& id : disk_config.device_ids()) {
         auto io_info = ioq_topology.at(id);
         all_io_queues.emplace(id, io_info.coordinators.size());
+        io_groups.emplace(id, disk_config.generate_group(id, io_info.coordinators.size()));
     }
 
-    auto alloc_io_queue = [&ioq_topology, &all_io_queues, &disk_config] (unsigned shard, dev_t id) {
+    auto alloc_io_queue = [&ioq_topology, &all_io_queues, &io_groups, &disk_config] (unsigned shard, dev_t id) {
         auto io_info = ioq_topology.at(id);
         auto cid = io_info.shard_to_coordinator[shard];
         auto vec_idx = io_info.coordinator_to_idx[cid];
         assert(io_info.coordinator_to_idx_valid[cid]);
         if (shard == cid) {
-            struct io_queue::config cfg = disk_config.generate_config(id);
+            struct io_queue::config cfg = disk_config.generate_config(id, io_groups.at(id));
             cfg.coordinator = cid;
             cfg.io_topology = io_info.shard_to_coordinator;
             assert(vec_idx < all_io_queues[id].size());
@@ -3744,11 +4354,14 @@ void smp::configure(boost::program_options::variables_map configuration, reactor
     _all_event_loops_done.emplace(smp::count);
 
     auto backend_selector = configuration["reactor-backend"].as<reactor_backend_selector>();
+#ifdef SEASTAR_HAVE_URING
+    io_uring_sqpoll = configuration["reactor-io-uring-sqpoll"].as<bool>();
+#endif
 
     unsigned i;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([configuration, &disk_config, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, mbind, backend_selector, reactor_cfg] {
+        create_thread([configuration, &disk_config, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, release_free_memory, huge_page_allocation_threshold, small_size_classes, heap_profiling_sample_rate, mbind, backend_selector, reactor_cfg] {
           try {
             auto thread_name = seastar::format("reactor-{}", i);
             pthread_setname_np(pthread_self(), thread_name.c_str());
@@ -3759,6 +4372,12 @@ void smp::configure(boost::program_options::variables_map configuration, reactor
             if (heapprof_enabled) {
                 memory::set_heap_profiling_enabled(heapprof_enabled);
             }
+            memory::set_free_memory_release(release_free_memory);
+            memory::set_huge_page_allocation_threshold(huge_page_allocation_threshold);
+            memory::add_small_size_classes(small_size_classes);
+            if (heap_profiling_sample_rate) {
+                memory::set_heap_profiling_sample_rate(heap_profiling_sample_rate);
+            }
             sigset_t mask;
             sigfillset(&mask);
             for (auto sig : { SIGSEGV }) {
@@ -3818,6 +4437,7 @@ void smp::configure(boost::program_options::variables_map configuration, reactor
             new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i]);
         }
     }
+    smp::_loads = std::make_unique<internal::smp_load_stats[]>(smp::count);
     alien::smp::_qs = alien::smp::create_qs(_reactors);
     smp_queues_constructed.wait();
     start_all_queues();
@@ -4200,6 +4820,10 @@ reactor::destroy_scheduling_group(scheduling_group sg) {
             }
         }
     }).then( [this, sg] () {
+        auto& tq = *_task_queues[sg._id];
+        if (tq._throttled) {
+            remove_throttled(tq);
+        }
         _task_queues[sg._id].reset();
     });
 
@@ -4220,6 +4844,11 @@ scheduling_group::set_shares(float shares) {
     engine()._task_queues[_id]->set_shares(shares);
 }
 
+void
+scheduling_group::set_cpu_cap(float fraction) {
+    engine().set_cpu_cap(*engine()._task_queues[_id], fraction);
+}
+
 future<scheduling_group>
 create_scheduling_group(sstring name, float shares) {
     auto id = allocate_scheduling_group_id();
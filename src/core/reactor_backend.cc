@@ -23,6 +23,7 @@
 #include "core/syscall_result.hh"
 #include <seastar/core/print.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/shared_future.hh>
 #include <seastar/util/defer.hh>
 #include <seastar/util/read_first_line.hh>
 #include <chrono>
@@ -33,6 +34,12 @@
 #include <osv/newpoll.hh>
 #endif
 
+#ifdef SEASTAR_HAVE_URING
+#include <liburing.h>
+#include <bitset>
+#include <boost/intrusive/list.hpp>
+#endif
+
 namespace seastar {
 
 using namespace std::chrono_literals;
@@ -926,6 +933,908 @@ reactor_backend_osv::make_pollable_fd_state(file_desc fd, pollable_fd::speculati
 }
 #endif
 
+#ifdef SEASTAR_HAVE_URING
+
+#ifndef IORING_FEAT_SQPOLL_NONFIXED
+#define IORING_FEAT_SQPOLL_NONFIXED (1U << 7)
+#endif
+
+static
+compat::optional<::io_uring>
+try_create_uring(unsigned queue_len, bool sqpoll, bool throw_on_error) {
+    auto required_features =
+            IORING_FEAT_SUBMIT_STABLE
+            | IORING_FEAT_NODROP;
+    auto required_ops = {
+            IORING_OP_POLL_ADD,
+            IORING_OP_POLL_REMOVE,
+            IORING_OP_ASYNC_CANCEL,
+            IORING_OP_READ,
+            IORING_OP_WRITE,
+            IORING_OP_READV,
+            IORING_OP_WRITEV,
+            IORING_OP_FSYNC,
+            IORING_OP_SENDMSG,
+            IORING_OP_RECVMSG,
+            IORING_OP_ACCEPT,
+            IORING_OP_CONNECT,
+            IORING_OP_SEND,
+            IORING_OP_RECV,
+            };
+    auto maybe_throw = [&] (auto exception) {
+        if (throw_on_error) {
+            throw exception;
+        }
+    };
+
+    auto params = ::io_uring_params{};
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        // How long the kernel submission thread keeps polling before it
+        // goes to sleep and needs an io_uring_enter() wakeup.
+        params.sq_thread_idle = 1000;
+    }
+    ::io_uring ring;
+    auto err = ::io_uring_queue_init_params(queue_len, &ring, &params);
+    if (err != 0) {
+        maybe_throw(std::system_error(std::error_code(-err, std::system_category()), "trying to create io_uring"));
+        return compat::nullopt;
+    }
+    auto free_ring = defer([&] { ::io_uring_queue_exit(&ring); });
+    ::io_uring_ring_dontfork(&ring);
+    if (~ring.features & required_features) {
+        maybe_throw(std::runtime_error(format("missing required io_ring features, required 0x{:x} available 0x{:x}", required_features, ring.features)));
+        return compat::nullopt;
+    }
+    // Before 5.11, an SQPOLL ring only works on registered files, and every
+    // operation on a plain fd fails with EBADF
+    if (sqpoll && !(ring.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        maybe_throw(std::runtime_error("io_uring SQPOLL requires registered files on this kernel"));
+        return compat::nullopt;
+    }
+
+    auto probe = ::io_uring_get_probe_ring(&ring);
+    if (!probe) {
+        maybe_throw(std::runtime_error("unable to create io_uring probe"));
+        return compat::nullopt;
+    }
+    auto free_probe = defer([&] { ::io_uring_free_probe(probe); });
+
+    for (auto op : required_ops) {
+        if (!::io_uring_opcode_supported(probe, op)) {
+            maybe_throw(std::runtime_error(format("required io_uring opcode {} not supported", int(op))));
+            return compat::nullopt;
+        }
+    }
+    free_ring.cancel();
+
+    return ring;
+}
+
+static bool detect_io_uring() {
+    auto ring_opt = try_create_uring(1, false, false);
+    if (ring_opt) {
+        ::io_uring_queue_exit(&ring_opt.value());
+    }
+    return bool(ring_opt);
+}
+
+// Set from --reactor-io-uring-sqpoll before the reactors are created.
+extern bool io_uring_sqpoll;
+
+// Reactor backend built on a single io_uring per shard. Disk I/O, fdatasync,
+// socket operations, readiness polls and the timerfd/eventfd notifications
+// used for timers and cross-shard wakeups are all submitted through the same
+// ring, so a reactor iteration costs at most one io_uring_enter() (none with
+// SQPOLL).
+//
+// Preemption while running tasks is still driven by linux-aio through
+// preempt_io_context, as its completion ring can be read from userspace
+// without a system call.
+class reactor_backend_uring final : public reactor_backend {
+    // s_queue_len is more or less arbitrary. Too low and we'll be
+    // issuing too small batches, too high and we require too much locked
+    // memory, but otherwise it doesn't matter.
+    static constexpr unsigned s_queue_len = 200;
+    reactor* _r;
+    ::io_uring _uring;
+    bool _did_work_while_getting_sqe = false;
+    bool _has_pending_submissions = false;
+    bool _processing_completions = false;
+    // Indexed by io_request::operation
+    std::bitset<32> _async_metadata_ops;
+    file_desc _hrtimer_timerfd;
+    preempt_io_context _preempt_io_context;
+
+    class uring_pollable_fd_state;
+
+    // An operation in the ring that refers to a uring_pollable_fd_state (a
+    // poll, or a socket recv/send/accept/connect). The state keeps a list of
+    // them so that forget() can cancel them, and is only freed once the kernel
+    // has completed all of them.
+    class fd_operation : public kernel_completion, public boost::intrusive::list_base_hook<> {
+    protected:
+        uring_pollable_fd_state& _owner;
+    public:
+        explicit fd_operation(uring_pollable_fd_state& owner) : _owner(owner) {}
+        virtual ~fd_operation() = default;
+        // The opcode that cancels this operation
+        virtual int cancel_opcode() const {
+            return IORING_OP_ASYNC_CANCEL;
+        }
+        bool in_flight() const {
+            return is_linked();
+        }
+        void submitted() {
+            _owner._in_flight.push_back(*this);
+        }
+        // Must be called first thing in complete_with(). Returns false if the
+        // owning pollable_fd is gone, in which case the state must not be
+        // touched after this call.
+        bool completed() {
+            _owner._in_flight.erase(_owner._in_flight.iterator_to(*this));
+            if (_owner._forgotten) {
+                _owner.maybe_dispose();
+                return false;
+            }
+            return true;
+        }
+    };
+
+    // Several waiters, e.g. two readable() calls, can share a poll
+    class poll_completion final : public fd_operation {
+        shared_promise<> _pr;
+    public:
+        using fd_operation::fd_operation;
+        virtual int cancel_opcode() const override {
+            return IORING_OP_POLL_REMOVE;
+        }
+        virtual void complete_with(ssize_t res) override {
+            if (!completed()) {
+                // Cancelled by forget(); nobody is waiting on _pr.
+                return;
+            }
+            // Errors are reported by the subsequent read/write/accept.
+            std::exchange(_pr, shared_promise<>()).set_value();
+        }
+        future<> get_future() {
+            return _pr.get_shared_future();
+        }
+    };
+
+    using forgotten_hook = boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+    class uring_pollable_fd_state : public pollable_fd_state, public forgotten_hook {
+        poll_completion _completion_pollin{*this};
+        poll_completion _completion_pollout{*this};
+        poll_completion _completion_pollin_or_out{*this};
+        boost::intrusive::list<fd_operation> _in_flight;
+        bool _forgotten = false;
+        friend class fd_operation;
+    public:
+        explicit uring_pollable_fd_state(file_desc desc, speculation speculate)
+                : pollable_fd_state(std::move(desc), std::move(speculate)) {
+        }
+        poll_completion* get_desc(int events) {
+            if (events == (POLLIN | POLLOUT)) {
+                return &_completion_pollin_or_out;
+            }
+            if (events & POLLIN) {
+                return &_completion_pollin;
+            }
+            return &_completion_pollout;
+        }
+        // Marks the state as no longer owned by a pollable_fd. Returns the
+        // operations that are still in the ring and need to be cancelled
+        // before the state can be freed.
+        const boost::intrusive::list<fd_operation>& forget() {
+            _forgotten = true;
+            return _in_flight;
+        }
+        void maybe_dispose() {
+            if (_in_flight.empty()) {
+                delete this;
+            }
+        }
+    };
+
+    // eventfd and timerfd both need an 8-byte read after they become readable
+    class recurring_eventfd_or_timerfd_completion : public fd_kernel_completion {
+        bool _armed = false;
+    public:
+        explicit recurring_eventfd_or_timerfd_completion(reactor* r, file_desc& fd) : fd_kernel_completion(r, fd) {}
+        bool armed() const {
+            return _armed;
+        }
+        // Completed without running, on teardown
+        void disarmed() {
+            _armed = false;
+        }
+        virtual void complete_with(ssize_t res) override {
+            uint64_t ignore = 0;
+            (void)_fd.read(&ignore, 8);
+            _armed = false;
+        }
+        void maybe_rearm(reactor_backend_uring& be) {
+            if (_armed) {
+                return;
+            }
+            auto sqe = be.get_sqe();
+            ::io_uring_prep_poll_add(sqe, fd().get(), POLLIN);
+            ::io_uring_sqe_set_data(sqe, static_cast<kernel_completion*>(this));
+            _armed = true;
+            be._has_pending_submissions = true;
+        }
+    };
+
+    // Completion for high resolution timerfd, used in wait_and_process_events()
+    // (while running tasks it's waited for in _preempt_io_context)
+    class hrtimer_completion : public recurring_eventfd_or_timerfd_completion {
+    public:
+        explicit hrtimer_completion(reactor* r, file_desc& timerfd)
+                : recurring_eventfd_or_timerfd_completion(r, timerfd) {
+        }
+        virtual void complete_with(ssize_t res) override {
+            recurring_eventfd_or_timerfd_completion::complete_with(res);
+            _r->service_highres_timer();
+        }
+    };
+
+    using smp_wakeup_completion = recurring_eventfd_or_timerfd_completion;
+
+    hrtimer_completion _hrtimer_completion;
+    smp_wakeup_completion _smp_wakeup_completion;
+    // States whose pollable_fd is gone, waiting for their cancelled
+    // operations to complete
+    boost::intrusive::list<uring_pollable_fd_state, boost::intrusive::base_hook<forgotten_hook>,
+            boost::intrusive::constant_time_size<false>> _forgotten_fds;
+private:
+    static file_desc make_timerfd() {
+        return file_desc::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    }
+
+    static ::io_uring make_uring() {
+        if (io_uring_sqpoll) {
+            try {
+                return *try_create_uring(s_queue_len, true, true);
+            } catch (...) {
+                // SQPOLL needs CAP_SYS_ADMIN (or CAP_SYS_NICE) on older kernels
+                seastar_logger.warn("Unable to create io_uring with SQPOLL ({}), falling back to interrupt-driven submission",
+                        std::current_exception());
+            }
+        }
+        return *try_create_uring(s_queue_len, false, true);
+    }
+
+    // Submits the queued entries. Returns false if the kernel can't take them
+    // right now (e.g. the completion queue is full), in which case they stay
+    // in the ring and have to be submitted again later.
+    bool submit() {
+        auto r = ::io_uring_submit(&_uring);
+        if (__builtin_expect(r < 0, false)) {
+            switch (-r) {
+            case EAGAIN:
+            case EBUSY:
+            case EINTR:
+                return false;
+            default:
+                seastar_logger.error("io_uring_submit: {}", std::system_error(-r, std::system_category()).what());
+                abort();
+            }
+        }
+        return true;
+    }
+
+    ::io_uring_sqe* get_sqe() {
+        ::io_uring_sqe* sqe;
+        while ((sqe = ::io_uring_get_sqe(&_uring)) == nullptr) {
+            if (!submit() && !_processing_completions) {
+                // Make room in the completion queue. Not from a completion,
+                // whose batch is still being processed.
+                do_process_kernel_completions();
+            }
+            _did_work_while_getting_sqe = true;
+        }
+        return sqe;
+    }
+
+    future<> poll(pollable_fd_state& fd, int events) {
+        if (events & fd.events_known) {
+            fd.events_known &= ~events;
+            return make_ready_future<>();
+        }
+        try {
+            fd.events_rw = events == (POLLIN|POLLOUT);
+            auto* ufd = static_cast<uring_pollable_fd_state*>(&fd);
+            auto* desc = ufd->get_desc(events);
+            auto fut = desc->get_future();
+            if (!desc->in_flight()) {
+                auto sqe = get_sqe();
+                ::io_uring_prep_poll_add(sqe, fd.fd.get(), events);
+                ::io_uring_sqe_set_data(sqe, static_cast<kernel_completion*>(desc));
+                desc->submitted();
+                _has_pending_submissions = true;
+            }
+            return fut;
+        } catch (...) {
+            return make_exception_future<>(std::current_exception());
+        }
+    }
+
+    void submit_io_request(internal::io_request& req, kernel_completion* completion) {
+        auto sqe = get_sqe();
+        using o = internal::io_request::operation;
+        switch (req.opcode()) {
+            case o::read:
+                ::io_uring_prep_read(sqe, req.fd(), req.address(), req.size(), req.pos());
+                break;
+            case o::write:
+                ::io_uring_prep_write(sqe, req.fd(), req.address(), req.size(), req.pos());
+                break;
+            case o::readv:
+                ::io_uring_prep_readv(sqe, req.fd(), req.iov(), req.iov_len(), req.pos());
+                break;
+            case o::writev:
+                ::io_uring_prep_writev(sqe, req.fd(), req.iov(), req.iov_len(), req.pos());
+                break;
+            case o::fdatasync:
+                ::io_uring_prep_fsync(sqe, req.fd(), IORING_FSYNC_DATASYNC);
+                break;
+            case o::recv:
+                ::io_uring_prep_recv(sqe, req.fd(), req.address(), req.size(), req.flags());
+                break;
+            case o::recvmsg:
+                ::io_uring_prep_recvmsg(sqe, req.fd(), req.msghdr(), req.flags());
+                break;
+            case o::send:
+                ::io_uring_prep_send(sqe, req.fd(), req.address(), req.size(), req.flags());
+                break;
+            case o::sendmsg:
+                ::io_uring_prep_sendmsg(sqe, req.fd(), req.msghdr(), req.flags());
+                break;
+            case o::accept:
+                ::io_uring_prep_accept(sqe, req.fd(), req.posix_sockaddr(), req.socklen_ptr(), req.flags());
+                break;
+            case o::connect:
+                ::io_uring_prep_connect(sqe, req.fd(), req.posix_sockaddr(), req.socklen());
+                break;
+            case o::poll_add:
+                ::io_uring_prep_poll_add(sqe, req.fd(), req.events());
+                break;
+            case o::openat:
+                ::io_uring_prep_openat(sqe, req.fd(), req.path(), req.flags(), req.mode());
+                break;
+            case o::close:
+                ::io_uring_prep_close(sqe, req.fd());
+                break;
+            case o::statx:
+                ::io_uring_prep_statx(sqe, req.fd(), req.path(), req.flags(), STATX_BASIC_STATS, req.statx_buffer());
+                break;
+#ifdef SEASTAR_HAVE_URING_UNLINKAT
+            case o::unlinkat:
+                ::io_uring_prep_unlinkat(sqe, req.fd(), req.path(), req.flags());
+                break;
+            case o::renameat:
+                ::io_uring_prep_renameat(sqe, req.fd(), req.path(), req.fd(), req.new_path(), 0);
+                break;
+#endif
+#ifdef SEASTAR_HAVE_URING_MKDIRAT
+            case o::linkat:
+                ::io_uring_prep_linkat(sqe, req.fd(), req.path(), req.fd(), req.new_path(), 0);
+                break;
+            case o::mkdirat:
+                ::io_uring_prep_mkdirat(sqe, req.fd(), req.path(), req.mode());
+                break;
+#endif
+            default:
+                seastar_logger.error("Invalid operation for io_uring: {}", req.opname());
+                std::abort();
+        }
+        ::io_uring_sqe_set_data(sqe, completion);
+
+        _has_pending_submissions = true;
+    }
+
+    void cancel(const fd_operation& op) {
+        cancel(op.cancel_opcode(), &op);
+    }
+
+    void cancel(int opcode, const kernel_completion* completion) {
+        auto sqe = get_sqe();
+        // Spelled out instead of using io_uring_prep_poll_remove()/io_uring_prep_cancel(),
+        // whose signatures differ between liburing versions.
+        ::io_uring_prep_rw(opcode, sqe, -1, nullptr, 0, 0);
+        sqe->addr = reinterpret_cast<uintptr_t>(completion);
+        // The result of the cancellation itself is of no interest, only the
+        // -ECANCELED completion of the operation it cancels.
+        ::io_uring_sqe_set_data(sqe, nullptr);
+        _has_pending_submissions = true;
+    }
+
+    // Socket operations are submitted to the ring as recv/send/accept/connect
+    // instead of waiting for readiness and then issuing the system call, which
+    // saves a reactor round trip and a kernel crossing per operation. The
+    // kernel accesses the buffers after submission, and can't always be
+    // stopped in time, so only buffers the operation owns are handed to it:
+    // reads and writes of raw memory wait for readiness instead.
+    //
+    // As with the other backends, a previous operation that filled the whole
+    // buffer leaves a speculation behind; in that case we try the non-blocking
+    // system call first since it will most likely complete synchronously.
+    template <typename Syscall>
+    static compat::optional<future<size_t>> try_speculated(pollable_fd_state& fd, int event, size_t len, Syscall syscall) {
+        if (!(fd.events_known & event)) {
+            return compat::nullopt;
+        }
+        fd.events_known &= ~event;
+        try {
+            auto r = syscall();
+            if (!r) {
+                return compat::nullopt;
+            }
+            if (size_t(*r) == len) {
+                fd.speculate_epoll(event);
+            }
+            return make_ready_future<size_t>(*r);
+        } catch (...) {
+            return make_exception_future<size_t>(std::current_exception());
+        }
+    }
+
+    // The kernel reads the packet's data after submission, and the operation
+    // can't be cancelled once it started, so it holds a share of the packet
+    // until it completes, in case the caller's goes away first
+    class socket_io_completion final : public fd_operation {
+        const size_t _len;
+        const int _event;
+        net::packet _packet;
+        ::msghdr _mh = {};
+        promise<size_t> _result;
+    public:
+        socket_io_completion(uring_pollable_fd_state& fd, int event, net::packet& p)
+                : fd_operation(fd), _len(p.len()), _event(event), _packet(p.share()) {
+            _mh.msg_iov = reinterpret_cast<iovec*>(_packet.fragment_array());
+            _mh.msg_iovlen = std::min<size_t>(_packet.nr_frags(), IOV_MAX);
+        }
+        ::msghdr* msghdr() {
+            return &_mh;
+        }
+        virtual void complete_with(ssize_t res) override {
+            auto alive = completed();
+            if (res >= 0) {
+                if (alive && size_t(res) == _len) {
+                    _owner.speculate_epoll(_event);
+                }
+                _result.set_value(res);
+            } else {
+                _result.set_exception(std::system_error(-res, std::system_category()));
+            }
+            delete this;
+        }
+        future<size_t> get_future() {
+            return _result.get_future();
+        }
+    };
+
+    // Likewise, the buffer a recv fills is owned by the operation and handed
+    // back to the caller on completion
+    class recv_completion final : public fd_operation {
+        temporary_buffer<char> _buf;
+        promise<temporary_buffer<char>> _result;
+    public:
+        recv_completion(uring_pollable_fd_state& fd, temporary_buffer<char> buf)
+                : fd_operation(fd), _buf(std::move(buf)) {
+        }
+        char* data() {
+            return _buf.get_write();
+        }
+        size_t size() const {
+            return _buf.size();
+        }
+        virtual void complete_with(ssize_t res) override {
+            auto alive = completed();
+            if (res >= 0) {
+                if (alive && size_t(res) == _buf.size()) {
+                    _owner.speculate_epoll(POLLIN);
+                }
+                _buf.trim(res);
+                _result.set_value(std::move(_buf));
+            } else {
+                _result.set_exception(std::system_error(-res, std::system_category()));
+            }
+            delete this;
+        }
+        future<temporary_buffer<char>> get_future() {
+            return _result.get_future();
+        }
+    };
+
+    class accept_completion final : public fd_operation {
+        socket_address _sa;
+        promise<std::tuple<pollable_fd, socket_address>> _result;
+    public:
+        explicit accept_completion(uring_pollable_fd_state& listenfd) : fd_operation(listenfd) {
+            _sa.addr_length = sizeof(_sa.u.sas);
+        }
+        ::sockaddr* posix_sockaddr() {
+            return &_sa.as_posix_sockaddr();
+        }
+        socklen_t* socklen_ptr() {
+            return &_sa.addr_length;
+        }
+        virtual void complete_with(ssize_t res) override {
+            completed();
+            try {
+                if (res < 0) {
+                    throw std::system_error(-res, std::system_category(), "accept4");
+                }
+                pollable_fd pfd(file_desc::from_fd(res), pollable_fd::speculation(EPOLLOUT));
+                _result.set_value(std::make_tuple(std::move(pfd), _sa));
+            } catch (...) {
+                _result.set_exception(std::current_exception());
+            }
+            delete this;
+        }
+        future<std::tuple<pollable_fd, socket_address>> get_future() {
+            return _result.get_future();
+        }
+    };
+
+    class connect_completion final : public fd_operation {
+        // The kernel reads the address after submission, so keep our own copy
+        socket_address _sa;
+        promise<> _result;
+    public:
+        connect_completion(uring_pollable_fd_state& fd, const socket_address& sa) : fd_operation(fd), _sa(sa) {}
+        ::sockaddr* posix_sockaddr() {
+            return &_sa.as_posix_sockaddr();
+        }
+        virtual void complete_with(ssize_t res) override {
+            completed();
+            if (res < 0) {
+                _result.set_exception(std::system_error(-res, std::system_category()));
+            } else {
+                _result.set_value();
+            }
+            delete this;
+        }
+        future<> get_future() {
+            return _result.get_future();
+        }
+    };
+
+    // Submits a socket operation on behalf of the fd that owns it
+    void submit_fd_operation(internal::io_request req, std::unique_ptr<fd_operation> op) {
+        submit_io_request(req, op.get());
+        op.release()->submitted();
+    }
+
+    // Returns true if any work was done
+    bool queue_pending_file_io() {
+        auto& pending = _r->_pending_io;
+        if (pending.empty()) {
+            return false;
+        }
+        for (auto& req : pending) {
+            submit_io_request(req, req.get_kernel_completion());
+        }
+        pending.clear();
+        return true;
+    }
+
+    // Process kernel completions already extracted from the ring.
+    // This is needed because we sometimes extract completions without
+    // waiting, and sometimes with waiting.
+    void process_completion(::io_uring_cqe* cqe) {
+        auto completion = reinterpret_cast<kernel_completion*>(::io_uring_cqe_get_data(cqe));
+        if (completion) {
+            completion->complete_with(cqe->res);
+        }
+    }
+
+    // Returns true if completions were processed
+    bool do_process_kernel_completions_step() {
+        std::array<::io_uring_cqe*, s_queue_len> buf;
+        auto n = ::io_uring_peek_batch_cqe(&_uring, buf.data(), buf.size());
+        _processing_completions = true;
+        for (unsigned i = 0; i != n; ++i) {
+            process_completion(buf[i]);
+        }
+        _processing_completions = false;
+        ::io_uring_cq_advance(&_uring, n);
+        return n != 0;
+    }
+
+    bool do_process_kernel_completions() {
+        auto did_work = false;
+        while (do_process_kernel_completions_step()) {
+            did_work = true;
+        }
+        return did_work | std::exchange(_did_work_while_getting_sqe, false);
+    }
+
+    // The metadata opcodes came with different kernel versions (openat,
+    // statx and close with 5.6, unlinkat and renameat with 5.11, mkdirat
+    // and linkat with 5.15), so each is probed on its own. The newer ones
+    // are left out when built against a liburing that can't prepare them.
+    void probe_async_metadata_ops() {
+        auto probe = ::io_uring_get_probe_ring(&_uring);
+        if (!probe) {
+            return;
+        }
+        auto free_probe = defer([&] { ::io_uring_free_probe(probe); });
+        using o = internal::io_request::operation;
+        static const std::pair<o, int> ops[] = {
+            { o::fdatasync, IORING_OP_FSYNC },
+            { o::openat, IORING_OP_OPENAT },
+            { o::close, IORING_OP_CLOSE },
+            { o::statx, IORING_OP_STATX },
+#ifdef SEASTAR_HAVE_URING_UNLINKAT
+            { o::unlinkat, IORING_OP_UNLINKAT },
+            { o::renameat, IORING_OP_RENAMEAT },
+#endif
+#ifdef SEASTAR_HAVE_URING_MKDIRAT
+            { o::linkat, IORING_OP_LINKAT },
+            { o::mkdirat, IORING_OP_MKDIRAT },
+#endif
+        };
+        for (auto& op : ops) {
+            if (::io_uring_opcode_supported(probe, op.second)) {
+                _async_metadata_ops.set(static_cast<unsigned>(op.first));
+            }
+        }
+    }
+
+    bool do_flush_submission_ring() {
+        if (_has_pending_submissions) {
+            _did_work_while_getting_sqe = false;
+            // Retried on the next poll if the kernel can't take them now
+            _has_pending_submissions = !submit();
+            return true;
+        } else {
+            return std::exchange(_did_work_while_getting_sqe, false);
+        }
+    }
+public:
+    explicit reactor_backend_uring(reactor* r)
+            : _r(r)
+            , _uring(make_uring())
+            , _hrtimer_timerfd(make_timerfd())
+            , _preempt_io_context(_r, _r->_task_quota_timer, _hrtimer_timerfd)
+            , _hrtimer_completion(_r, _hrtimer_timerfd)
+            , _smp_wakeup_completion(_r, _r->_notify_eventfd) {
+        // Protect against spurious wakeups - if we get notified that the timer has
+        // expired when it really hasn't, we don't want to block in read(tfd, ...).
+        auto tfd = _r->_task_quota_timer.get();
+        ::fcntl(tfd, F_SETFL, ::fcntl(tfd, F_GETFL) | O_NONBLOCK);
+
+        sigset_t mask = make_sigset_mask(hrtimer_signal());
+        auto e = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
+        assert(e == 0);
+
+        probe_async_metadata_ops();
+    }
+    ~reactor_backend_uring() {
+        drain();
+        ::io_uring_queue_exit(&_uring);
+    }
+
+    // Waits for the operations still in the ring, which refer to memory
+    // freed with the backend: the recurring notification polls, and the
+    // states of forgotten fds, which their last completion frees.
+    void drain() {
+        for (auto c : { static_cast<recurring_eventfd_or_timerfd_completion*>(&_hrtimer_completion), &_smp_wakeup_completion }) {
+            if (c->armed()) {
+                cancel(IORING_OP_POLL_REMOVE, c);
+            }
+        }
+        auto submitted = submit();
+        while (!_forgotten_fds.empty() || _hrtimer_completion.armed() || _smp_wakeup_completion.armed()) {
+            if (!submitted) {
+                submitted = submit();
+            }
+            ::io_uring_cqe* cqe = nullptr;
+            ::__kernel_timespec timeout = { 1, 0 };
+            auto r = ::io_uring_wait_cqe_timeout(&_uring, &cqe, &timeout);
+            if (r == -EINTR) {
+                continue;
+            }
+            if (r < 0) {
+                seastar_logger.warn("io_uring: operations still in flight at shutdown: {}",
+                        std::system_error(-r, std::system_category()).what());
+                return;
+            }
+            auto completion = reinterpret_cast<kernel_completion*>(::io_uring_cqe_get_data(cqe));
+            if (completion == &_hrtimer_completion || completion == &_smp_wakeup_completion) {
+                // Not completed as usual, the reactor is going away
+                static_cast<recurring_eventfd_or_timerfd_completion*>(completion)->disarmed();
+            } else if (completion) {
+                completion->complete_with(cqe->res);
+            }
+            ::io_uring_cqe_seen(&_uring, cqe);
+        }
+    }
+    virtual bool reap_kernel_completions() override {
+        return do_process_kernel_completions();
+    }
+    virtual bool kernel_submit_work() override {
+        bool did_work = false;
+        did_work |= _preempt_io_context.service_preempting_io();
+        did_work |= queue_pending_file_io();
+        did_work |= do_flush_submission_ring();
+        return did_work;
+    }
+    virtual bool kernel_events_can_sleep() const override {
+        // We never need to spin while I/O is in flight; completions wake us up.
+        return true;
+    }
+    virtual bool have_async_metadata_op(internal::io_request::operation op) const override {
+        return _async_metadata_ops.test(static_cast<unsigned>(op));
+    }
+    virtual void wait_and_process_events(const sigset_t* active_sigmask) override {
+        _smp_wakeup_completion.maybe_rearm(*this);
+        _hrtimer_completion.maybe_rearm(*this);
+        do_flush_submission_ring();
+        bool did_work = false;
+        did_work |= _preempt_io_context.service_preempting_io();
+        did_work |= do_process_kernel_completions();
+        if (did_work) {
+            return;
+        }
+        ::io_uring_cqe* cqe = nullptr;
+        sigset_t sigs;
+        sigset_t* sigsp = nullptr;
+        if (active_sigmask) {
+            sigs = *active_sigmask; // io_uring_wait_cqes() wants a non-const sigset_t*
+            sigsp = &sigs;
+        }
+        auto r = ::io_uring_wait_cqes(&_uring, &cqe, 1, nullptr, sigsp);
+        if (__builtin_expect(r < 0, false)) {
+            switch (-r) {
+            case EINTR:
+                return;
+            default:
+                seastar_logger.error("io_uring_wait_cqes: {}", std::system_error(-r, std::system_category()).what());
+                abort();
+            }
+        }
+        do_process_kernel_completions();
+        _preempt_io_context.service_preempting_io();
+    }
+    virtual future<> readable(pollable_fd_state& fd) override {
+        return poll(fd, POLLIN);
+    }
+    virtual future<> writeable(pollable_fd_state& fd) override {
+        return poll(fd, POLLOUT);
+    }
+    virtual future<> readable_or_writeable(pollable_fd_state& fd) override {
+        return poll(fd, POLLIN | POLLOUT);
+    }
+    virtual void forget(pollable_fd_state& fd) noexcept override {
+        auto* pfd = static_cast<uring_pollable_fd_state*>(&fd);
+        auto& in_flight = pfd->forget();
+        if (in_flight.empty()) {
+            delete pfd;
+            return;
+        }
+        // Operations in the ring still reference the state (and the fd); cancel
+        // them and let the last completion free it. The fd stays open until
+        // then, so the kernel cannot complete an operation on a recycled
+        // descriptor.
+        for (auto& op : in_flight) {
+            cancel(op);
+        }
+        _forgotten_fds.push_back(*pfd);
+    }
+    virtual future<std::tuple<pollable_fd, socket_address>>
+    accept(pollable_fd_state& listenfd) override {
+        if (listenfd.no_more_recv) {
+            return make_exception_future<std::tuple<pollable_fd, socket_address>>(
+                    std::system_error(ECONNABORTED, std::system_category()));
+        }
+        try {
+            auto desc = std::make_unique<accept_completion>(static_cast<uring_pollable_fd_state&>(listenfd));
+            auto fut = desc->get_future();
+            auto req = internal::io_request::make_accept(listenfd.fd.get(), desc->posix_sockaddr(), desc->socklen_ptr(),
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+            submit_fd_operation(req, std::move(desc));
+            return fut;
+        } catch (...) {
+            return make_exception_future<std::tuple<pollable_fd, socket_address>>(std::current_exception());
+        }
+    }
+    virtual future<> connect(pollable_fd_state& fd, socket_address& sa) override {
+        try {
+            auto desc = std::make_unique<connect_completion>(static_cast<uring_pollable_fd_state&>(fd), sa);
+            auto fut = desc->get_future();
+            auto req = internal::io_request::make_connect(fd.fd.get(), desc->posix_sockaddr(), sa.length());
+            submit_fd_operation(req, std::move(desc));
+            return fut;
+        } catch (...) {
+            return make_exception_future<>(std::current_exception());
+        }
+    }
+    virtual void shutdown(pollable_fd_state& fd, int how) override {
+        fd.fd.shutdown(how);
+    }
+    virtual future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t len) override {
+        return engine().do_read_some(fd, buffer, len);
+    }
+    virtual future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) override {
+        return engine().do_read_some(fd, iov);
+    }
+    virtual future<temporary_buffer<char>> read_some_buffer(pollable_fd_state& fd, temporary_buffer<char> buf) override {
+        auto len = buf.size();
+        if (auto r = try_speculated(fd, POLLIN, len, [&] { return fd.fd.read(buf.get_write(), len); })) {
+            return r->then([buf = std::move(buf)] (size_t size) mutable {
+                buf.trim(size);
+                return std::move(buf);
+            });
+        }
+        try {
+            auto desc = std::make_unique<recv_completion>(static_cast<uring_pollable_fd_state&>(fd), std::move(buf));
+            auto fut = desc->get_future();
+            auto req = internal::io_request::make_recv(fd.fd.get(), desc->data(), desc->size(), 0);
+            submit_fd_operation(req, std::move(desc));
+            return fut;
+        } catch (...) {
+            return make_exception_future<temporary_buffer<char>>(std::current_exception());
+        }
+    }
+    virtual future<size_t> write_some(pollable_fd_state& fd, net::packet& p) override {
+        static_assert(offsetof(iovec, iov_base) == offsetof(net::fragment, base) &&
+            sizeof(iovec::iov_base) == sizeof(net::fragment::base) &&
+            offsetof(iovec, iov_len) == offsetof(net::fragment, size) &&
+            sizeof(iovec::iov_len) == sizeof(net::fragment::size) &&
+            alignof(iovec) == alignof(net::fragment) &&
+            sizeof(iovec) == sizeof(net::fragment)
+            , "net::fragment and iovec should be equivalent");
+
+        try {
+            auto desc = std::make_unique<socket_io_completion>(static_cast<uring_pollable_fd_state&>(fd), POLLOUT, p);
+            if (auto r = try_speculated(fd, POLLOUT, p.len(), [&] { return fd.fd.sendmsg(desc->msghdr(), MSG_NOSIGNAL); })) {
+                return std::move(*r);
+            }
+            auto fut = desc->get_future();
+            auto req = internal::io_request::make_sendmsg(fd.fd.get(), desc->msghdr(), MSG_NOSIGNAL);
+            submit_fd_operation(req, std::move(desc));
+            return fut;
+        } catch (...) {
+            return make_exception_future<size_t>(std::current_exception());
+        }
+    }
+    virtual future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t len) override {
+        return engine().do_write_some(fd, buffer, len);
+    }
+    virtual void signal_received(int signo, siginfo_t* siginfo, void* ignore) override {
+        engine()._signals.action(signo, siginfo, ignore);
+    }
+    virtual void start_tick() override {
+        _preempt_io_context.start_tick();
+    }
+    virtual void stop_tick() override {
+        _preempt_io_context.stop_tick();
+    }
+    virtual void arm_highres_timer(const ::itimerspec& its) override {
+        _hrtimer_timerfd.timerfd_settime(TFD_TIMER_ABSTIME, its);
+    }
+    virtual void reset_preemption_monitor() override {
+        _preempt_io_context.reset_preemption_monitor();
+    }
+    virtual void request_preemption() override {
+        _preempt_io_context.request_preemption();
+    }
+    virtual void start_handling_signal() override {
+        // Like the aio backend, we only use SIGHUP/SIGTERM/SIGINT, which don't
+        // need to be handled right away.
+    }
+    virtual pollable_fd_state_ptr make_pollable_fd_state(file_desc fd, pollable_fd::speculation speculate) override {
+        return pollable_fd_state_ptr(new uring_pollable_fd_state(std::move(fd), std::move(speculate)));
+    }
+};
+
+#endif
+
 static bool detect_aio_poll() {
     auto fd = file_desc::eventfd(0, 0);
     aio_context_t ioc{};
@@ -969,6 +1878,10 @@ std::unique_ptr<reactor_backend> reactor_backend_selector::create(reactor* r) {
         return std::make_unique<reactor_backend_aio>(r);
     } else if (_name == "epoll") {
         return std::make_unique<reactor_backend_epoll>(r);
+#ifdef SEASTAR_HAVE_URING
+    } else if (_name == "io_uring") {
+        return std::make_unique<reactor_backend_uring>(r);
+#endif
     }
     throw std::logic_error("bad reactor backend");
 }
@@ -981,6 +1894,12 @@ std::vector<reactor_backend_selector> reactor_backend_selector::available() {
     std::vector<reactor_backend_selector> ret;
     if (detect_aio_poll() && has_enough_aio_nr()) {
         ret.push_back(reactor_backend_selector("linux-aio"));
+#ifdef SEASTAR_HAVE_URING
+        // The io_uring backend relies on linux-aio for preemption
+        if (detect_io_uring()) {
+            ret.push_back(reactor_backend_selector("io_uring"));
+        }
+#endif
     }
     ret.push_back(reactor_backend_selector("epoll"));
     return ret;
@@ -25,6 +25,7 @@
 #include <seastar/core/posix.hh>
 #include <seastar/core/internal/pollable_fd.hh>
 #include <seastar/core/internal/poll.hh>
+#include <seastar/core/internal/io_request.hh>
 #include <seastar/core/linux-aio.hh>
 #include <seastar/core/cacheline.hh>
 #include <sys/time.h>
@@ -180,6 +181,16 @@ class reactor_backend {
     virtual void shutdown(pollable_fd_state& fd, int how) = 0;
     virtual future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t len) = 0;
     virtual future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) = 0;
+    // Reads into a buffer that the read owns until it completes, so that a
+    // backend may let the kernel fill it asynchronously
+    virtual future<temporary_buffer<char>> read_some_buffer(pollable_fd_state& fd, temporary_buffer<char> buf) {
+        auto data = buf.get_write();
+        auto len = buf.size();
+        return read_some(fd, data, len).then([buf = std::move(buf)] (size_t size) mutable {
+            buf.trim(size);
+            return std::move(buf);
+        });
+    }
     virtual future<size_t> write_some(pollable_fd_state& fd, net::packet& p) = 0;
     virtual future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t len) = 0;
 
@@ -192,6 +203,13 @@ class reactor_backend {
     virtual void start_handling_signal() = 0;
 
     virtual pollable_fd_state_ptr make_pollable_fd_state(file_desc fd, pollable_fd::speculation speculate) = 0;
+
+    // Whether the metadata operation \c op (see io_request::operation) can be
+    // submitted through reactor::submit_io() and executed by the kernel
+    // asynchronously. Otherwise it has to run in the syscall thread.
+    virtual bool have_async_metadata_op(internal::io_request::operation op) const {
+        return false;
+    }
 };
 
 // reactor backend using file-descriptor & epoll, suitable for running on
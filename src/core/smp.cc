@@ -33,6 +33,52 @@ void smp_message_queue::work_item::process() {
     schedule(this);
 }
 
+namespace {
+
+// Recycled small work items of this shard
+struct work_item_cache {
+    std::vector<void*> items;
+    ~work_item_cache() {
+        for (auto p : items) {
+            ::operator delete(p);
+        }
+    }
+};
+
+thread_local work_item_cache small_work_items;
+
+}
+
+void* smp_message_queue::work_item::operator new(size_t size) {
+    if (size <= small_item_size) {
+        auto& items = small_work_items.items;
+        if (!items.empty()) {
+            auto p = items.back();
+            items.pop_back();
+            return p;
+        }
+        size = small_item_size;
+    }
+    return ::operator new(size);
+}
+
+void smp_message_queue::work_item::operator delete(void* p, size_t size) {
+    auto& items = small_work_items.items;
+    if (size <= small_item_size && items.size() < max_cached_items) {
+        if (items.capacity() == 0) {
+            try {
+                items.reserve(max_cached_items);
+            } catch (...) {
+                ::operator delete(p);
+                return;
+            }
+        }
+        items.push_back(p);
+        return;
+    }
+    ::operator delete(p);
+}
+
 struct smp_service_group_impl {
     std::vector<smp_service_group_semaphore> clients;   // one client per server shard
 };
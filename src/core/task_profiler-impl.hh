@@ -0,0 +1,106 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/task_profiler.hh>
+#include <seastar/core/scheduling.hh>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+
+namespace seastar {
+
+namespace internal {
+
+// The reactor's side of the task profiler
+class task_profiler {
+public:
+    struct entry {
+        uint64_t samples = 0;
+        uint64_t tasks = 0;
+        std::chrono::nanoseconds runtime{0};
+    };
+    struct group_profile {
+        std::unordered_map<std::type_index, entry> types;
+        // Task types past max_types_per_group
+        entry others;
+    };
+private:
+    // Bounds the memory used by programs with many task types
+    static constexpr size_t max_types_per_group = 512;
+
+    std::array<group_profile, max_scheduling_groups()> _groups;
+    unsigned _period;
+    unsigned _countdown;
+    uint64_t _random;
+
+    // Sampling at random intervals that average to the period, so tasks
+    // that run in a fixed cycle don't always or never get sampled
+    unsigned next_countdown() {
+        _random ^= _random << 13;
+        _random ^= _random >> 7;
+        _random ^= _random << 17;
+        return 1 + _random % (2 * _period - 1);
+    }
+public:
+    explicit task_profiler(unsigned period);
+
+    // This shard's profiler, null when disabled
+    static std::unique_ptr<task_profiler>& local();
+
+    void set_period(unsigned period) {
+        _period = period;
+        _countdown = next_countdown();
+    }
+
+    // Called before each task runs
+    bool should_sample() {
+        if (--_countdown) {
+            return false;
+        }
+        _countdown = next_countdown();
+        return true;
+    }
+
+    void add(unsigned group, const std::type_info& type, std::chrono::nanoseconds runtime);
+
+    void reset() {
+        for (auto& g : _groups) {
+            g = group_profile();
+        }
+    }
+
+    const std::array<group_profile, max_scheduling_groups()>& groups() const {
+        return _groups;
+    }
+};
+
+// A short name for a task type: the first lambda that appears in it, with the
+// scope that defines it, or the whole type name if there is none. Lambdas have
+// no names, so they are told apart by that scope and their ordinal in it.
+sstring task_type_name(std::type_index type);
+
+}
+
+}
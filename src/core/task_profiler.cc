@@ -0,0 +1,276 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#include <seastar/core/task_profiler.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/print.hh>
+#include <seastar/http/httpd.hh>
+#include <seastar/http/function_handlers.hh>
+#include <seastar/json/formatter.hh>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <map>
+#include <cxxabi.h>
+#include "core/task_profiler-impl.hh"
+
+namespace seastar {
+
+namespace internal {
+
+task_profiler::task_profiler(unsigned period)
+    : _period(period)
+    , _random(std::chrono::steady_clock::now().time_since_epoch().count() | 1) {
+    _countdown = next_countdown();
+}
+
+std::unique_ptr<task_profiler>& task_profiler::local() {
+    return engine()._task_profiler;
+}
+
+void task_profiler::add(unsigned group, const std::type_info& type, std::chrono::nanoseconds runtime) {
+    auto& g = _groups[group];
+    auto i = g.types.find(std::type_index(type));
+    entry* e;
+    if (i != g.types.end()) {
+        e = &i->second;
+    } else if (g.types.size() < max_types_per_group) {
+        e = &g.types[std::type_index(type)];
+    } else {
+        e = &g.others;
+    }
+    e->samples++;
+    e->tasks += _period;
+    e->runtime += runtime * _period;
+}
+
+sstring task_type_name(std::type_index type) {
+    int status;
+    std::unique_ptr<char[], void (*)(void*)> demangled(abi::__cxa_demangle(type.name(), 0, 0, &status), std::free);
+    sstring name = demangled ? demangled.get() : type.name();
+    auto lambda = name.find("{lambda(");
+    if (lambda == sstring::npos) {
+        return name;
+    }
+    // Back to the start of the qualified name of the lambda, i.e. to the
+    // bracket or separator that encloses it
+    size_t begin = lambda;
+    int depth = 0;
+    while (begin > 0) {
+        auto c = name[begin - 1];
+        if (c == ')' || c == '>' || c == '}') {
+            depth++;
+        } else if (c == '(' || c == '<' || c == '{') {
+            if (!depth) {
+                break;
+            }
+            depth--;
+        } else if ((c == ',' || c == ' ') && !depth) {
+            break;
+        }
+        begin--;
+    }
+    // And forward to its end, past lambdas nested in it
+    size_t end = lambda;
+    depth = 0;
+    for (; end < name.size(); end++) {
+        auto c = name[end];
+        if (c == '(' || c == '<' || c == '{') {
+            depth++;
+        } else if (c == ')' || c == '>' || c == '}') {
+            if (!depth) {
+                break;
+            }
+            depth--;
+        } else if (c == ',' && !depth) {
+            break;
+        }
+    }
+    return name.substr(begin, end - begin);
+}
+
+}
+
+void set_task_profiler_sample_period(unsigned period) {
+    auto& profiler = internal::task_profiler::local();
+    if (!period) {
+        profiler.reset();
+    } else if (profiler) {
+        profiler->set_period(period);
+    } else {
+        profiler = std::make_unique<internal::task_profiler>(period);
+    }
+}
+
+void reset_task_profile() {
+    if (auto& profiler = internal::task_profiler::local()) {
+        profiler->reset();
+    }
+}
+
+namespace {
+
+task_profile_entry make_entry(sstring name, const internal::task_profiler::entry& e) {
+    task_profile_entry r;
+    r.task_type = std::move(name);
+    r.samples = e.samples;
+    r.tasks = e.tasks;
+    r.runtime = e.runtime;
+    return r;
+}
+
+void add_to(task_profile_entry& to, const task_profile_entry& e) {
+    to.samples += e.samples;
+    to.tasks += e.tasks;
+    to.runtime += e.runtime;
+}
+
+void sort_and_trim(std::vector<task_profile_entry>& entries, size_t top_n) {
+    std::sort(entries.begin(), entries.end(), [] (const task_profile_entry& a, const task_profile_entry& b) {
+        return a.runtime > b.runtime;
+    });
+    if (entries.size() > top_n) {
+        entries.resize(top_n);
+    }
+}
+
+// This shard's profile, with all the task types when top_n is 0
+std::vector<task_profile_group> local_profile(size_t top_n) {
+    std::vector<task_profile_group> ret;
+    auto& profiler = internal::task_profiler::local();
+    if (!profiler) {
+        return ret;
+    }
+    auto& groups = profiler->groups();
+    for (unsigned i = 0; i < groups.size(); i++) {
+        auto& g = groups[i];
+        auto sg = internal::scheduling_group_from_index(i);
+        if ((g.types.empty() && !g.others.samples) || !sg.active()) {
+            continue;
+        }
+        task_profile_group pg;
+        pg.scheduling_group = sg.name();
+        // Different types may get the same short name
+        std::map<sstring, task_profile_entry> by_name;
+        for (auto& t : g.types) {
+            auto name = internal::task_type_name(t.first);
+            auto e = make_entry(name, t.second);
+            auto j = by_name.emplace(name, e);
+            if (!j.second) {
+                add_to(j.first->second, e);
+            }
+        }
+        if (g.others.samples) {
+            by_name.emplace("(other task types)", make_entry("(other task types)", g.others));
+        }
+        for (auto& e : by_name) {
+            pg.tasks += e.second.tasks;
+            pg.runtime += e.second.runtime;
+            pg.top.push_back(std::move(e.second));
+        }
+        if (top_n) {
+            sort_and_trim(pg.top, top_n);
+        }
+        ret.push_back(std::move(pg));
+    }
+    return ret;
+}
+
+sstring to_json(const std::vector<task_profile_group>& profile) {
+    using json::formatter;
+    auto ms = [] (std::chrono::nanoseconds d) {
+        return formatter::to_json(std::chrono::duration<double, std::milli>(d).count());
+    };
+    sstring out = "[";
+    for (unsigned i = 0; i < profile.size(); i++) {
+        auto& g = profile[i];
+        out += format("{}{{\"scheduling_group\": {}, \"tasks\": {}, \"runtime_ms\": {}, \"top\": [",
+                i ? ", " : "", formatter::to_json(g.scheduling_group), g.tasks, ms(g.runtime));
+        for (unsigned j = 0; j < g.top.size(); j++) {
+            auto& e = g.top[j];
+            out += format("{}{{\"task_type\": {}, \"samples\": {}, \"tasks\": {}, \"runtime_ms\": {}}}",
+                    j ? ", " : "", formatter::to_json(e.task_type), e.samples, e.tasks, ms(e.runtime));
+        }
+        out += "]}";
+    }
+    out += "]";
+    return out;
+}
+
+}
+
+std::vector<task_profile_group> get_task_profile(size_t top_n) {
+    return local_profile(top_n);
+}
+
+future<std::vector<task_profile_group>> collect_task_profile(size_t top_n) {
+    using profile = std::vector<task_profile_group>;
+    return map_reduce(smp::all_cpus().begin(), smp::all_cpus().end(), [] (unsigned shard) {
+        return smp::submit_to(shard, [] {
+            return local_profile(0);
+        });
+    }, profile(), [] (profile acc, profile p) {
+        for (auto& g : p) {
+            auto i = std::find_if(acc.begin(), acc.end(), [&g] (const task_profile_group& a) {
+                return a.scheduling_group == g.scheduling_group;
+            });
+            if (i == acc.end()) {
+                acc.push_back(std::move(g));
+                continue;
+            }
+            i->tasks += g.tasks;
+            i->runtime += g.runtime;
+            for (auto& e : g.top) {
+                auto j = std::find_if(i->top.begin(), i->top.end(), [&e] (const task_profile_entry& a) {
+                    return a.task_type == e.task_type;
+                });
+                if (j == i->top.end()) {
+                    i->top.push_back(std::move(e));
+                } else {
+                    add_to(*j, e);
+                }
+            }
+        }
+        return acc;
+    }).then([top_n] (profile p) {
+        for (auto& g : p) {
+            sort_and_trim(g.top, top_n);
+        }
+        return p;
+    });
+}
+
+void add_task_profile_route(httpd::http_server& server, sstring path) {
+    httpd::future_handler_function handler = [] (std::unique_ptr<httpd::request> req, std::unique_ptr<httpd::reply> rep) {
+        size_t top_n = 20;
+        auto top = req->get_query_param("top");
+        if (!top.empty()) {
+            top_n = boost::lexical_cast<size_t>(top);
+        }
+        return collect_task_profile(top_n).then([rep = std::move(rep)] (std::vector<task_profile_group> profile) mutable {
+            rep->write_body("json", to_json(profile));
+            return std::move(rep);
+        });
+    };
+    server._routes.put(httpd::GET, path, new httpd::function_handler(handler, "json"));
+}
+
+}
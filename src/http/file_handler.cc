@@ -88,11 +88,13 @@ future<std::unique_ptr<reply>> file_interaction_handler::read(
         return do_with(output_stream<char>(get_stream(std::move(req), extension, std::move(s))),
                 [file_name] (output_stream<char>& os) {
             return open_file_dma(file_name, open_flags::ro).then([&os] (file f) {
-                return do_with(input_stream<char>(make_file_input_stream(std::move(f))), [&os](input_stream<char>& is) {
-                    return copy(is, os).then([&os] {
+                return do_with(std::move(f), [&os] (file& f) {
+                    return f.size().then([&os, &f] (uint64_t size) {
+                        return os.write_file(f, 0, size, default_priority_class());
+                    }).then([&os] {
                         return os.close();
-                    }).then([&is] {
-                        return is.close();
+                    }).finally([&f] {
+                        return f.close();
                     });
                 });
             });
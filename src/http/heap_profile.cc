@@ -0,0 +1,78 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#include <seastar/http/heap_profile.hh>
+#include <seastar/http/exception.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/reactor.hh>
+#include <boost/lexical_cast.hpp>
+#include <boost/range/irange.hpp>
+#include <sstream>
+
+namespace seastar {
+
+namespace httpd {
+
+future<std::unique_ptr<reply>> heap_profile_handler::handle(const sstring& path,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    auto first = 0u;
+    auto last = smp::count;
+    auto shard = req->get_query_param("shard");
+    if (!shard.empty()) {
+        try {
+            first = boost::lexical_cast<unsigned>(shard);
+        } catch (boost::bad_lexical_cast&) {
+            throw bad_param_exception("shard must be a number");
+        }
+        if (first >= smp::count) {
+            throw bad_param_exception("no such shard");
+        }
+        last = first + 1;
+    }
+    auto profiles = make_lw_shared<std::vector<memory::sampled_heap_profile>>(last - first);
+    return parallel_for_each(boost::irange(first, last), [profiles, first] (unsigned c) {
+        return smp::submit_to(c, [] {
+            return memory::get_sampled_heap_profile();
+        }).then([profiles, idx = c - first] (memory::sampled_heap_profile p) {
+            (*profiles)[idx] = std::move(p);
+        });
+    }).then([profiles, rep = std::move(rep)] () mutable {
+        std::ostringstream os;
+        memory::write_pprof_heap_profile(os, *profiles);
+        rep->write_body("txt", sstring(os.str()));
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    });
+}
+
+future<> add_heap_profile_routes(http_server& server, sstring path) {
+    server._routes.put(GET, path, new heap_profile_handler());
+    return make_ready_future<>();
+}
+
+future<> add_heap_profile_routes(distributed<http_server>& server, sstring path) {
+    return server.invoke_on_all([path] (http_server& s) {
+        return add_heap_profile_routes(s, path);
+    });
+}
+
+}
+
+}
@@ -124,6 +124,18 @@ class http_chunked_data_sink_impl : public data_sink_impl {
             return _out.write("\r\n", 2);
         });
     }
+    virtual future<> put_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc) override {
+        if (len == 0) {
+            return make_ready_future<>();
+        }
+        // One chunk for the whole range, so the connection's sink can send
+        // the file's contents without copying them.
+        return write_size(len).then([this, &f, pos, len, &pc] {
+            return _out.write_file(f, pos, len, pc);
+        }).then([this] {
+            return _out.write("\r\n", 2);
+        });
+    }
     virtual future<> close() override {
         return  make_ready_future<>();
     }
@@ -22,6 +22,7 @@
 #include <random>
 
 #include <linux/if.h>
+#include <linux/errqueue.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <net/route.h>
@@ -31,8 +32,11 @@
 #include <seastar/net/packet.hh>
 #include <seastar/net/api.hh>
 #include <seastar/net/inet_address.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/future-util.hh>
 #include <seastar/util/std-compat.hh>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <netinet/sctp.h>
 
 namespace std {
@@ -65,6 +69,9 @@ class posix_connected_socket_operations {
     virtual keepalive_params get_keepalive_parameters(file_desc& _fd) const = 0;
 };
 
+// Value of --zero-copy-send-threshold for this shard; 0 disables zero-copy send.
+static thread_local size_t zero_copy_send_threshold = 0;
+
 thread_local posix_ap_server_socket_impl::sockets_map_t posix_ap_server_socket_impl::sockets{};
 thread_local posix_ap_server_socket_impl::conn_map_t posix_ap_server_socket_impl::conn_q{};
 
@@ -187,7 +194,7 @@ class posix_connected_socket_impl final : public connected_socket_impl {
         return data_source(std::make_unique< posix_data_source_impl>(_fd, _allocator));
     }
     virtual data_sink sink() override {
-        return data_sink(std::make_unique< posix_data_sink_impl>(_fd));
+        return data_sink(std::make_unique< posix_data_sink_impl>(_fd, zero_copy_send_threshold));
     }
     virtual void shutdown_input() override {
         _fd->shutdown(SHUT_RD);
@@ -537,11 +544,9 @@ posix_ap_server_socket_impl::move_connected_socket(int protocol, socket_address
 
 future<temporary_buffer<char>>
 posix_data_source_impl::get() {
-    return _fd->read_some(_buf.get_write(), _buf_size).then([this] (size_t size) {
-        _buf.trim(size);
-        auto ret = std::move(_buf);
+    // The read owns the buffer until it completes
+    return _fd->read_some(std::move(_buf)).finally([this] {
         _buf = make_temporary_buffer<char>(_buffer_allocator, _buf_size);
-        return make_ready_future<temporary_buffer<char>>(std::move(ret));
     });
 }
 
@@ -568,23 +573,217 @@ std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
     return v;
 }
 
+future<>
+posix_data_sink_impl::zero_copy_state::send_some(packet p, uint32_t first_seq, uint32_t nr_seqs) {
+    auto fd = _fd->get_file_desc().get();
+    auto flags = MSG_NOSIGNAL | MSG_ZEROCOPY;
+    while (p.len()) {
+        msghdr mh = {};
+        mh.msg_iov = reinterpret_cast<iovec*>(p.fragment_array());
+        mh.msg_iovlen = std::min<size_t>(p.nr_frags(), IOV_MAX);
+        auto r = ::sendmsg(fd, &mh, flags);
+        if (r == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return _fd->writeable().then_wrapped([self = shared_from_this(), p = std::move(p), first_seq, nr_seqs] (future<> f) mutable {
+                    if (f.failed()) {
+                        self->retire(std::move(p), first_seq, nr_seqs);
+                        return f;
+                    }
+                    return self->send_some(std::move(p), first_seq, nr_seqs);
+                });
+            }
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                // Out of option memory for notifications, copy this chunk.
+                flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+            auto e = errno;
+            retire(std::move(p), first_seq, nr_seqs);
+            return make_exception_future<>(std::system_error(e, std::system_category(), "sendmsg"));
+        }
+        if (flags & MSG_ZEROCOPY) {
+            ++_next_seq;
+            ++nr_seqs;
+        }
+        flags |= MSG_ZEROCOPY;
+        p.trim_front(r);
+    }
+    retire(std::move(p), first_seq, nr_seqs);
+    return make_ready_future<>();
+}
+
+void
+posix_data_sink_impl::zero_copy_state::retire(packet p, uint32_t first_seq, uint32_t nr_seqs) {
+    if (!nr_seqs) {
+        return;
+    }
+    // The trimmed packet still owns the memory of the fragments sent.
+    _in_flight.push_back(in_flight{first_seq, nr_seqs, nr_seqs, std::move(p)});
+    maybe_start_reaper();
+}
+
+void
+posix_data_sink_impl::zero_copy_state::complete(uint32_t lo, uint32_t hi) {
+    for (auto& f : _in_flight) {
+        auto a = std::max<int64_t>(int32_t(lo - f.first_seq), 0);
+        auto b = std::min<int64_t>(int32_t(hi - f.first_seq), f.nr_seqs - 1);
+        if (a <= b) {
+            f.outstanding -= b - a + 1;
+            if (!f.outstanding) {
+                f.p.reset();
+            }
+        }
+    }
+    while (!_in_flight.empty() && !_in_flight.front().outstanding) {
+        _in_flight.pop_front();
+    }
+}
+
+bool
+posix_data_sink_impl::zero_copy_state::reap() noexcept {
+    auto fd = _fd->get_file_desc().get();
+    bool reaped = false;
+    for (;;) {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+        msghdr mh = {};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            return reaped;
+        }
+        reaped = true;
+        for (auto cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            sock_extended_err serr;
+            std::memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr.ee_errno) {
+                continue;
+            }
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // The device can't transmit from user memory (e.g. loopback),
+                // so zero-copy only adds notification overhead.
+                _kernel_copies = true;
+            }
+            complete(serr.ee_info, serr.ee_data);
+        }
+    }
+}
+
+future<>
+posix_data_sink_impl::zero_copy_state::wait_for_notification() {
+    // A pending notification raises POLLERR on the socket. The socket's own
+    // readiness also reports unread data and EOF, so watch it through a
+    // private epoll instance that is only interested in errors: it becomes
+    // readable when a notification is queued, and nothing else.
+    if (!_errqueue_fd) {
+        try {
+            auto epfd = file_desc::epoll_create(EPOLL_CLOEXEC);
+            ::epoll_event evt = {};
+            evt.events = EPOLLET; // EPOLLERR and EPOLLHUP are always reported
+            auto r = ::epoll_ctl(epfd.get(), EPOLL_CTL_ADD, _fd->get_file_desc().get(), &evt);
+            throw_system_error_on(r == -1, "epoll_ctl");
+            _errqueue_fd = pollable_fd(std::move(epfd));
+        } catch (...) {
+            // send() still reaps, and restarts the reaper.
+            return make_exception_future<>(std::current_exception());
+        }
+    }
+    return _errqueue_fd->readable().then([this] {
+        // Consume the edge, so the instance waits for the next notification.
+        ::epoll_event evt;
+        ::epoll_wait(_errqueue_fd->get_file_desc().get(), &evt, 1, 0);
+        reap();
+    });
+}
+
+void
+posix_data_sink_impl::zero_copy_state::maybe_start_reaper() {
+    if (_reaping) {
+        return;
+    }
+    _reaping = true;
+    (void)do_until([this] { return _in_flight.empty(); }, [this] {
+        return wait_for_notification();
+    }).finally([self = shared_from_this()] {
+        self->_reaping = false;
+    });
+}
+
+posix_data_sink_impl::posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd, size_t zero_copy_threshold) : _fd(std::move(fd)) {
+    if (zero_copy_threshold) {
+        try {
+            _fd->get_file_desc().setsockopt(SOL_SOCKET, SO_ZEROCOPY, 1);
+            _zc = make_lw_shared<zero_copy_state>(_fd, zero_copy_threshold);
+        } catch (std::system_error&) {
+            // Not supported by the kernel or the socket type (e.g. AF_UNIX); copy.
+        }
+    }
+}
+
 future<>
 posix_data_sink_impl::put(temporary_buffer<char> buf) {
+    if (_zc && _zc->wants(buf.size())) {
+        return put(packet(std::move(buf)));
+    }
     return _fd->write_all(buf.get(), buf.size()).then([d = buf.release()] {});
 }
 
 future<>
 posix_data_sink_impl::put(packet p) {
+    if (_zc && _zc->wants(p.len())) {
+        return _zc->send(std::move(p));
+    }
     _p = std::move(p);
     return _fd->write_all(_p).then([this] { _p.reset(); });
 }
 
+future<>
+posix_data_sink_impl::put_file(const file& f, uint64_t pos, uint64_t len, const io_priority_class& pc) {
+    if (!engine().can_sendfile(f)) {
+        return data_sink_impl::put_file(f, pos, len, pc);
+    }
+    static constexpr uint64_t chunk_size = 128 * 1024;
+    return do_with(pos, len, [this, &f, &pc] (uint64_t& pos, uint64_t& len) {
+        return do_until([&len] { return len == 0; }, [this, &f, &pc, &pos, &len] {
+            return _fd->writeable().then([this, &f, &pc, &pos, &len] {
+                return engine().sendfile(_fd->get_file_desc().get(), f, pos, std::min(len, chunk_size), pc);
+            }).then_wrapped([&pos, &len] (future<size_t> fut) {
+                size_t n;
+                try {
+                    n = fut.get0();
+                } catch (std::system_error& e) {
+                    if (e.code().value() != EAGAIN) {
+                        throw;
+                    }
+                    // Spurious wakeup, e.g. EPOLLERR from a zero-copy completion
+                    return;
+                }
+                if (!n) {
+                    throw file::eof_error();
+                }
+                pos += n;
+                len -= n;
+            });
+        });
+    });
+}
+
 future<>
 posix_data_sink_impl::close() {
     _fd->shutdown(SHUT_WR);
     return make_ready_future<>();
 }
 
+posix_network_stack::posix_network_stack(boost::program_options::variables_map opts, compat::polymorphic_allocator<char>* allocator)
+        : _reuseport(engine().posix_reuseport_available()), _allocator(allocator) {
+    if (opts.count("zero-copy-send-threshold")) {
+        zero_copy_send_threshold = opts["zero-copy-send-threshold"].as<size_t>();
+    }
+}
+
 server_socket
 posix_network_stack::listen(socket_address sa, listen_options opt) {
     using server_socket = seastar::api_v2::server_socket;
@@ -623,39 +822,83 @@ posix_ap_network_stack::listen(socket_address sa, listen_options opt) {
         server_socket(std::make_unique<posix_ap_server_socket_impl>(protocol, sa, _allocator));
 }
 
-struct cmsg_with_pktinfo {
-    struct cmsghdrcmh;
-    union {
-        struct in_pktinfo pktinfo;
-        struct in6_pktinfo pkt6info;
-    };
-};
-
 class posix_udp_channel : public udp_channel_impl {
 private:
     static constexpr int MAX_DATAGRAM_SIZE = 65507;
+    // Datagrams fetched by one recvmmsg() call.
+    static constexpr unsigned recv_batch_size = 16;
+    // Smaller datagrams are copied out of the receive buffer, larger ones
+    // take it over (and the slot gets a new one).
+    static constexpr size_t recv_copy_threshold = 2048;
+    // Limits of a single UDP GSO send (UDP_MAX_SEGMENTS in the kernel).
+    static constexpr unsigned max_gso_segments = 64;
+    static constexpr size_t max_gso_size = 65000;
+    // The kernel fails a GSO send whose segments don't fit the route's MTU,
+    // which an unconnected socket can't query. Only use GSO for segments
+    // that fit an Ethernet MTU (1500) after IPv6 and UDP headers.
+    static constexpr size_t max_gso_segment_size = 1500 - 40 - 8;
+    // Room for the IP_PKTINFO/IPV6_PKTINFO and UDP_GRO control messages.
+    union recv_cmsg {
+        char buf[CMSG_SPACE(sizeof(in6_pktinfo)) + CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    };
+    union gso_cmsg {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr align;
+    };
+    // Ring of receive buffers, MAX_DATAGRAM_SIZE each, and the datagrams
+    // already received but not yet handed out. Only _nr_slots buffers are
+    // used; that grows while batches come back full, and shrinks back once
+    // they use a quarter of it or less, so a socket holds recv_batch_size
+    // buffers only during a burst.
     struct recv_ctx {
-        struct msghdr _hdr;
-        struct iovec _iov;
-        socket_address _src_addr;
-        char* _buffer;
-        cmsg_with_pktinfo _cmsg;
-
-        recv_ctx() {
-            memset(&_hdr, 0, sizeof(_hdr));
-            _hdr.msg_iov = &_iov;
-            _hdr.msg_iovlen = 1;
-            _hdr.msg_name = &_src_addr.u.sa;
-            _hdr.msg_namelen = sizeof(_src_addr.u.sas);
-            memset(&_cmsg, 0, sizeof(_cmsg));
-            _hdr.msg_control = &_cmsg;
-            _hdr.msg_controllen = sizeof(_cmsg);
+        std::array<mmsghdr, recv_batch_size> _msgs;
+        std::array<iovec, recv_batch_size> _iovs;
+        std::array<socket_address, recv_batch_size> _src_addrs;
+        std::array<recv_cmsg, recv_batch_size> _cmsgs;
+        std::array<char*, recv_batch_size> _buffers{};
+        circular_buffer<udp_datagram> _ready;
+        unsigned _nr_slots = 1;
+        // The last batch was full, so more datagrams are probably queued.
+        bool _more = false;
+
+        recv_ctx() = default;
+        recv_ctx(const recv_ctx&) = delete;
+        ~recv_ctx() {
+            for (auto b : _buffers) {
+                delete[] b;
+            }
         }
 
         void prepare() {
-            _buffer = new char[MAX_DATAGRAM_SIZE];
-            _iov.iov_base = _buffer;
-            _iov.iov_len = MAX_DATAGRAM_SIZE;
+            for (unsigned i = 0; i < _nr_slots; ++i) {
+                if (!_buffers[i]) {
+                    _buffers[i] = new char[MAX_DATAGRAM_SIZE];
+                }
+                _iovs[i].iov_base = _buffers[i];
+                _iovs[i].iov_len = MAX_DATAGRAM_SIZE;
+                auto& hdr = _msgs[i].msg_hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.msg_iov = &_iovs[i];
+                hdr.msg_iovlen = 1;
+                hdr.msg_name = &_src_addrs[i].u.sa;
+                hdr.msg_namelen = sizeof(_src_addrs[i].u.sas);
+                hdr.msg_control = &_cmsgs[i];
+                hdr.msg_controllen = sizeof(_cmsgs[i]);
+                _msgs[i].msg_len = 0;
+            }
+        }
+        // Adapts _nr_slots to a batch of n datagrams.
+        void resize(unsigned n) {
+            if (n == _nr_slots) {
+                _nr_slots = std::min(_nr_slots * 2, unsigned(recv_batch_size));
+            } else if (n * 4 <= _nr_slots) {
+                _nr_slots = std::max(_nr_slots / 2, 1u);
+                for (unsigned i = _nr_slots; i < recv_batch_size; ++i) {
+                    delete[] _buffers[i];
+                    _buffers[i] = nullptr;
+                }
+            }
         }
     };
     struct send_ctx {
@@ -679,11 +922,30 @@ class posix_udp_channel : public udp_channel_impl {
             resolve_outgoing_address(_dst);
         }
     };
+    // A send_batch() in progress: one mmsghdr per run of datagrams that
+    // go out together.
+    struct send_batch_ctx {
+        std::vector<std::pair<socket_address, packet>> _datagrams;
+        std::vector<mmsghdr> _msgs;
+        std::vector<iovec> _iovecs;
+        std::vector<gso_cmsg> _cmsgs;
+        // Index in _datagrams of the first datagram of each message.
+        std::vector<size_t> _first;
+
+        explicit send_batch_ctx(std::vector<std::pair<socket_address, packet>> datagrams)
+            : _datagrams(std::move(datagrams)) {
+            for (auto& d : _datagrams) {
+                resolve_outgoing_address(d.first);
+            }
+        }
+        void prepare(size_t from, bool gso);
+    };
     std::unique_ptr<pollable_fd> _fd;
     socket_address _address;
     recv_ctx _recv;
     send_ctx _send;
     bool _closed;
+    bool _gso = false;
 public:
     posix_udp_channel(const socket_address& bind_address)
             : _closed(false) {
@@ -693,6 +955,10 @@ class posix_udp_channel : public udp_channel_impl {
         if (engine().posix_reuseport_available()) {
             fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
         }
+        // Segmentation offload needs Linux 4.18 (send) and 5.0 (receive).
+        int zero = 0, one = 1;
+        _gso = ::setsockopt(fd.get(), SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+        ::setsockopt(fd.get(), SOL_UDP, UDP_GRO, &one, sizeof(one));
         fd.bind(sa.u.sa, sizeof(sa.u.sas));
         _address = fd.get_address();
         _fd = std::make_unique<pollable_fd>(std::move(fd));
@@ -701,6 +967,7 @@ class posix_udp_channel : public udp_channel_impl {
     virtual future<udp_datagram> receive() override;
     virtual future<> send(const socket_address& dst, const char *msg) override;
     virtual future<> send(const socket_address& dst, packet p) override;
+    virtual future<> send_batch(std::vector<std::pair<socket_address, packet>> datagrams) override;
     virtual void shutdown_input() override {
         _fd->abort_reader();
     }
@@ -716,6 +983,10 @@ class posix_udp_channel : public udp_channel_impl {
         assert(_address.u.sas.ss_family != AF_INET6 || (_address.addr_length > 20));
         return _address;
     }
+private:
+    void receive_batch();
+    void deliver(unsigned slot);
+    future<> send_messages(lw_shared_ptr<send_batch_ctx> ctx, size_t from);
 };
 
 future<> posix_udp_channel::send(const socket_address& dst, const char *message) {
@@ -767,28 +1038,192 @@ class posix_datagram : public udp_datagram_impl {
 
 future<udp_datagram>
 posix_udp_channel::receive() {
+    if (!_recv._ready.empty()) {
+        auto d = std::move(_recv._ready.front());
+        _recv._ready.pop_front();
+        return make_ready_future<udp_datagram>(std::move(d));
+    }
+    // Only try before polling if the last batch suggests more are queued;
+    // a request-response workload would mostly pay for a failed recvmmsg().
+    auto ready = _recv._more ? make_ready_future<>() : _fd->readable();
+    return ready.then([this] {
+        receive_batch();
+        return receive();
+    });
+}
+
+void
+posix_udp_channel::receive_batch() {
     _recv.prepare();
-    return _fd->recvmsg(&_recv._hdr).then([this] (size_t size) {
-        socket_address dst;
-        for (auto* cmsg = CMSG_FIRSTHDR(&_recv._hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&_recv._hdr, cmsg)) {
-            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
-                dst = ipv4_addr(reinterpret_cast<const in_pktinfo*>(CMSG_DATA(cmsg))->ipi_addr, _address.port());
-                break;
-            } else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
-                dst = ipv6_addr(reinterpret_cast<const in6_pktinfo*>(CMSG_DATA(cmsg))->ipi6_addr, _address.port());
-                break;
+    auto n = ::recvmmsg(_fd->get_file_desc().get(), _recv._msgs.data(), _recv._nr_slots, MSG_DONTWAIT, nullptr);
+    if (n == -1) {
+        _recv._more = false;
+        throw_system_error_on(errno != EAGAIN && errno != EWOULDBLOCK, "recvmmsg");
+        return;
+    }
+    _recv._more = unsigned(n) == _recv._nr_slots;
+    for (int i = 0; i < n; ++i) {
+        deliver(i);
+    }
+    // After deliver(), which may hand the buffers over to the datagrams
+    _recv.resize(n);
+}
+
+void
+posix_udp_channel::deliver(unsigned slot) {
+    auto& hdr = _recv._msgs[slot].msg_hdr;
+    size_t size = _recv._msgs[slot].msg_len;
+    size_t segment_size = size;
+    socket_address dst;
+    for (auto* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            dst = ipv4_addr(reinterpret_cast<const in_pktinfo*>(CMSG_DATA(cmsg))->ipi_addr, _address.port());
+        } else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+            dst = ipv6_addr(reinterpret_cast<const in6_pktinfo*>(CMSG_DATA(cmsg))->ipi6_addr, _address.port());
+        } else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            // Several datagrams from the same source, coalesced by GRO
+            int gso_size;
+            memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+            segment_size = gso_size;
+        }
+    }
+    if (hdr.msg_flags & MSG_TRUNC) {
+        // Only a GRO batch can outgrow the buffer. Its segments are all
+        // segment_size long except the last, so the whole ones that fit are
+        // intact; drop the rest.
+        if (segment_size >= size || !segment_size) {
+            return;
+        }
+        size -= size % segment_size;
+    }
+    auto buf = _recv._buffers[slot];
+    auto p = size <= recv_copy_threshold
+            ? packet(buf, size)
+            : packet(fragment{buf, size}, make_deleter([buf] { delete[] buf; }));
+    if (size > recv_copy_threshold) {
+        _recv._buffers[slot] = nullptr;
+    }
+    auto& src = _recv._src_addrs[slot];
+    if (segment_size >= size || !segment_size) {
+        _recv._ready.emplace_back(std::make_unique<posix_datagram>(src, dst, std::move(p)));
+        return;
+    }
+    for (size_t off = 0; off < size; off += segment_size) {
+        _recv._ready.emplace_back(std::make_unique<posix_datagram>(src, dst, p.share(off, std::min(segment_size, size - off))));
+    }
+}
+
+// Lays out datagrams [_first-of-message from, end) as mmsghdrs. With gso,
+// a run of datagrams to the same destination whose sizes are all equal
+// (except for a shorter last one) becomes a single message that the kernel
+// splits back along the UDP_SEGMENT size.
+void
+posix_udp_channel::send_batch_ctx::prepare(size_t from, bool gso) {
+    size_t nr_frags = 0;
+    for (size_t i = from; i < _datagrams.size(); ++i) {
+        nr_frags += _datagrams[i].second.nr_frags();
+    }
+    _msgs.clear();
+    _iovecs.clear();
+    _cmsgs.clear();
+    _first.clear();
+    // Reserve up front, the headers point into these
+    _msgs.reserve(_datagrams.size() - from);
+    _iovecs.reserve(nr_frags);
+    _cmsgs.reserve(_datagrams.size() - from);
+    for (size_t i = from; i < _datagrams.size();) {
+        auto& dst = _datagrams[i].first;
+        auto seg = _datagrams[i].second.len();
+        auto end = i + 1;
+        auto total = seg;
+        if (gso && seg && seg <= max_gso_segment_size) {
+            while (end < _datagrams.size()
+                    && end - i < max_gso_segments
+                    && _datagrams[end].first == dst
+                    && _datagrams[end].second.len()
+                    && _datagrams[end].second.len() <= seg
+                    && total + _datagrams[end].second.len() <= max_gso_size) {
+                total += _datagrams[end].second.len();
+                if (_datagrams[end++].second.len() < seg) {
+                    break;
+                }
             }
         }
-        return make_ready_future<udp_datagram>(udp_datagram(std::make_unique<posix_datagram>(
-            _recv._src_addr, dst, packet(fragment{_recv._buffer, size}, make_deleter([buf = _recv._buffer] { delete[] buf; })))));
-    }).handle_exception([p = _recv._buffer](auto ep) {
-        delete[] p;
-        return make_exception_future<udp_datagram>(std::move(ep));
-    });
+        auto first_iov = _iovecs.size();
+        for (auto j = i; j < end; ++j) {
+            for (auto& f : _datagrams[j].second.fragments()) {
+                _iovecs.push_back({f.base, f.size});
+            }
+        }
+        mmsghdr m;
+        memset(&m, 0, sizeof(m));
+        m.msg_hdr.msg_name = &dst.u.sa;
+        m.msg_hdr.msg_namelen = sizeof(dst.u.sas);
+        m.msg_hdr.msg_iov = &_iovecs[first_iov];
+        m.msg_hdr.msg_iovlen = _iovecs.size() - first_iov;
+        if (end - i > 1) {
+            _cmsgs.emplace_back();
+            auto& c = _cmsgs.back();
+            memset(&c, 0, sizeof(c));
+            m.msg_hdr.msg_control = c.buf;
+            m.msg_hdr.msg_controllen = sizeof(c.buf);
+            auto cm = CMSG_FIRSTHDR(&m.msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg16 = seg;
+            memcpy(CMSG_DATA(cm), &seg16, sizeof(seg16));
+        }
+        _msgs.push_back(m);
+        _first.push_back(i);
+        i = end;
+    }
+}
+
+future<>
+posix_udp_channel::send_batch(std::vector<std::pair<socket_address, packet>> datagrams) {
+    if (datagrams.empty()) {
+        return make_ready_future<>();
+    }
+    auto ctx = make_lw_shared<send_batch_ctx>(std::move(datagrams));
+    ctx->prepare(0, _gso);
+    return send_messages(std::move(ctx), 0);
+}
+
+future<>
+posix_udp_channel::send_messages(lw_shared_ptr<send_batch_ctx> ctx, size_t from) {
+    auto fd = _fd->get_file_desc().get();
+    while (from < ctx->_msgs.size()) {
+        auto n = ::sendmmsg(fd, &ctx->_msgs[from], ctx->_msgs.size() - from, 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return _fd->writeable().then([this, ctx = std::move(ctx), from] () mutable {
+                    return send_messages(std::move(ctx), from);
+                });
+            }
+            if ((errno == EIO || errno == EINVAL) && ctx->_msgs[from].msg_hdr.msg_control) {
+                // The route can't take segmentation offload (e.g. no
+                // checksum offload, or an MTU below the segment size);
+                // stop using it on this channel.
+                _gso = false;
+                ctx->prepare(ctx->_first[from], false);
+                from = 0;
+                continue;
+            }
+            return make_exception_future<>(std::system_error(errno, std::system_category(), "sendmmsg"));
+        }
+        from += n;
+    }
+    return make_ready_future<>();
 }
 
 void register_posix_stack() {
-    register_network_stack("posix", boost::program_options::options_description(),
+    boost::program_options::options_description opts;
+    opts.add_options()
+        ("zero-copy-send-threshold", boost::program_options::value<size_t>()->default_value(0),
+                "Send packets of at least this many bytes over TCP with MSG_ZEROCOPY (posix stack only; 0 to disable)")
+        ;
+    register_network_stack("posix", opts,
         [](boost::program_options::variables_map ops) {
             return smp::main_thread() ? posix_network_stack::create(ops)
                                       : posix_ap_network_stack::create(ops);
@@ -53,6 +53,18 @@ future<> net::udp_channel::send(const socket_address& dst, packet p) {
     return _impl->send(dst, std::move(p));
 }
 
+future<> net::udp_channel::send_batch(std::vector<std::pair<socket_address, packet>> datagrams) {
+    return _impl->send_batch(std::move(datagrams));
+}
+
+future<> net::udp_channel_impl::send_batch(std::vector<std::pair<socket_address, packet>> datagrams) {
+    return do_with(std::move(datagrams), [this] (std::vector<std::pair<socket_address, packet>>& datagrams) {
+        return do_for_each(datagrams, [this] (std::pair<socket_address, packet>& d) {
+            return send(d.first, std::move(d.second));
+        });
+    });
+}
+
 bool net::udp_channel::is_closed() const {
     return _impl->is_closed();
 }
@@ -0,0 +1,87 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+// Creates, stats, renames and removes many files, the way a storage engine
+// churns through its data files. Run with --async-metadata=0 to compare
+// with the syscall thread.
+
+#include <seastar/core/reactor.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/app-template.hh>
+#include <seastar/core/print.hh>
+#include <boost/range/irange.hpp>
+#include <fmt/printf.h>
+
+using namespace seastar;
+
+int main(int ac, char** av) {
+    app_template at;
+    namespace bpo = boost::program_options;
+    at.add_options()
+            ("directory", bpo::value<sstring>()->default_value("."), "Directory to create the files in")
+            ("files", bpo::value<unsigned>()->default_value(10000), "Number of files to create")
+            ("concurrency", bpo::value<unsigned>()->default_value(16), "Operations to issue in parallel")
+            ;
+    return at.run(ac, av, [&at] {
+        auto dir = at.configuration()["directory"].as<sstring>();
+        auto files = at.configuration()["files"].as<unsigned>();
+        auto concurrency = at.configuration()["concurrency"].as<unsigned>();
+        auto name = [dir] (const char* prefix, unsigned i) {
+            return format("{}/{}-{}-{}.tmp", dir, prefix, engine().cpu_id(), i);
+        };
+        // Runs op on every file, concurrency at a time, and reports the rate
+        auto phase = [=] (const char* what, std::function<future<> (unsigned)> op) {
+            return do_with(semaphore(concurrency), [=] (semaphore& sem) {
+                auto start = std::chrono::steady_clock::now();
+                return parallel_for_each(boost::irange(0u, files), [&sem, op] (unsigned i) {
+                    return with_semaphore(sem, 1, [op, i] {
+                        return op(i);
+                    });
+                }).then([=] {
+                    auto end = std::chrono::steady_clock::now();
+                    using fseconds = std::chrono::duration<float, std::ratio<1, 1>>;
+                    auto ops = files / std::chrono::duration_cast<fseconds>(end - start).count();
+                    fmt::print("{:10} {:10d} {:12.0f}\n", what, files, ops);
+                });
+            });
+        };
+        fmt::print("{:10} {:10} {:12}\n", "operation", "files", "ops/s");
+        return phase("create", [=] (unsigned i) {
+            return open_file_dma(name("a", i), open_flags::wo | open_flags::create | open_flags::exclusive).then([] (file f) {
+                return f.close().finally([f] {});
+            });
+        }).then([=] {
+            return phase("stat", [=] (unsigned i) {
+                return file_stat(name("a", i)).discard_result();
+            });
+        }).then([=] {
+            return phase("rename", [=] (unsigned i) {
+                return rename_file(name("a", i), name("b", i));
+            });
+        }).then([=] {
+            return phase("remove", [=] (unsigned i) {
+                return remove_file(name("b", i));
+            });
+        });
+    });
+}
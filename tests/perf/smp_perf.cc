@@ -0,0 +1,87 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#include <boost/range/irange.hpp>
+
+#include <seastar/core/future-util.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/testing/perf_tests.hh>
+
+// Cross-shard calls from shard 0. With a single shard, they all run locally.
+struct cross_shard {
+    static constexpr size_t batch = 64;
+
+    shard_id other = smp::count - 1;
+    int value = 0;
+};
+
+// One call at a time, measuring the round trip
+PERF_TEST_F(cross_shard, ping_pong)
+{
+    return smp::submit_to(other, [] {
+        return 1;
+    }).then([this] (int v) {
+        value += v;
+        perf_tests::do_not_optimize(value);
+    });
+}
+
+// Many concurrent calls to the same shard, measuring throughput
+PERF_TEST_F(cross_shard, concurrent)
+{
+    return parallel_for_each(boost::irange<size_t>(0, batch), [this] (size_t) {
+        return smp::submit_to(other, [] {});
+    }).then([] {
+        return batch;
+    });
+}
+
+// The same calls, sent as one batch
+PERF_TEST_F(cross_shard, batched)
+{
+    std::vector<noncopyable_function<void ()>> funcs;
+    funcs.reserve(batch);
+    for (size_t i = 0; i < batch; i++) {
+        funcs.emplace_back([] {});
+    }
+    return smp::submit_batch_to(other, smp_submit_to_options(), std::move(funcs)).then([] {
+        return batch;
+    });
+}
+
+// A call to every shard
+PERF_TEST_F(cross_shard, fan_out)
+{
+    return smp::invoke_on_all([] {});
+}
+
+// A call to every shard, collecting the results
+PERF_TEST_F(cross_shard, map_reduce)
+{
+    return map_reduce(smp::all_cpus(), [] (shard_id t) {
+        return smp::submit_to(t, [] {
+            return 1;
+        });
+    }, 0, std::plus<int>()).then([this] (int v) {
+        value += v;
+        perf_tests::do_not_optimize(value);
+    });
+}
@@ -24,6 +24,7 @@
 #include <seastar/core/reactor.hh>
 #include <seastar/core/temporary_buffer.hh>
 #include <vector>
+#include <sstream>
 
 using namespace seastar;
 
@@ -69,6 +70,31 @@ SEASTAR_TEST_CASE(test_live_objects_counter_with_cross_cpu_free) {
     });
 }
 
+SEASTAR_TEST_CASE(test_cross_cpu_frees_are_batched) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    return smp::submit_to(1, [] {
+        auto ret = std::vector<std::unique_ptr<int>>(100000);
+        for (auto& o : ret) {
+            o = std::make_unique<int>(0);
+        }
+        return ret;
+    }).then([] (auto&& vec) {
+        auto before = memory::stats();
+        vec.clear(); // cause cross-cpu free
+        auto after = memory::stats();
+        auto frees = after.cross_cpu_frees() - before.cross_cpu_frees();
+        auto batches = after.cross_cpu_free_batches() - before.cross_cpu_free_batches();
+        BOOST_REQUIRE_EQUAL(frees, 100000);
+        BOOST_REQUIRE_LE(batches * 10, frees);
+    });
+#else
+    return make_ready_future<>();
+#endif
+}
+
 SEASTAR_TEST_CASE(test_aligned_alloc) {
     for (size_t align = sizeof(void*); align <= 65536; align <<= 1) {
         for (size_t size = align; size <= align * 2; size <<= 1) {
@@ -94,3 +120,81 @@ SEASTAR_TEST_CASE(test_temporary_buffer_aligned) {
     }
     return make_ready_future<>();
 }
+
+SEASTAR_TEST_CASE(test_huge_page_allocation_threshold) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    memory::set_huge_page_allocation_threshold(256 << 10);
+    auto p = malloc(300 << 10);
+    BOOST_REQUIRE(p != nullptr);
+    BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(p) % memory::huge_page_size, 0);
+    BOOST_REQUIRE_EQUAL(malloc_usable_size(p), memory::huge_page_size);
+    free(p);
+    memory::set_huge_page_allocation_threshold(0);
+    p = malloc(300 << 10);
+    BOOST_REQUIRE(p != nullptr);
+    BOOST_REQUIRE_EQUAL(malloc_usable_size(p), 512 << 10);
+    free(p);
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_release_free_memory) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    auto size = 8 * memory::huge_page_size;
+    auto before = memory::stats();
+    auto p = static_cast<char*>(malloc(size));
+    BOOST_REQUIRE(p != nullptr);
+    ::memset(p, 1, size);
+    free(p);
+    BOOST_REQUIRE_GE(memory::release_free_memory(), size);
+    auto after = memory::stats();
+    BOOST_REQUIRE_GE(after.released_memory(), size);
+    BOOST_REQUIRE_LE(after.released_memory(), after.free_memory());
+    BOOST_REQUIRE_GT(after.memory_releases(), before.memory_releases());
+    // Released memory is handed out again like any other free memory
+    p = static_cast<char*>(malloc(size));
+    BOOST_REQUIRE(p != nullptr);
+    ::memset(p, 1, size);
+    free(p);
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_sampled_heap_profile) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    auto live = [] {
+        size_t count = 0;
+        for (auto& s : memory::get_sampled_heap_profile().sites) {
+            count += s.live_count;
+        }
+        return count;
+    };
+    memory::set_heap_profiling_sample_rate(4096);
+    auto objs = std::vector<std::unique_ptr<char[]>>(10000);
+    for (auto& o : objs) {
+        o = std::make_unique<char[]>(100);
+    }
+    auto large = std::make_unique<char[]>(1 << 20);
+    memory::set_heap_profiling_sample_rate(0);
+    auto profile = memory::get_sampled_heap_profile();
+    BOOST_REQUIRE_EQUAL(profile.sample_rate, 4096);
+    size_t samples = 0;
+    for (auto& s : profile.sites) {
+        BOOST_REQUIRE(!s.backtrace.empty());
+        BOOST_REQUIRE_GE(s.alloc_count, s.live_count);
+        samples += s.alloc_count;
+    }
+    // 1MB of allocations at one sample per 4k
+    BOOST_REQUIRE_GT(samples, 100);
+    BOOST_REQUIRE_GT(live(), 0);
+    std::ostringstream os;
+    memory::write_pprof_heap_profile(os, {profile});
+    BOOST_REQUIRE_EQUAL(os.str().rfind("heap profile: ", 0), 0);
+    BOOST_REQUIRE_NE(os.str().find("@ heap_v2/4096\n"), std::string::npos);
+    // Everything sampled above was allocated by us
+    std::vector<std::unique_ptr<char[]>>().swap(objs);
+    large.reset();
+    BOOST_REQUIRE_EQUAL(live(), 0);
+#endif
+    return make_ready_future<>();
+}
@@ -273,6 +273,51 @@ future<> test_smp_timeout() {
     });
 }
 
+future<> test_smp_admission_control() {
+    return async([] {
+        if (smp::count < 2) {
+            return;
+        }
+        const shard_id other_shard = smp::count - 1;
+
+        std::mutex mut;
+        std::unique_lock<std::mutex> lk(mut);
+
+        // Keeps the remote shard busy with one request
+        auto fut1 = smp::submit_to(other_shard, [&mut] {
+            std::unique_lock<std::mutex> lk(mut);
+        });
+        while (smp::load(other_shard).backlog < 1) {
+            sleep(1ms).get();
+        }
+
+        {
+            auto notify = defer([lk = std::move(lk)] { });
+
+            smp_submit_to_options options;
+            options.max_backlog = 1;
+            auto fut_rejected = smp::submit_to(other_shard, options, [] {
+                std::cout << "Running rejected request" << std::endl;
+            });
+            try {
+                fut_rejected.get();
+                throw std::runtime_error("smp::submit_to() wasn't rejected as expected");
+            } catch (smp_overloaded_error& e) {
+                std::cout << "Expected rejection received: " << e.what() << std::endl;
+            }
+
+            // Routed away from the busy shard
+            std::vector<shard_id> shards{other_shard, 0};
+            auto shard = smp::submit_to_least_loaded(shards, options, [] {
+                return this_shard_id();
+            }).get0();
+            assert(shard == 0);
+        }
+
+        fut1.get();
+    });
+}
+
 int main(int argc, char** argv) {
     app_template app;
     return app.run(argc, argv, [] {
@@ -292,6 +337,8 @@ int main(int argc, char** argv) {
             return test_smp_service_groups_re_construction();
         }).then([] {
             return test_smp_timeout();
+        }).then([] {
+            return test_smp_admission_control();
         });
     });
 }
@@ -70,6 +70,9 @@ class test_env {
     test_env(unsigned capacity) : _fq(capacity)
     {}
 
+    test_env(fair_queue::config cfg) : _fq(std::move(cfg))
+    {}
+
     // As long as there is a request sitting in the queue, tick() will process
     // at least one request. The only situation in which tick() will return nothing
     // is if no requests were sent to the fair_queue (obviously).
@@ -130,6 +133,19 @@ class test_env {
         _fq.update_shares(cl, shares);
     }
 
+    void set_latency_target(unsigned index, std::chrono::microseconds target) {
+        auto cl = _classes[index];
+        _fq.set_latency_target(cl, target);
+    }
+
+    unsigned results(unsigned index) const {
+        return _results[index];
+    }
+
+    size_t executing() const {
+        return _inflight.size();
+    }
+
     void reset_results(unsigned index) {
         _results[index] = 0;
     }
@@ -420,3 +436,198 @@ SEASTAR_THREAD_TEST_CASE(test_fair_queue_random_run) {
     auto expected_error = std::max(1, int(round(reqs * 0.05)));
     env.verify(format("random_run ({:d} requests)", reqs), {1, 1}, expected_error);
 }
+
+// A class with few shares and a latency target is served ahead of a deep backlog
+// once its requests become urgent, but only up to max_latency_lead requests past
+// its fair share. After that, shares apply again.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_latency_target) {
+    test_env env(1);
+
+    auto a = env.register_priority_class(1000);
+    auto b = env.register_priority_class(10);
+    env.set_latency_target(b, 1ms);
+
+    for (int i = 0; i < 1000; ++i) {
+        env.do_op(a, 1);
+    }
+    for (int i = 0; i < 100; ++i) {
+        env.do_op(b, 1);
+    }
+
+    sleep(1ms).get();
+    env.tick(20);
+    std::cout << "latency_target: r[0] = " << env.results(a) << " r[1] = " << env.results(b) << std::endl;
+    // Default lead of 8, plus the request b gets by shares
+    BOOST_REQUIRE_GE(env.results(b), 8);
+    BOOST_REQUIRE_LE(env.results(b), 10);
+
+    // Now b is ahead and it only gets its 1:100 ratio
+    env.tick(200);
+    std::cout << "latency_target: r[0] = " << env.results(a) << " r[1] = " << env.results(b) << std::endl;
+    BOOST_REQUIRE_LE(env.results(b), 13);
+}
+
+// Once the lead is used up, it is re-armed when the class is late again, at
+// most once per latency target.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_latency_target_rearm) {
+    test_env env(1);
+
+    auto a = env.register_priority_class(1000);
+    auto b = env.register_priority_class(10);
+    env.set_latency_target(b, 1ms);
+
+    for (int i = 0; i < 1000; ++i) {
+        env.do_op(a, 1);
+    }
+    for (int i = 0; i < 100; ++i) {
+        env.do_op(b, 1);
+    }
+
+    sleep(1ms).get();
+    env.tick(20);
+    auto first = env.results(b);
+    BOOST_REQUIRE_GE(first, 8);
+
+    sleep(1ms).get();
+    env.tick(20);
+    std::cout << "latency_target_rearm: r[0] = " << env.results(a) << " r[1] = " << env.results(b) << std::endl;
+    BOOST_REQUIRE_GE(env.results(b), first + 8);
+}
+
+// Among urgent classes, the one whose oldest request has the earliest deadline
+// goes first.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_latency_target_earliest_deadline) {
+    test_env env(1);
+
+    auto a = env.register_priority_class(1000);
+    auto b = env.register_priority_class(10);
+    auto c = env.register_priority_class(10);
+    env.set_latency_target(b, 100ms);
+    env.set_latency_target(c, 2ms);
+
+    for (int i = 0; i < 1000; ++i) {
+        env.do_op(a, 1);
+    }
+    for (int i = 0; i < 100; ++i) {
+        env.do_op(b, 1);
+    }
+    sleep(50ms).get();
+    for (int i = 0; i < 100; ++i) {
+        env.do_op(c, 1);
+    }
+
+    // b's requests are 50ms old and due in 50ms; c's are due in 2ms, but only
+    // urgent after 1ms.
+    env.tick(4);
+    BOOST_REQUIRE_EQUAL(env.results(c), 0);
+    BOOST_REQUIRE_GE(env.results(b), 4);
+
+    sleep(1ms).get();
+    // One of b's requests is still executing
+    env.tick(9);
+    std::cout << "latency_target_earliest_deadline: r[0] = " << env.results(a) << " r[1] = " << env.results(b)
+              << " r[2] = " << env.results(c) << std::endl;
+    BOOST_REQUIRE_GE(env.results(c), 8);
+}
+
+// Requests that are far from their latency target do not jump the queue.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_latency_target_not_urgent) {
+    test_env env(1);
+
+    auto a = env.register_priority_class(1000);
+    auto b = env.register_priority_class(10);
+    env.set_latency_target(b, 10s);
+
+    for (int i = 0; i < 1000; ++i) {
+        env.do_op(a, 1);
+    }
+    for (int i = 0; i < 100; ++i) {
+        env.do_op(b, 1);
+    }
+
+    later().get();
+    env.tick(20);
+    BOOST_REQUIRE_LE(env.results(b), 1);
+}
+
+// Two queues sharing a group. A busy queue borrows the group capacity on top of
+// its own, while the other one can still use its reservation.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_shared_capacity) {
+    auto group = std::make_shared<fair_group>(fair_group::config{8, std::numeric_limits<unsigned>::max()});
+    auto cfg = make_config(std::numeric_limits<unsigned>::max());
+    cfg.max_req_count = 2;
+    cfg.group = group;
+    test_env busy(cfg);
+    test_env idle(cfg);
+
+    auto a = busy.register_priority_class(10);
+    auto b = idle.register_priority_class(10);
+
+    for (int i = 0; i < 100; ++i) {
+        busy.do_op(a, 1);
+    }
+    busy.tick(0);
+    BOOST_REQUIRE_EQUAL(busy.executing(), 10);
+
+    for (int i = 0; i < 100; ++i) {
+        idle.do_op(b, 1);
+    }
+    idle.tick(0);
+    BOOST_REQUIRE_EQUAL(idle.executing(), 2);
+
+    // Capacity is given back as requests complete. Both queues have the same
+    // demand, so the busy one only takes its half, and the rest waits for the idle one.
+    idle.tick(1);
+    BOOST_REQUIRE_EQUAL(idle.executing(), 2);
+    busy.tick(1);
+    BOOST_REQUIRE_EQUAL(busy.executing(), 6);
+    idle.tick(1);
+    BOOST_REQUIRE_EQUAL(idle.executing(), 6);
+}
+
+// Capacity is lent in proportion to the shares of the backlogged classes of each queue.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_shared_capacity_proportional) {
+    auto group = std::make_shared<fair_group>(fair_group::config{8, std::numeric_limits<unsigned>::max()});
+    auto cfg = make_config(std::numeric_limits<unsigned>::max());
+    cfg.max_req_count = 1;
+    cfg.group = group;
+    test_env big(cfg);
+    test_env small(cfg);
+
+    auto a = big.register_priority_class(30);
+    auto b = small.register_priority_class(10);
+
+    for (int i = 0; i < 100; ++i) {
+        big.do_op(a, 1);
+        small.do_op(b, 1);
+    }
+    // On top of their reservation of 1, the queues get 6 and 2 of the 8 lent out,
+    // even though the big one asks first
+    big.tick(0);
+    small.tick(0);
+    BOOST_REQUIRE_EQUAL(big.executing(), 7);
+    BOOST_REQUIRE_EQUAL(small.executing(), 3);
+
+    big.tick(1);
+    small.tick(1);
+    BOOST_REQUIRE_EQUAL(big.executing(), 7);
+    BOOST_REQUIRE_EQUAL(small.executing(), 3);
+}
+
+// A queue with nothing executing dispatches even if the group is exhausted.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_shared_capacity_progress) {
+    auto group = std::make_shared<fair_group>(fair_group::config{0, std::numeric_limits<unsigned>::max()});
+    auto cfg = make_config(std::numeric_limits<unsigned>::max());
+    cfg.max_req_count = 2;
+    cfg.group = group;
+    test_env env(cfg);
+
+    auto a = env.register_priority_class(10);
+    env.do_op(a, 5);
+    env.do_op(a, 5);
+    env.tick(0);
+    BOOST_REQUIRE_EQUAL(env.executing(), 1);
+    env.tick(1);
+    BOOST_REQUIRE_EQUAL(env.executing(), 1);
+    BOOST_REQUIRE_EQUAL(env.results(a), 1);
+}
@@ -25,9 +25,13 @@
 #include <seastar/core/semaphore.hh>
 #include <seastar/core/condition-variable.hh>
 #include <seastar/core/file.hh>
+#include <seastar/core/caching_file.hh>
+#include <seastar/core/mapped_file.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/thread.hh>
 #include <seastar/core/stall_sampler.hh>
+#include <seastar/core/io_queue.hh>
+#include <seastar/core/posix.hh>
 #include <boost/range/adaptor/transformed.hpp>
 #include <iostream>
 
@@ -451,3 +455,195 @@ SEASTAR_THREAD_TEST_CASE(test_recursive_touch_directory_permissions) {
 
     umask(orig_umask);
 }
+
+SEASTAR_THREAD_TEST_CASE(test_io_queue_merge_and_split) {
+    constexpr size_t file_size = 64 << 10;
+    auto fd = file_desc::open("testfile.tmp", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    std::vector<char> data(file_size);
+    for (size_t i = 0; i < file_size; i++) {
+        data[i] = char(i % 251);
+    }
+    BOOST_REQUIRE_EQUAL(*fd.write(data.data(), data.size()), file_size);
+
+    io_queue::config cfg;
+    cfg.coordinator = engine().cpu_id();
+    cfg.io_topology.resize(smp::count, engine().cpu_id());
+    cfg.mountpoint = "io_queue_merge_test";
+    cfg.max_request_size = 16 << 10;
+    cfg.merge_requests = true;
+    cfg.max_merged_request_size = 64 << 10;
+    io_queue ioq(cfg);
+
+    std::vector<char> buf(2 * file_size);
+    auto read = [&] (uint64_t pos, size_t len) {
+        return ioq.queue_request(default_priority_class(), len, internal::io_request::make_read(fd.get(), pos, buf.data() + pos, len));
+    };
+
+    // Contiguous reads dispatched together become a single request
+    std::vector<future<size_t>> reads;
+    for (size_t pos = 0; pos < 32 << 10; pos += 4096) {
+        reads.push_back(read(pos, 4096));
+    }
+    ioq.poll_io_queue();
+    for (auto& f : when_all(reads.begin(), reads.end()).get0()) {
+        BOOST_REQUIRE_EQUAL(f.get0(), 4096);
+    }
+    BOOST_REQUIRE_EQUAL(ioq.merged_requests(), 8);
+    BOOST_REQUIRE(std::equal(buf.begin(), buf.begin() + (32 << 10), data.begin()));
+
+    // A large read is split, and the size is what was read up to EOF. Without
+    // merging, so that the pieces are dispatched on their own.
+    cfg.mountpoint = "io_queue_split_test";
+    cfg.merge_requests = false;
+    io_queue split_ioq(cfg);
+    auto f = split_ioq.queue_request(default_priority_class(), 32 << 10,
+            internal::io_request::make_read(fd.get(), 48 << 10, buf.data() + (48 << 10), 32 << 10));
+    split_ioq.poll_io_queue();
+    BOOST_REQUIRE_EQUAL(f.get0(), 16 << 10);
+    BOOST_REQUIRE_EQUAL(split_ioq.split_requests(), 1);
+    BOOST_REQUIRE_EQUAL(split_ioq.merged_requests(), 0);
+    BOOST_REQUIRE(std::equal(buf.begin() + (48 << 10), buf.begin() + file_size, data.begin() + (48 << 10)));
+    remove_file("testfile.tmp").get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_caching_file) {
+    constexpr size_t block_size = 16 << 10;
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto wbuf = allocate_aligned_buffer<char>(4 * block_size, 4096);
+    for (size_t i = 0; i < 4 * block_size; i++) {
+        wbuf.get()[i] = char(i % 251);
+    }
+    BOOST_REQUIRE_EQUAL(f.dma_write(0, wbuf.get(), 4 * block_size).get0(), 4 * block_size);
+    f.flush().get();
+
+    auto cf = make_caching_file(std::move(f), caching_file_options{block_size});
+    auto before = get_block_cache_stats();
+
+    // Concurrent reads of the same block read it once
+    auto r1 = cf.dma_read<char>(0, 4096);
+    auto r2 = cf.dma_read<char>(4096, 4096);
+    auto b1 = r1.get0();
+    auto b2 = r2.get0();
+    BOOST_REQUIRE(std::equal(b1.begin(), b1.end(), wbuf.get()));
+    BOOST_REQUIRE(std::equal(b2.begin(), b2.end(), wbuf.get() + 4096));
+    auto s = get_block_cache_stats();
+    BOOST_REQUIRE_EQUAL(s.misses - before.misses, 1);
+    BOOST_REQUIRE_EQUAL(s.coalesced_misses - before.coalesced_misses, 1);
+
+    // A read spanning blocks, and ending past EOF, misses on the empty block at EOF too
+    auto rbuf = allocate_aligned_buffer<char>(4 * block_size, 4096);
+    BOOST_REQUIRE_EQUAL(cf.dma_read(block_size / 2, rbuf.get(), 4 * block_size).get0(), 4 * block_size - block_size / 2);
+    BOOST_REQUIRE(std::equal(rbuf.get(), rbuf.get() + 4 * block_size - block_size / 2, wbuf.get() + block_size / 2));
+    s = get_block_cache_stats();
+    BOOST_REQUIRE_EQUAL(s.misses - before.misses, 5);
+    BOOST_REQUIRE_EQUAL(s.hits - before.hits, 1);
+
+    // A write drops the block it touches
+    std::fill_n(wbuf.get(), 4096, 'x');
+    BOOST_REQUIRE_EQUAL(cf.dma_write(0, wbuf.get(), 4096).get0(), 4096);
+    b1 = cf.dma_read<char>(0, 4096).get0();
+    BOOST_REQUIRE(std::all_of(b1.begin(), b1.end(), [] (char c) { return c == 'x'; }));
+    BOOST_REQUIRE_EQUAL(get_block_cache_stats().misses - before.misses, 6);
+
+    // A write extending the file drops the empty block cached at the old EOF
+    std::fill_n(wbuf.get(), 4096, 'y');
+    BOOST_REQUIRE_EQUAL(cf.dma_write(4 * block_size, wbuf.get(), 4096).get0(), 4096);
+    b1 = cf.dma_read<char>(4 * block_size, 4096).get0();
+    BOOST_REQUIRE_EQUAL(b1.size(), 4096);
+    BOOST_REQUIRE(std::all_of(b1.begin(), b1.end(), [] (char c) { return c == 'y'; }));
+
+    cf.close().get();
+    BOOST_REQUIRE_EQUAL(get_block_cache_stats().used_bytes, before.used_bytes);
+    remove_file("testfile.tmp").get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_mapped_file) {
+    constexpr size_t chunk_size = 1 << 20;
+    // Five full chunks and a partial one
+    constexpr size_t size = 5 * chunk_size + 12345;
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto wbuf = allocate_aligned_buffer<char>(align_up<size_t>(size, 4096), 4096);
+    for (size_t i = 0; i < size; i++) {
+        wbuf.get()[i] = char(i % 251);
+    }
+    f.dma_write(0, wbuf.get(), align_up<size_t>(size, 4096)).get();
+    f.truncate(size).get();
+    f.flush().get();
+    f.close().get();
+
+    f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+    auto mf = make_mapped_file(std::move(f), mapped_file_options{chunk_size}).get0();
+    BOOST_REQUIRE_EQUAL(mf.size(), size);
+    BOOST_REQUIRE(!mf.is_resident(0, 1));
+    BOOST_REQUIRE_EQUAL(mf.resident_bytes(), 0);
+
+    // Only the chunks covering the range are read
+    auto offset = 2 * chunk_size + 100;
+    mf.ensure_resident(offset, 1000).get();
+    BOOST_REQUIRE(mf.is_resident(2 * chunk_size, chunk_size));
+    BOOST_REQUIRE(!mf.is_resident(offset, chunk_size));
+    BOOST_REQUIRE_EQUAL(mf.resident_bytes(), chunk_size);
+    BOOST_REQUIRE(std::equal(mf.data() + offset, mf.data() + offset + 1000, wbuf.get() + offset));
+
+    mf.prefetch(0, size);
+    mf.ensure_resident(0, size).get();
+    BOOST_REQUIRE(mf.is_resident(0, size));
+    BOOST_REQUIRE_EQUAL(mf.resident_bytes(), size);
+    BOOST_REQUIRE(std::equal(mf.data(), mf.data() + size, wbuf.get()));
+
+    mf.close().get();
+    remove_file("testfile.tmp").get();
+}
+
+SEASTAR_TEST_CASE(test_io_cost_model) {
+    io_device_model m;
+    m.read = {{4096, 100000}, {65536, 10000}};
+    m.write = {{4096, 50000}};
+    m.mixed = {{0.5, 0.5}};
+    m.concurrency = {{1, 10000}, {4, 80000}, {16, 95000}, {64, 100000}};
+    BOOST_REQUIRE_EQUAL(m.saturation_depth(), 16);
+
+    io_queue::config cfg;
+    cfg.set_cost_model(m, 100000, 1 << 30);
+    constexpr auto base = io_queue::read_request_base_count;
+    // One entry per power of two up to the largest measured size
+    BOOST_REQUIRE_EQUAL(cfg.read_costs.size(), 5);
+    BOOST_REQUIRE_EQUAL(cfg.read_costs[0].weight, base);
+    BOOST_REQUIRE_EQUAL(cfg.read_costs[4].weight, 10 * base);
+    // A 4kB read takes 10us, in which 10.7kB could be read at full bandwidth
+    BOOST_REQUIRE_EQUAL(cfg.read_costs[0].bytes_multiplier, 336);
+    // Linear in the size between the measured points
+    BOOST_REQUIRE_EQUAL(cfg.read_costs[2].weight, 358);
+    BOOST_REQUIRE_EQUAL(cfg.write_costs.size(), 1);
+    BOOST_REQUIRE_EQUAL(cfg.write_costs[0].weight, 2 * base);
+
+    BOOST_REQUIRE_EQUAL(cfg.mix_multipliers.size(), 11);
+    BOOST_REQUIRE_EQUAL(cfg.mix_multipliers[0], base);
+    BOOST_REQUIRE_EQUAL(cfg.mix_multipliers[5], 2 * base);
+    BOOST_REQUIRE_EQUAL(cfg.mix_multipliers[10], base);
+    BOOST_REQUIRE_EQUAL(cfg.mix_multipliers[1], std::lround(base / 0.9));
+
+    // Without a model the write-to-read multipliers are used
+    cfg.set_cost_model(io_device_model{}, 100000, 1 << 30);
+    BOOST_REQUIRE(cfg.read_costs.empty() && cfg.write_costs.empty() && cfg.mix_multipliers.empty());
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_io_latency_histogram) {
+    using namespace std::chrono_literals;
+    internal::latency_histogram lh;
+    lh.add(0us);
+    lh.add(3us);
+    lh.add(4us);
+    lh.add(1ms);
+    lh.add(1h);
+    auto h = lh.to_metrics_histogram();
+    BOOST_REQUIRE_EQUAL(h.sample_count, 5);
+    BOOST_REQUIRE_EQUAL(h.buckets.front().count, 1);
+    BOOST_REQUIRE_EQUAL(h.buckets[2].upper_bound, 4e-6);
+    BOOST_REQUIRE_EQUAL(h.buckets[2].count, 3);
+    BOOST_REQUIRE_EQUAL(h.buckets[10].count, 4);
+    // Above the last bucket, counted only in the total
+    BOOST_REQUIRE_EQUAL(h.buckets.back().count, 4);
+    return make_ready_future<>();
+}
@@ -30,7 +30,9 @@
 #include <seastar/core/seastar.hh>
 #include <seastar/testing/test_case.hh>
 #include <seastar/testing/test_runner.hh>
+#include <seastar/testing/thread_test_case.hh>
 #include <seastar/core/thread.hh>
+#include <seastar/core/memory.hh>
 #include <seastar/core/print.hh>
 #include <seastar/util/defer.hh>
 #include <boost/range/adaptor/transformed.hpp>
@@ -513,3 +515,154 @@ SEASTAR_TEST_CASE(test_fstream_slow_start) {
         read_while_file_at_full_speed(make_fstream());
     });
 }
+
+SEASTAR_THREAD_TEST_CASE(test_fstream_adaptive_read_ahead) {
+    static constexpr size_t file_size = 16 * 1024 * 1024;
+    auto mock_file = make_shared<mock_read_only_file>(file_size);
+    mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+    mock_file->set_defer_reads(true);
+    std::vector<size_t> lengths;
+    mock_file->set_read_size_verifier([&] (size_t length) {
+        lengths.push_back(length);
+    });
+
+    file_input_stream_options options{};
+    options.buffer_size = 8192;
+    options.read_ahead = 4;
+    options.max_buffer_size = 65536;
+    options.adaptive_read_ahead = true;
+
+    // The consumer always waits for the disk: read-ahead and buffer size grow to the limits
+    auto fstr = make_file_input_stream(file(mock_file), options);
+    for (int i = 0; i < 10; i++) {
+        auto f = fstr.read();
+        mock_file->complete_deferred_read();
+        BOOST_REQUIRE_EQUAL(f.get0().size(), lengths[i]);
+    }
+    BOOST_REQUIRE_EQUAL(lengths.front(), 8192);
+    BOOST_REQUIRE_EQUAL(lengths.back(), 65536);
+    BOOST_REQUIRE_EQUAL(mock_file->deferred_reads(), 4);
+
+    // Skipping over a buffer still within the read-ahead keeps it
+    fstr.skip(65536).get();
+    auto f = fstr.read();
+    BOOST_REQUIRE_EQUAL(lengths.back(), 65536);
+    BOOST_REQUIRE_EQUAL(mock_file->deferred_reads(), 6);
+    mock_file->complete_deferred_read();
+    mock_file->complete_deferred_read();
+    BOOST_REQUIRE_EQUAL(f.get0().size(), 65536);
+
+    // Skipping past the buffered data goes back to a single small read
+    fstr.skip(1 << 20).get();
+    f = fstr.read();
+    BOOST_REQUIRE_EQUAL(lengths.back(), 8192);
+    BOOST_REQUIRE_EQUAL(mock_file->deferred_reads(), 5);
+    while (mock_file->deferred_reads()) {
+        mock_file->complete_deferred_read();
+    }
+    BOOST_REQUIRE_EQUAL(f.get0().size(), 8192);
+    fstr.close().get();
+
+    // Without budget there is no read-ahead
+    set_file_input_stream_read_ahead_budget(0);
+    auto restore_budget = defer([] {
+        set_file_input_stream_read_ahead_budget(memory::stats().total_memory() / 32);
+    });
+    mock_file = make_shared<mock_read_only_file>(file_size);
+    mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+    mock_file->set_defer_reads(true);
+    fstr = make_file_input_stream(file(mock_file), options);
+    for (int i = 0; i < 10; i++) {
+        auto f = fstr.read();
+        BOOST_REQUIRE_EQUAL(mock_file->deferred_reads(), 1);
+        mock_file->complete_deferred_read();
+        f.get();
+    }
+    fstr.close().get();
+}
+
+// Counts the vectored writes that reach the file
+class vectored_write_counting_file final : public file_impl {
+    file _file;
+    file_impl* _impl;
+public:
+    unsigned vectored_writes = 0;
+
+    explicit vectored_write_counting_file(file f) : _file(std::move(f)), _impl(get_file_impl(_file)) {
+        _memory_dma_alignment = _impl->_memory_dma_alignment;
+        _disk_read_dma_alignment = _impl->_disk_read_dma_alignment;
+        _disk_write_dma_alignment = _impl->_disk_write_dma_alignment;
+    }
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        return _impl->write_dma(pos, buffer, len, pc);
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        ++vectored_writes;
+        return _impl->write_dma(pos, std::move(iov), pc);
+    }
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override {
+        return _impl->read_dma(pos, buffer, len, pc);
+    }
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        return _impl->read_dma(pos, std::move(iov), pc);
+    }
+    virtual future<> flush() override {
+        return _impl->flush();
+    }
+    virtual future<struct stat> stat() override {
+        return _impl->stat();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        return _impl->truncate(length);
+    }
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        return _impl->discard(offset, length);
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _impl->allocate(position, length);
+    }
+    virtual future<uint64_t> size() override {
+        return _impl->size();
+    }
+    virtual future<> close() override {
+        return _impl->close();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override {
+        return _impl->list_directory(std::move(next));
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        return _impl->dma_read_bulk(offset, range_size, pc);
+    }
+};
+
+SEASTAR_THREAD_TEST_CASE(test_fstream_gathered_writes) {
+    static constexpr size_t buffer_size = 4096;
+    static constexpr size_t nr_buffers = 256;
+    static constexpr size_t tail = 100;
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto counting = make_shared<vectored_write_counting_file>(std::move(f));
+
+    file_output_stream_options options;
+    options.buffer_size = buffer_size;
+    options.write_behind = 1;
+    options.max_gathered_write_size = 64 * 1024;
+    auto out = make_file_output_stream(file(counting), options);
+    std::vector<char> data(nr_buffers * buffer_size + tail);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = char(i % 251);
+    }
+    for (size_t pos = 0; pos < data.size(); pos += buffer_size) {
+        out.write(data.data() + pos, std::min(buffer_size, data.size() - pos)).get();
+    }
+    out.flush().get();
+    out.close().get();
+    // Writes queued behind the single write-behind slot were gathered
+    BOOST_REQUIRE_GT(counting->vectored_writes, 0u);
+
+    f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+    BOOST_REQUIRE_EQUAL(f.size().get0(), data.size());
+    auto in = make_file_input_stream(std::move(f));
+    auto buf = in.read_exactly(data.size()).get0();
+    BOOST_REQUIRE(std::equal(buf.begin(), buf.end(), data.begin()));
+    in.close().get();
+}
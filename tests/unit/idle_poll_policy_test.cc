@@ -0,0 +1,71 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB Ltd.
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/core/internal/idle_poll_policy.hh>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+using internal::idle_poll_policy;
+
+static void add_gaps(idle_poll_policy& p, idle_poll_policy::duration gap, unsigned n) {
+    for (unsigned i = 0; i < n; i++) {
+        p.add_gap(gap);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_polls_through_short_gaps) {
+    idle_poll_policy p(200us, 50us, 100us);
+    BOOST_REQUIRE(p.poll_time() == 100us);
+    add_gaps(p, 5us, 64);
+    // Just long enough to cover the gaps, rounded up to a power of two
+    BOOST_REQUIRE(p.poll_time() == 8us);
+}
+
+BOOST_AUTO_TEST_CASE(test_sleeps_when_mostly_idle) {
+    idle_poll_policy p(200us, 50us, 100us);
+    add_gaps(p, 10ms, 64);
+    BOOST_REQUIRE(p.poll_time() == 0us);
+}
+
+BOOST_AUTO_TEST_CASE(test_poll_time_is_bounded) {
+    // Worth polling 1ms gaps if waking up is that expensive, but not allowed to
+    idle_poll_policy p(200us, 5ms, 200us);
+    add_gaps(p, 1ms, 64);
+    BOOST_REQUIRE(p.poll_time() == 0us);
+    idle_poll_policy unbounded(10ms, 5ms, 200us);
+    add_gaps(unbounded, 1ms, 64);
+    BOOST_REQUIRE(unbounded.poll_time() == 1024us);
+}
+
+BOOST_AUTO_TEST_CASE(test_follows_the_load) {
+    idle_poll_policy p(200us, 50us, 100us);
+    add_gaps(p, 5us, 4096);
+    BOOST_REQUIRE(p.poll_time() == 8us);
+    // A few long gaps among short ones still leave polling worth it
+    add_gaps(p, 10ms, 64);
+    BOOST_REQUIRE(p.poll_time() == 8us);
+    // Once the load is gone, the short gaps are forgotten
+    add_gaps(p, 10ms, 16384);
+    BOOST_REQUIRE(p.poll_time() == 0us);
+}
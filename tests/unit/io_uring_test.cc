@@ -0,0 +1,117 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+// Runs with --reactor-backend io_uring, with and without SQPOLL (see
+// CMakeLists.txt), on plain unregistered file descriptors.
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/internal/pollable_fd.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/net/api.hh>
+#include <seastar/util/defer.hh>
+#include <cstring>
+#include <sys/socket.h>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+SEASTAR_THREAD_TEST_CASE(test_io_uring_file_io) {
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto close_f = defer([&f] { f.close().get(); });
+    auto size = f.disk_write_dma_alignment();
+    auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), size);
+    std::fill(wbuf.get_write(), wbuf.get_write() + size, 'x');
+    BOOST_REQUIRE_EQUAL(f.dma_write(0, wbuf.get(), size).get0(), size);
+    f.flush().get();
+    auto rbuf = f.dma_read<char>(0, size).get0();
+    BOOST_REQUIRE_EQUAL(rbuf.size(), size);
+    BOOST_REQUIRE(std::equal(rbuf.begin(), rbuf.end(), wbuf.begin()));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_io_uring_sockets) {
+    listen_options lo;
+    lo.reuse_address = true;
+    auto ss = seastar::listen(make_ipv4_address({"127.0.0.1", 0}), lo);
+    auto accepted = ss.accept();
+    auto client = connect(ss.local_address()).get0();
+    auto server = accepted.get0().connection;
+
+    auto out = client.output();
+    out.write("ping").get();
+    out.flush().get();
+    auto in = server.input();
+    auto buf = in.read_exactly(4).get0();
+    BOOST_REQUIRE_EQUAL(sstring(buf.get(), buf.size()), "ping");
+
+    // A read in flight ends when its socket is shut down
+    auto pending = client.input();
+    auto f = pending.read();
+    sleep(10ms).get();
+    BOOST_REQUIRE(!f.available());
+    client.shutdown_input();
+    f.get();
+    out.close().get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_io_uring_polls) {
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    pollable_fd a(file_desc::from_fd(fds[0]));
+    auto b = file_desc::from_fd(fds[1]);
+
+    // Both wait on the same POLLIN poll
+    auto f1 = a.readable();
+    auto f2 = a.readable();
+    char c = 'x';
+    b.write(&c, 1);
+    f1.get();
+    f2.get();
+    a.get_file_desc().read(&c, 1);
+
+    // readable_or_writeable() has its own poll, which wakes on POLLOUT without
+    // waking readers
+    auto r = a.readable();
+    a.readable_or_writeable().get();
+    sleep(10ms).get();
+    BOOST_REQUIRE(!r.available());
+    b.write(&c, 1);
+    r.get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_io_uring_forget_cancels_reads) {
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+    auto a = std::make_unique<pollable_fd>(file_desc::from_fd(fds[0]));
+    auto b = file_desc::from_fd(fds[1]);
+
+    // A read left in flight when its fd goes away is cancelled, and its
+    // buffer and state are freed once the kernel is done with them
+    auto f = a->read_some(temporary_buffer<char>(4096));
+    sleep(10ms).get();
+    BOOST_REQUIRE(!f.available());
+    a.reset();
+    BOOST_REQUIRE_THROW(f.get(), std::system_error);
+}
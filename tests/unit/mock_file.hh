@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <deque>
 #include <boost/range/numeric.hpp>
 
 #include <seastar/testing/seastar_test.hh>
@@ -33,6 +34,8 @@ class mock_read_only_file final : public file_impl {
     uint64_t _total_file_size;
     size_t _allowed_read_requests = 0;
     std::function<void(size_t)> _verify_length;
+    bool _defer_reads = false;
+    std::deque<std::pair<size_t, promise<temporary_buffer<uint8_t>>>> _deferred_reads;
 private:
     size_t verify_read(uint64_t position, size_t length) {
         BOOST_CHECK(!_closed);
@@ -63,6 +66,18 @@ class mock_read_only_file final : public file_impl {
     void set_allowed_read_requests(size_t requests) {
         _allowed_read_requests = requests;
     }
+    // Bulk reads complete only when complete_deferred_read() is called, oldest first
+    void set_defer_reads(bool defer) {
+        _defer_reads = defer;
+    }
+    size_t deferred_reads() const {
+        return _deferred_reads.size();
+    }
+    void complete_deferred_read() {
+        auto read = std::move(_deferred_reads.front());
+        _deferred_reads.pop_front();
+        read.second.set_value(temporary_buffer<uint8_t>(read.first));
+    }
 
     virtual future<size_t> write_dma(uint64_t, const void*, size_t, const io_priority_class&) override {
         throw std::bad_function_call();
@@ -106,6 +121,10 @@ class mock_read_only_file final : public file_impl {
     }
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class&) override {
         auto length = verify_read(offset, range_size);
+        if (_defer_reads) {
+            _deferred_reads.emplace_back(length, promise<temporary_buffer<uint8_t>>());
+            return _deferred_reads.back().second.get_future();
+        }
         return make_ready_future<temporary_buffer<uint8_t>>(temporary_buffer<uint8_t>(length));
     }
 };
@@ -25,6 +25,8 @@
 #include <seastar/core/vector-data-sink.hh>
 #include <seastar/core/future-util.hh>
 #include <seastar/core/sstring.hh>
+#include <seastar/core/file.hh>
+#include <seastar/util/defer.hh>
 #include <seastar/net/packet.hh>
 #include <seastar/testing/test_case.hh>
 #include <seastar/testing/thread_test_case.hh>
@@ -157,3 +159,99 @@ SEASTAR_THREAD_TEST_CASE(test_simple_write) {
     BOOST_REQUIRE_EQUAL(buf.size(), 1);
     BOOST_REQUIRE_EQUAL(sstring(buf.front().get(), buf.front().size()), value);
 }
+
+SEASTAR_THREAD_TEST_CASE(test_write_file) {
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto close_f = defer([&f] { f.close().get(); });
+    auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), 4096);
+    for (size_t i = 0; i < wbuf.size(); ++i) {
+        wbuf.get_write()[i] = 'a' + i % 26;
+    }
+    f.dma_write(0, wbuf.get(), wbuf.size()).get();
+
+    // vector_data_sink has no put_file(), so this covers the copying fallback
+    auto vec = std::vector<net::packet>{};
+    auto out = output_stream<char>(data_sink(std::make_unique<vector_data_sink>(vec)), 8);
+    out.write("head").get();
+    out.write_file(f, 10, 4000, default_priority_class()).get();
+    out.write("tail").get();
+    out.close().get();
+
+    auto packets = net::packet{};
+    for (auto& p : vec) {
+        packets.append(std::move(p));
+    }
+    BOOST_REQUIRE_EQUAL(to_sstring(packets), "head" + sstring(wbuf.get() + 10, 4000) + "tail");
+
+    BOOST_REQUIRE_THROW(output_stream<char>(data_sink(std::make_unique<vector_data_sink>(vec)), 8)
+            .write_file(f, 4000, 100, default_priority_class()).get(), file::eof_error);
+}
+
+// A sink that completes each put() only after yielding, so a batched flush
+// is still in progress when the next write arrives.
+class deferring_data_sink final : public data_sink_impl {
+    std::vector<net::packet>& _v;
+public:
+    explicit deferring_data_sink(std::vector<net::packet>& v) : _v(v) {}
+    virtual future<> put(net::packet p) override {
+        return later().then([this, p = std::move(p)] () mutable {
+            _v.push_back(std::move(p));
+        });
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+};
+
+SEASTAR_THREAD_TEST_CASE(test_write_file_during_flush) {
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto close_f = defer([&f] { f.close().get(); });
+    auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), 4096);
+    std::fill_n(wbuf.get_write(), wbuf.size(), 'f');
+    f.dma_write(0, wbuf.get(), wbuf.size()).get();
+
+    auto vec = std::vector<net::packet>{};
+    auto out = output_stream<char>(data_sink(std::make_unique<deferring_data_sink>(vec)), 16, false, true);
+    out.write("head").get();
+    out.flush().get();
+    // Let the flush poller start putting "head" in the background.
+    later().get();
+    out.write("mid").get();
+    out.write_file(f, 0, 100, default_priority_class()).get();
+    out.write("tail").get();
+    out.close().get();
+
+    auto packets = net::packet{};
+    for (auto& p : vec) {
+        packets.append(std::move(p));
+    }
+    BOOST_REQUIRE_EQUAL(to_sstring(packets), "headmid" + sstring(100, 'f') + "tail");
+}
+
+class failing_flush_data_sink final : public data_sink_impl {
+public:
+    virtual future<> put(net::packet p) override {
+        return make_ready_future<>();
+    }
+    virtual future<> flush() override {
+        return make_exception_future<>(std::runtime_error("flush failed"));
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+};
+
+SEASTAR_THREAD_TEST_CASE(test_write_file_after_failed_flush) {
+    auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto close_f = defer([&f] { f.close().get(); });
+
+    auto out = output_stream<char>(data_sink(std::make_unique<failing_flush_data_sink>()), 16, false, true);
+    out.write("head").get();
+    out.flush().get();
+    // Let the flush poller fail in the background
+    for (int i = 0; i < 10; i++) {
+        later().get();
+    }
+    BOOST_REQUIRE_THROW(out.write_file(f, 0, 100, default_priority_class()).get(), std::runtime_error);
+    out.close().handle_exception([] (std::exception_ptr) {}).get();
+}
@@ -211,3 +211,33 @@ SEASTAR_THREAD_TEST_CASE(sg_specific_values_define_before_and_after_sg_create) {
         });
     }).get();
 }
+
+/**
+ *  Test that a CPU cap bounds a group even when nothing else runs
+ */
+SEASTAR_THREAD_TEST_CASE(sg_cpu_cap) {
+    auto sg = create_scheduling_group("capped", 100).get0();
+    const auto destroy_scheduling_group_ = defer([sg] () {
+        destroy_scheduling_group(sg).get();
+    });
+    sg.set_cpu_cap(0.2);
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + 1s;
+    std::chrono::steady_clock::duration used{0};
+    with_scheduling_group(sg, [&] {
+        return do_until([&] { return std::chrono::steady_clock::now() >= end; }, [&] {
+            auto spin_start = std::chrono::steady_clock::now();
+            while (std::chrono::steady_clock::now() < spin_start + 100us) {
+                // spin!
+            }
+            used += std::chrono::steady_clock::now() - spin_start;
+            return later();
+        });
+    }).get();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    sg.set_cpu_cap(0);
+
+    // The cap may be overrun by a task quota per period
+    BOOST_REQUIRE_LT(double(used.count()) / elapsed.count(), 0.3);
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+// Adding size classes can't be undone, so this runs in a process of its own
+// rather than changing the allocator under the other allocation tests.
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/util/std-compat.hh>
+#include <vector>
+#include <malloc.h>
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_small_size_classes) {
+#if !defined(SEASTAR_DEFAULT_ALLOCATOR) && !defined(SEASTAR_HEAPPROF)
+    auto pool_of = [] (size_t object_size) {
+        for (auto& s : memory::small_pool_statistics()) {
+            if (s.object_size == object_size) {
+                return compat::optional<memory::small_pool_stats>(s);
+            }
+        }
+        return compat::optional<memory::small_pool_stats>();
+    };
+    auto p = ::operator new(200);
+    BOOST_REQUIRE_EQUAL(malloc_usable_size(p), 224);
+    // 196 rounds up to 200 as well, 100 to 104
+    memory::add_small_size_classes({200, 196, 100});
+    BOOST_REQUIRE(pool_of(200));
+    BOOST_REQUIRE(pool_of(104));
+    auto objs = std::vector<void*>();
+    for (auto i = 0; i < 1000; ++i) {
+        objs.push_back(malloc(i % 2 ? 200 : 193));
+    }
+    for (auto i = 0; i < 1000; ++i) {
+        BOOST_REQUIRE_EQUAL(malloc_usable_size(objs[i]), 200);
+    }
+    auto before = *pool_of(200);
+    BOOST_REQUIRE_GE(before.use_count, 1000);
+    BOOST_REQUIRE_GT(before.memory, 0);
+    BOOST_REQUIRE_GT(before.spans, 0);
+    for (auto o : objs) {
+        free(o);
+    }
+    auto after = memory::small_pool_statistics_for(200);
+    BOOST_REQUIRE_EQUAL(after.use_count, before.use_count - 1000);
+    BOOST_REQUIRE_GT(after.trims, before.trims);
+    // Allocated before the class was added, freed after
+    ::operator delete(p, 200);
+    BOOST_REQUIRE_THROW(memory::add_small_size_classes({1 << 20}), std::invalid_argument);
+    auto all = memory::small_pool_statistics();
+    for (size_t i = 1; i < all.size(); ++i) {
+        BOOST_REQUIRE_LT(all[i - 1].object_size, all[i].object_size);
+    }
+#endif
+    return make_ready_future<>();
+}
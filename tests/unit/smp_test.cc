@@ -22,6 +22,9 @@
 #include <seastar/core/reactor.hh>
 #include <seastar/core/app-template.hh>
 #include <seastar/core/print.hh>
+#include <seastar/core/future-util.hh>
+#include <boost/iterator/counting_iterator.hpp>
+#include <atomic>
 
 using namespace seastar;
 
@@ -57,6 +60,58 @@ future<bool> test_smp_exception() {
     });
 }
 
+std::atomic<unsigned> batch_calls;
+
+future<bool> test_smp_batch_exception() {
+    std::vector<std::function<future<> ()>> funcs;
+    for (unsigned i = 0; i < 8; i++) {
+        funcs.push_back([i] {
+            ++batch_calls;
+            if (i == 3) {
+                return make_exception_future<>(nasty_exception());
+            }
+            return make_ready_future<>();
+        });
+    }
+    return smp::submit_batch_to(1, smp_submit_to_options(), std::move(funcs)).then_wrapped([] (future<> result) {
+        try {
+            result.get();
+            return false; // expected an exception
+        } catch (nasty_exception&) {
+            // the other functions of the batch still ran
+            return batch_calls == 8;
+        } catch (...) {
+            return false;
+        }
+    });
+}
+
+// Each call reuses the work item the previous one freed, so alternate
+// values and exceptions to catch any state left over from the last use.
+future<bool> test_smp_recycled_items() {
+    return do_with(true, [] (bool& ok) {
+        return do_for_each(boost::counting_iterator<int>(0), boost::counting_iterator<int>(64), [&ok] (int i) {
+            return smp::submit_to(1, [i] {
+                if (i % 2) {
+                    return make_exception_future<int>(nasty_exception());
+                }
+                return make_ready_future<int>(i);
+            }).then_wrapped([&ok, i] (future<int> result) {
+                try {
+                    auto v = result.get0();
+                    ok &= i % 2 == 0 && v == i;
+                } catch (nasty_exception&) {
+                    ok &= i % 2 == 1;
+                } catch (...) {
+                    ok = false;
+                }
+            });
+        }).then([&ok] {
+            return ok;
+        });
+    });
+}
+
 int tests, fails;
 
 future<>
@@ -72,6 +127,10 @@ int main(int ac, char** av) {
     return app_template().run_deprecated(ac, av, [] {
        return report("smp call", test_smp_call()).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("smp batch exception", test_smp_batch_exception());
+       }).then([] {
+           return report("smp recycled items", test_smp_recycled_items());
        }).then([] {
            fmt::print("\n{:d} tests / {:d} failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
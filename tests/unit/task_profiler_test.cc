@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+#include <seastar/core/task_profiler.hh>
+#include <seastar/core/thread.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/scheduling.hh>
+#include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/util/defer.hh>
+#include <boost/range/irange.hpp>
+#include <algorithm>
+
+using namespace seastar;
+
+static future<> run_some_tasks() {
+    auto range = boost::irange(0, 1000);
+    return do_for_each(range.begin(), range.end(), [] (int) {
+        return later().then([] {
+            volatile int x = 0;
+            for (int i = 0; i < 1000; i++) {
+                x = x + i;
+            }
+        });
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_task_profiler_disabled) {
+    set_task_profiler_sample_period(0);
+    run_some_tasks().get();
+    BOOST_REQUIRE(get_task_profile().empty());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_task_profiler_groups_and_types) {
+    auto sg = create_scheduling_group("profiled", 100).get0();
+    auto destroy = defer([sg] {
+        set_task_profiler_sample_period(0);
+        destroy_scheduling_group(sg).get();
+    });
+
+    set_task_profiler_sample_period(1);
+    with_scheduling_group(sg, [] {
+        return run_some_tasks();
+    }).get();
+
+    auto profile = get_task_profile(5);
+    auto g = std::find_if(profile.begin(), profile.end(), [] (const task_profile_group& g) {
+        return g.scheduling_group == "profiled";
+    });
+    BOOST_REQUIRE(g != profile.end());
+    BOOST_REQUIRE_GE(g->tasks, 1000u);
+    BOOST_REQUIRE(!g->top.empty());
+    BOOST_REQUIRE_LE(g->top.size(), 5u);
+    BOOST_REQUIRE(std::is_sorted(g->top.begin(), g->top.end(), [] (const task_profile_entry& a, const task_profile_entry& b) {
+        return a.runtime > b.runtime;
+    }));
+    // The lambda is named after the function that defines it
+    BOOST_REQUIRE(std::any_of(g->top.begin(), g->top.end(), [] (const task_profile_entry& e) {
+        return e.task_type.find("run_some_tasks") != sstring::npos;
+    }));
+
+    reset_task_profile();
+    profile = get_task_profile();
+    BOOST_REQUIRE(std::none_of(profile.begin(), profile.end(), [] (const task_profile_group& g) {
+        return g.scheduling_group == "profiled";
+    }));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_task_profiler_disabled_from_sampled_task) {
+    // Every task is sampled, including the one that disables the profiler
+    set_task_profiler_sample_period(1);
+    later().then([] {
+        set_task_profiler_sample_period(0);
+    }).get();
+    run_some_tasks().get();
+    BOOST_REQUIRE(get_task_profile().empty());
+}
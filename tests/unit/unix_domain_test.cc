@@ -25,6 +25,7 @@
 #include <seastar/core/print.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/thread.hh>
+#include <seastar/core/file.hh>
 #include <seastar/util/log.hh>
 #include <seastar/util/std-compat.hh>
 
@@ -231,3 +232,41 @@ SEASTAR_TEST_CASE(unixdomain_abort) {
     });
 }
 
+
+// write_file() over a posix-stack socket, which transfers with sendfile()
+SEASTAR_TEST_CASE(unixdomain_write_file) {
+    return seastar::async([] {
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), 256 * 1024);
+        for (size_t i = 0; i < wbuf.size(); ++i) {
+            wbuf.get_write()[i] = 'a' + i % 26;
+        }
+        f.dma_write(0, wbuf.get(), wbuf.size()).get();
+        const uint64_t pos = 17, len = wbuf.size() - 100;
+
+        socket_address addr{unix_domain_addr{"\0write_file_test"s}};
+        auto lstn = engine().listen(addr);
+        auto client = engine().connect(addr).then([] (connected_socket cs) {
+            auto in = cs.input();
+            return do_with(std::move(cs), std::move(in), std::string(), [] (auto& cs, auto& in, std::string& received) {
+                return repeat([&in, &received] {
+                    return in.read().then([&received] (temporary_buffer<char> buf) {
+                        received.append(buf.get(), buf.size());
+                        return buf.empty() ? stop_iteration::yes : stop_iteration::no;
+                    });
+                }).then([&received] {
+                    return received;
+                });
+            });
+        });
+        auto cn = lstn.accept().get0().connection;
+        auto out = cn.output();
+        out.write("head").get();
+        out.write_file(f, pos, len, default_priority_class()).get();
+        out.write("tail").get();
+        out.close().get();
+
+        BOOST_REQUIRE(client.get0() == "head" + std::string(wbuf.get() + pos, len) + "tail");
+        f.close().get();
+    });
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2020 ScyllaDB
+ */
+
+// Run with --zero-copy-send-threshold, so the posix stack sends large
+// buffers with MSG_ZEROCOPY where the kernel supports it.
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/net/api.hh>
+#include <seastar/net/inet_address.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/thread.hh>
+#include <seastar/core/sleep.hh>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+SEASTAR_TEST_CASE(zero_copy_send_releases_buffers) {
+    return async([] {
+        auto sc = api_v2::server_socket(engine().net().listen(ipv4_addr{"127.0.0.1", 0}, {}));
+        auto cc = engine().net().connect(sc.local_address()).get0();
+        auto lc = std::move(sc.accept().get0().connection);
+
+        constexpr size_t nr_buffers = 16;
+        constexpr size_t buffer_size = 64 * 1024;
+        std::vector<std::unique_ptr<char[]>> storage;
+        size_t released = 0;
+
+        auto in = lc.input();
+        auto received = do_with(size_t(0), [&in] (size_t& pos) {
+            return repeat([&in, &pos] {
+                return in.read().then([&pos] (temporary_buffer<char> buf) {
+                    for (auto c : buf) {
+                        BOOST_REQUIRE_EQUAL(c, char('a' + pos++ / buffer_size));
+                    }
+                    return buf.empty() ? stop_iteration::yes : stop_iteration::no;
+                });
+            }).then([&pos] {
+                return pos;
+            });
+        });
+
+        auto out = cc.output();
+        for (size_t i = 0; i < nr_buffers; ++i) {
+            storage.push_back(std::make_unique<char[]>(buffer_size));
+            std::fill_n(storage.back().get(), buffer_size, char('a' + i));
+            out.write(temporary_buffer<char>(storage.back().get(), buffer_size, make_deleter([&released] {
+                ++released;
+            }))).get();
+        }
+        out.close().get();
+        BOOST_REQUIRE_EQUAL(received.get0(), nr_buffers * buffer_size);
+
+        // Buffers sent with MSG_ZEROCOPY are only released once their
+        // completion is read from the socket's error queue.
+        for (auto i = 0; i < 500 && released < nr_buffers; ++i) {
+            sleep(10ms).get();
+        }
+        BOOST_REQUIRE_EQUAL(released, nr_buffers);
+
+        in.close().get();
+        sc.abort_accept();
+    });
+}